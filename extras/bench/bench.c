@@ -0,0 +1,307 @@
+// A microbenchmark of the lwmqtt packet codec.
+//
+// Every encoder and decoder of packet.c and the variable number helpers of helpers.c are run in a tight loop on
+// prepared buffers. Publish packets are swept over topic and payload sizes, subscribe and unsubscribe packets over the
+// number of topic filters. Each case runs for a fixed time and reports the nanoseconds per packet and the packets per
+// second. The publish encoder only writes the header as the client sends the payload separately, and the publish
+// decoder only points into the payload, so the payload size merely affects the remaining length and a throughput in
+// bytes would not be meaningful.
+//
+// Build using "make bench" and run "extras/bench/bench [seconds per case] [filter]".
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet.h"
+
+// the size of the buffers used for encoding and decoding
+#define BENCH_BUF_SIZE 8192
+
+// the number of iterations between clock reads
+#define BENCH_BATCH 1024
+
+typedef struct {
+  lwmqtt_string_t topic;
+  lwmqtt_message_t msg;
+  lwmqtt_string_t filters[16];
+  lwmqtt_qos_t qos[16];
+  int count;
+  uint32_t varnum;
+  uint8_t *encoded;
+  size_t encoded_len;
+  uint8_t *buf;
+} bench_case_t;
+
+typedef lwmqtt_err_t (*bench_fn_t)(bench_case_t *c);
+
+static double bench_seconds = 0.2;
+static const char *bench_filter = NULL;
+static volatile size_t bench_sink;
+
+static uint8_t bench_buf[BENCH_BUF_SIZE];
+static uint8_t bench_encoded[BENCH_BUF_SIZE];
+static uint8_t bench_payload[BENCH_BUF_SIZE];
+static char bench_topic[256];
+static char bench_filters[16][64];
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static lwmqtt_err_t bench_encode_connect(bench_case_t *c) {
+  lwmqtt_connect_options_t options = lwmqtt_default_connect_options;
+  options.client_id = c->topic;
+  options.username = lwmqtt_string("username");
+  options.password = lwmqtt_string("password");
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_connect(c->buf, BENCH_BUF_SIZE, &len, &options, NULL);
+  bench_sink = len;
+  return err;
+}
+
+static lwmqtt_err_t bench_decode_connack(bench_case_t *c) {
+  bool session_present;
+  lwmqtt_return_code_t return_code;
+  lwmqtt_err_t err = lwmqtt_decode_connack(c->encoded, c->encoded_len, &session_present, &return_code);
+  bench_sink = return_code;
+  return err;
+}
+
+static lwmqtt_err_t bench_encode_zero(bench_case_t *c) {
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_zero(c->buf, BENCH_BUF_SIZE, &len, LWMQTT_PINGREQ_PACKET);
+  bench_sink = len;
+  return err;
+}
+
+static lwmqtt_err_t bench_encode_ack(bench_case_t *c) {
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_ack(c->buf, BENCH_BUF_SIZE, &len, LWMQTT_PUBACK_PACKET, 4242);
+  bench_sink = len;
+  return err;
+}
+
+static lwmqtt_err_t bench_decode_ack(bench_case_t *c) {
+  uint16_t packet_id;
+  lwmqtt_err_t err = lwmqtt_decode_ack(c->encoded, c->encoded_len, LWMQTT_PUBACK_PACKET, &packet_id);
+  bench_sink = packet_id;
+  return err;
+}
+
+static lwmqtt_err_t bench_decode_packet_id(bench_case_t *c) {
+  uint16_t packet_id;
+  lwmqtt_err_t err = lwmqtt_decode_packet_id(c->encoded, c->encoded_len, &packet_id);
+  bench_sink = packet_id;
+  return err;
+}
+
+static lwmqtt_err_t bench_detect(bench_case_t *c) {
+  lwmqtt_packet_type_t packet_type;
+  uint32_t rem_len = 0;
+  lwmqtt_err_t err = lwmqtt_detect_packet_type(c->encoded, c->encoded_len, &packet_type);
+  if (err == LWMQTT_SUCCESS) {
+    err = lwmqtt_detect_remaining_length(c->encoded + 1, c->encoded_len - 1, &rem_len);
+  }
+  bench_sink = rem_len;
+  return err;
+}
+
+static lwmqtt_err_t bench_encode_publish(bench_case_t *c) {
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_publish(c->buf, BENCH_BUF_SIZE, &len, false, 4242, c->topic, c->msg);
+  bench_sink = len;
+  return err;
+}
+
+static lwmqtt_err_t bench_decode_publish(bench_case_t *c) {
+  bool dup;
+  uint16_t packet_id;
+  lwmqtt_string_t topic;
+  lwmqtt_message_t msg;
+  lwmqtt_err_t err = lwmqtt_decode_publish(c->encoded, c->encoded_len, &dup, &packet_id, &topic, &msg);
+  bench_sink = msg.payload_len;
+  return err;
+}
+
+static lwmqtt_err_t bench_encode_subscribe(bench_case_t *c) {
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_subscribe(c->buf, BENCH_BUF_SIZE, &len, 4242, c->count, c->filters, c->qos);
+  bench_sink = len;
+  return err;
+}
+
+static lwmqtt_err_t bench_decode_suback(bench_case_t *c) {
+  uint16_t packet_id;
+  int count;
+  lwmqtt_qos_t granted[16];
+  lwmqtt_err_t err = lwmqtt_decode_suback(c->encoded, c->encoded_len, &packet_id, 16, &count, granted);
+  bench_sink = (size_t)count;
+  return err;
+}
+
+static lwmqtt_err_t bench_encode_unsubscribe(bench_case_t *c) {
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_unsubscribe(c->buf, BENCH_BUF_SIZE, &len, 4242, c->count, c->filters);
+  bench_sink = len;
+  return err;
+}
+
+static lwmqtt_err_t bench_write_varnum(bench_case_t *c) {
+  uint8_t *ptr = c->buf;
+  lwmqtt_err_t err = lwmqtt_write_varnum(&ptr, c->buf + BENCH_BUF_SIZE, c->varnum);
+  bench_sink = (size_t)(ptr - c->buf);
+  return err;
+}
+
+static lwmqtt_err_t bench_read_varnum(bench_case_t *c) {
+  uint8_t *ptr = c->encoded;
+  uint32_t varnum;
+  lwmqtt_err_t err = lwmqtt_read_varnum(&ptr, c->encoded + c->encoded_len, &varnum);
+  bench_sink = varnum;
+  return err;
+}
+
+static void bench_run(const char *name, bench_fn_t fn, bench_case_t *c) {
+  // apply filter
+  if (bench_filter != NULL && strstr(name, bench_filter) == NULL) {
+    return;
+  }
+
+  // verify the case once
+  lwmqtt_err_t err = fn(c);
+  if (err != LWMQTT_SUCCESS) {
+    printf("%-40s failed: %d\n", name, err);
+    return;
+  }
+
+  // warm up caches and branch predictors
+  for (int i = 0; i < BENCH_BATCH; i++) {
+    fn(c);
+  }
+
+  // run batches until the time is up
+  uint64_t iterations = 0;
+  double start = bench_now();
+  double elapsed;
+  do {
+    for (int i = 0; i < BENCH_BATCH; i++) {
+      fn(c);
+    }
+    iterations += BENCH_BATCH;
+    elapsed = bench_now() - start;
+  } while (elapsed < bench_seconds);
+
+  // print result
+  double ns = elapsed * 1e9 / (double)iterations;
+  printf("%-40s %10.1f ns/pkt %12.0f pkt/s\n", name, ns, (double)iterations / elapsed);
+}
+
+static void bench_prepare(bench_case_t *c, size_t topic_len, size_t payload_len, int count) {
+  // prepare topic
+  memset(bench_topic, 'a', topic_len);
+  bench_topic[topic_len] = 0;
+
+  // prepare case
+  memset(c, 0, sizeof(bench_case_t));
+  c->topic = lwmqtt_string(bench_topic);
+  c->msg.qos = LWMQTT_QOS1;
+  c->msg.payload = bench_payload;
+  c->msg.payload_len = payload_len;
+  c->count = count;
+  for (int i = 0; i < count; i++) {
+    snprintf(bench_filters[i], sizeof(bench_filters[i]), "devices/+/sensors/%d/#", i);
+    c->filters[i] = lwmqtt_string(bench_filters[i]);
+    c->qos[i] = LWMQTT_QOS1;
+  }
+  c->encoded = bench_encoded;
+  c->buf = bench_buf;
+}
+
+int main(int argc, char **argv) {
+  // parse arguments
+  if (argc > 1) {
+    bench_seconds = atof(argv[1]);
+  }
+  if (argc > 2) {
+    bench_filter = argv[2];
+  }
+
+  // prepare payload
+  for (size_t i = 0; i < sizeof(bench_payload); i++) {
+    bench_payload[i] = (uint8_t)i;
+  }
+
+  char name[64];
+  bench_case_t c;
+
+  // fixed size packets
+  bench_prepare(&c, 16, 0, 0);
+  bench_run("encode_connect", bench_encode_connect, &c);
+  memcpy(c.encoded, "\x20\x02\x01\x00", 4);
+  c.encoded_len = 4;
+  bench_run("decode_connack", bench_decode_connack, &c);
+  bench_run("encode_zero", bench_encode_zero, &c);
+  bench_run("encode_ack", bench_encode_ack, &c);
+  lwmqtt_encode_ack(c.encoded, BENCH_BUF_SIZE, &c.encoded_len, LWMQTT_PUBACK_PACKET, 4242);
+  bench_run("decode_ack", bench_decode_ack, &c);
+  bench_run("decode_packet_id", bench_decode_packet_id, &c);
+  bench_run("detect", bench_detect, &c);
+
+  // variable numbers of every encoded length
+  uint32_t varnums[] = {127, 16383, 2097151, 268435455};
+  for (int i = 0; i < 4; i++) {
+    bench_prepare(&c, 0, 0, 0);
+    c.varnum = varnums[i];
+    uint8_t *ptr = c.encoded;
+    lwmqtt_write_varnum(&ptr, c.encoded + BENCH_BUF_SIZE, c.varnum);
+    c.encoded_len = (size_t)(ptr - c.encoded);
+    snprintf(name, sizeof(name), "write_varnum/%dB", i + 1);
+    bench_run(name, bench_write_varnum, &c);
+    snprintf(name, sizeof(name), "read_varnum/%dB", i + 1);
+    bench_run(name, bench_read_varnum, &c);
+  }
+
+  // publish packets over topic and payload sizes
+  size_t topics[] = {8, 32, 128};
+  size_t payloads[] = {0, 16, 256, 4096};
+  for (int t = 0; t < 3; t++) {
+    for (int p = 0; p < 4; p++) {
+      bench_prepare(&c, topics[t], payloads[p], 0);
+      lwmqtt_encode_publish(c.encoded, BENCH_BUF_SIZE, &c.encoded_len, false, 4242, c.topic, c.msg);
+      memcpy(c.encoded + c.encoded_len, bench_payload, payloads[p]);
+      c.encoded_len += payloads[p];
+      snprintf(name, sizeof(name), "encode_publish/t%zu/p%zu", topics[t], payloads[p]);
+      bench_run(name, bench_encode_publish, &c);
+      snprintf(name, sizeof(name), "decode_publish/t%zu/p%zu", topics[t], payloads[p]);
+      bench_run(name, bench_decode_publish, &c);
+    }
+  }
+
+  // subscribe and unsubscribe packets over filter counts
+  int counts[] = {1, 4, 16};
+  for (int i = 0; i < 3; i++) {
+    bench_prepare(&c, 0, 0, counts[i]);
+    snprintf(name, sizeof(name), "encode_subscribe/n%d", counts[i]);
+    bench_run(name, bench_encode_subscribe, &c);
+    snprintf(name, sizeof(name), "encode_unsubscribe/n%d", counts[i]);
+    bench_run(name, bench_encode_unsubscribe, &c);
+
+    // prepare suback with the same count
+    c.encoded[0] = LWMQTT_SUBACK_PACKET << 4;
+    c.encoded[1] = (uint8_t)(2 + counts[i]);
+    c.encoded[2] = 0x10;
+    c.encoded[3] = 0x92;
+    memset(c.encoded + 4, 1, (size_t)counts[i]);
+    c.encoded_len = (size_t)(4 + counts[i]);
+    snprintf(name, sizeof(name), "decode_suback/n%d", counts[i]);
+    bench_run(name, bench_decode_suback, &c);
+  }
+
+  return 0;
+}
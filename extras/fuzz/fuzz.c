@@ -0,0 +1,337 @@
+// Fuzz targets for the decoders of the lwmqtt packet codec.
+//
+// Every target feeds the input to one decoder in an exactly sized heap buffer, so that sanitizers catch reads past
+// its end, and checks that decoded strings and payloads lie within the input. Successfully decoded values are
+// encoded again and decoded a second time, which must yield the same values.
+//
+// The target is selected at compile time using -DFUZZ_TARGET=<name> with one of: detect, connack, ack, packet_id,
+// publish, suback, varnum, string. Built with clang and -fsanitize=fuzzer, the file is a coverage-guided libFuzzer
+// target that reports exec/s itself. Built with any other compiler, a driver is included that replays the files passed
+// as arguments or, without arguments, mutates seed packets for ten seconds and reports exec/s.
+//
+// Build using "make fuzz" (clang) or "make fuzz-driver" and see the Makefile for how to run the targets.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet.h"
+
+#ifndef FUZZ_TARGET
+#define FUZZ_TARGET publish
+#endif
+
+#define FUZZ_STRINGIFY(name) #name
+#define FUZZ_NAME(name) FUZZ_STRINGIFY(name)
+
+// aborts on a violated invariant so the fuzzer records the input
+#define FUZZ_CHECK(cond)                                                                \
+  do {                                                                                  \
+    if (!(cond)) {                                                                      \
+      fprintf(stderr, "check failed: %s (%s:%d)\n", #cond, __FILE__, __LINE__);         \
+      abort();                                                                          \
+    }                                                                                   \
+  } while (0)
+
+static bool fuzz_within(uint8_t *buf, size_t len, void *ptr, size_t ptr_len) {
+  // check that the range lies within the buffer
+  return ptr_len == 0 || ((uint8_t *)ptr >= buf && (uint8_t *)ptr + ptr_len <= buf + len);
+}
+
+static void fuzz_detect(uint8_t *buf, size_t len) {
+  // detect packet type
+  lwmqtt_packet_type_t packet_type;
+  lwmqtt_err_t err = lwmqtt_detect_packet_type(buf, len, &packet_type);
+  FUZZ_CHECK(err == LWMQTT_SUCCESS || packet_type == LWMQTT_NO_PACKET);
+
+  // detect remaining length
+  uint32_t rem_len;
+  if (len > 0 && lwmqtt_detect_remaining_length(buf + 1, len - 1, &rem_len) == LWMQTT_SUCCESS) {
+    // a decoded length must encode into at most four bytes
+    int rem_len_len;
+    FUZZ_CHECK(lwmqtt_varnum_length(rem_len, &rem_len_len) == LWMQTT_SUCCESS);
+    FUZZ_CHECK((size_t)rem_len_len <= len - 1);
+  }
+}
+
+static void fuzz_connack(uint8_t *buf, size_t len) {
+  // decode connack
+  bool session_present;
+  lwmqtt_return_code_t return_code;
+  if (lwmqtt_decode_connack(buf, len, &session_present, &return_code) != LWMQTT_SUCCESS) {
+    return;
+  }
+
+  // check return code
+  FUZZ_CHECK(return_code <= LWMQTT_UNKNOWN_RETURN_CODE);
+}
+
+static void fuzz_ack(uint8_t *buf, size_t len) {
+  // decode all acknowledgement types and encode them again
+  lwmqtt_packet_type_t types[] = {LWMQTT_PUBACK_PACKET, LWMQTT_PUBREC_PACKET, LWMQTT_PUBREL_PACKET,
+                                  LWMQTT_PUBCOMP_PACKET, LWMQTT_UNSUBACK_PACKET};
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    uint16_t packet_id;
+    if (lwmqtt_decode_ack(buf, len, types[i], &packet_id) != LWMQTT_SUCCESS) {
+      continue;
+    }
+
+    // check round trip
+    uint8_t out[4];
+    size_t out_len;
+    uint16_t decoded;
+    FUZZ_CHECK(lwmqtt_encode_ack(out, sizeof(out), &out_len, types[i], packet_id) == LWMQTT_SUCCESS);
+    FUZZ_CHECK(lwmqtt_decode_ack(out, out_len, types[i], &decoded) == LWMQTT_SUCCESS);
+    FUZZ_CHECK(decoded == packet_id);
+  }
+}
+
+static void fuzz_packet_id(uint8_t *buf, size_t len) {
+  // decode packet id
+  uint16_t packet_id;
+  if (lwmqtt_decode_packet_id(buf, len, &packet_id) != LWMQTT_SUCCESS) {
+    return;
+  }
+
+  // the packet id follows the header
+  FUZZ_CHECK(len >= 4);
+}
+
+static void fuzz_publish(uint8_t *buf, size_t len) {
+  // decode publish
+  bool dup;
+  uint16_t packet_id = 0;
+  lwmqtt_string_t topic;
+  lwmqtt_message_t msg;
+  if (lwmqtt_decode_publish(buf, len, &dup, &packet_id, &topic, &msg) != LWMQTT_SUCCESS) {
+    return;
+  }
+
+  // check that topic and payload reference the input
+  FUZZ_CHECK(fuzz_within(buf, len, topic.data, topic.len));
+  FUZZ_CHECK(fuzz_within(buf, len, msg.payload, msg.payload_len));
+  FUZZ_CHECK(msg.qos == LWMQTT_QOS0 || packet_id > 0);
+
+  // encode header again and append payload
+  size_t out_size = len + 8;
+  uint8_t *out = malloc(out_size);
+  size_t out_len;
+  FUZZ_CHECK(lwmqtt_encode_publish(out, out_size, &out_len, dup, packet_id, topic, msg) == LWMQTT_SUCCESS);
+  FUZZ_CHECK(out_len + msg.payload_len <= out_size);
+  memcpy(out + out_len, msg.payload, msg.payload_len);
+  out_len += msg.payload_len;
+
+  // check round trip
+  bool dup2;
+  uint16_t packet_id2 = 0;
+  lwmqtt_string_t topic2;
+  lwmqtt_message_t msg2;
+  FUZZ_CHECK(lwmqtt_decode_publish(out, out_len, &dup2, &packet_id2, &topic2, &msg2) == LWMQTT_SUCCESS);
+  FUZZ_CHECK(dup2 == dup && packet_id2 == packet_id && msg2.qos == msg.qos && msg2.retained == msg.retained);
+  FUZZ_CHECK(topic2.len == topic.len && memcmp(topic2.data, topic.data, topic.len) == 0);
+  FUZZ_CHECK(msg2.payload_len == msg.payload_len && memcmp(msg2.payload, msg.payload, msg.payload_len) == 0);
+  free(out);
+}
+
+static void fuzz_suback(uint8_t *buf, size_t len) {
+  // decode suback
+  uint16_t packet_id;
+  int count = 0;
+  lwmqtt_qos_t granted[8];
+  if (lwmqtt_decode_suback(buf, len, &packet_id, 8, &count, granted) != LWMQTT_SUCCESS) {
+    return;
+  }
+
+  // check granted levels
+  FUZZ_CHECK(count >= 1 && count <= 8);
+  for (int i = 0; i < count; i++) {
+    FUZZ_CHECK(granted[i] == LWMQTT_QOS0 || granted[i] == LWMQTT_QOS1 || granted[i] == LWMQTT_QOS2 ||
+               granted[i] == LWMQTT_QOS_FAILURE);
+  }
+}
+
+static void fuzz_varnum(uint8_t *buf, size_t len) {
+  // read varnum
+  uint8_t *ptr = buf;
+  uint32_t varnum;
+  if (lwmqtt_read_varnum(&ptr, buf + len, &varnum) != LWMQTT_SUCCESS) {
+    return;
+  }
+  FUZZ_CHECK(ptr > buf && ptr <= buf + len && ptr - buf <= 4);
+
+  // check round trip with the minimal encoding
+  uint8_t out[4];
+  uint8_t *out_ptr = out;
+  FUZZ_CHECK(lwmqtt_write_varnum(&out_ptr, out + sizeof(out), varnum) == LWMQTT_SUCCESS);
+  FUZZ_CHECK(out_ptr - out <= ptr - buf);
+  int varnum_len;
+  FUZZ_CHECK(lwmqtt_varnum_length(varnum, &varnum_len) == LWMQTT_SUCCESS && varnum_len == out_ptr - out);
+  uint8_t *in_ptr = out;
+  uint32_t decoded;
+  FUZZ_CHECK(lwmqtt_read_varnum(&in_ptr, out_ptr, &decoded) == LWMQTT_SUCCESS && decoded == varnum);
+}
+
+static void fuzz_string(uint8_t *buf, size_t len) {
+  // read strings until the input is exhausted
+  uint8_t *ptr = buf;
+  lwmqtt_string_t str;
+  while (lwmqtt_read_string(&ptr, buf + len, &str) == LWMQTT_SUCCESS) {
+    FUZZ_CHECK(fuzz_within(buf, len, str.data, str.len));
+    FUZZ_CHECK(ptr <= buf + len);
+  }
+}
+
+typedef void (*fuzz_target_t)(uint8_t *buf, size_t len);
+
+static struct {
+  const char *name;
+  fuzz_target_t fn;
+} fuzz_targets[] = {
+    {"detect", fuzz_detect}, {"connack", fuzz_connack}, {"ack", fuzz_ack},       {"packet_id", fuzz_packet_id},
+    {"publish", fuzz_publish}, {"suback", fuzz_suback}, {"varnum", fuzz_varnum}, {"string", fuzz_string},
+};
+
+static fuzz_target_t fuzz_target(void) {
+  // look up the selected target once
+  static fuzz_target_t target = NULL;
+  if (target == NULL) {
+    for (size_t i = 0; i < sizeof(fuzz_targets) / sizeof(fuzz_targets[0]); i++) {
+      if (strcmp(fuzz_targets[i].name, FUZZ_NAME(FUZZ_TARGET)) == 0) {
+        target = fuzz_targets[i].fn;
+      }
+    }
+    FUZZ_CHECK(target != NULL);
+  }
+
+  return target;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  // copy input into an exactly sized buffer as the decoders take mutable pointers
+  uint8_t *buf = malloc(size > 0 ? size : 1);
+  memcpy(buf, data, size);
+
+  // run target
+  fuzz_target()(buf, size);
+  free(buf);
+
+  return 0;
+}
+
+#if !defined(FUZZ_LIBFUZZER)
+
+static uint64_t fuzz_random_state = 0x2545f4914f6cdd1dull;
+
+static uint64_t fuzz_random(void) {
+  // advance xorshift64 state
+  fuzz_random_state ^= fuzz_random_state << 13;
+  fuzz_random_state ^= fuzz_random_state >> 7;
+  fuzz_random_state ^= fuzz_random_state << 17;
+  return fuzz_random_state;
+}
+
+static size_t fuzz_seeds(uint8_t seeds[][64], size_t *lens) {
+  // encode one valid packet of every type as seeds
+  size_t n = 0;
+  lwmqtt_message_t msg = {LWMQTT_QOS1, true, (uint8_t *)"payload", 7};
+  lwmqtt_encode_publish(seeds[n], 64, &lens[n], false, 7, lwmqtt_string("a/b/c"), msg);
+  memcpy(seeds[n] + lens[n], msg.payload, msg.payload_len);
+  lens[n++] += msg.payload_len;
+  lwmqtt_encode_ack(seeds[n], 64, &lens[n], LWMQTT_PUBACK_PACKET, 7);
+  n++;
+  lwmqtt_encode_ack(seeds[n], 64, &lens[n], LWMQTT_PUBREL_PACKET, 8);
+  n++;
+  memcpy(seeds[n], "\x20\x02\x01\x00", 4);
+  lens[n++] = 4;
+  memcpy(seeds[n], "\x90\x05\x00\x07\x00\x01\x80", 7);
+  lens[n++] = 7;
+  memcpy(seeds[n], "\xff\xff\xff\x7f", 4);
+  lens[n++] = 4;
+  memcpy(seeds[n], "\x00\x03" "abc\x00\x00", 7);
+  lens[n++] = 7;
+
+  return n;
+}
+
+static int fuzz_replay(int argc, char **argv) {
+  // run every file once
+  for (int i = 1; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    uint8_t data[65536];
+    size_t size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, size);
+    printf("%s: ok\n", argv[i]);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  // replay files if given
+  if (argc > 1) {
+    return fuzz_replay(argc, argv);
+  }
+
+  // prepare seeds
+  uint8_t seeds[8][64];
+  size_t lens[8];
+  size_t count = fuzz_seeds(seeds, lens);
+
+  // mutate seeds until the time is up
+  printf("fuzzing %s for 10s\n", FUZZ_NAME(FUZZ_TARGET));
+  uint8_t input[128];
+  uint64_t execs = 0;
+  time_t start = time(NULL);
+  time_t last = start;
+  while (time(NULL) - start < 10) {
+    for (int i = 0; i < 4096; i++) {
+      // pick seed
+      size_t s = fuzz_random() % count;
+      size_t len = lens[s];
+      memcpy(input, seeds[s], len);
+
+      // flip, set or insert bytes and truncate or extend the input
+      int mutations = 1 + (int)(fuzz_random() % 4);
+      for (int m = 0; m < mutations; m++) {
+        uint64_t r = fuzz_random();
+        switch (r % 4) {
+          case 0:
+            input[(r >> 8) % len] ^= (uint8_t)(1u << ((r >> 16) % 8));
+            break;
+          case 1:
+            input[(r >> 8) % len] = (uint8_t)(r >> 16);
+            break;
+          case 2:
+            len = 1 + (r >> 8) % len;
+            break;
+          default:
+            if (len < sizeof(input)) {
+              input[len++] = (uint8_t)(r >> 8);
+            }
+        }
+      }
+
+      LLVMFuzzerTestOneInput(input, len);
+      execs++;
+    }
+
+    // report progress
+    time_t now = time(NULL);
+    if (now != last) {
+      printf("#%llu exec/s: %llu\n", (unsigned long long)execs, (unsigned long long)(execs / (uint64_t)(now - start)));
+      last = now;
+    }
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,879 @@
+// A load generator that simulates a fleet of devices using the lwmqtt client and codec.
+//
+// The clients are distributed over worker threads. Every worker multiplexes its clients over non-blocking sockets
+// using epoll: connections are established concurrently, incoming packets are only read once the socket reports
+// readability and publishes as well as keep alives are driven by per client deadlines. The connect handshake is a state
+// machine as well: the connect packet is written once the socket is writable and the connack is decoded once the
+// socket is readable, so no worker ever waits for the broker to respond.
+//
+// Build using "make loadgen" and run "extras/loadgen/loadgen --help" for the available options.
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "linux.h"
+#include "lwmqtt.h"
+
+// the number of sub buckets per power of two of the latency histograms
+#define LOADGEN_SUB_BUCKETS 16
+
+// the number of latency histogram buckets, enough for values up to 2^40 microseconds
+#define LOADGEN_BUCKETS (41 * LOADGEN_SUB_BUCKETS)
+
+// the maximum number of concurrent tcp connection attempts per worker
+#define LOADGEN_MAX_PENDING 64
+
+typedef enum {
+  LOADGEN_IDLE = 0,
+  LOADGEN_CONNECTING,
+  LOADGEN_HANDSHAKING,
+  LOADGEN_CONNECTED,
+} loadgen_state_t;
+
+typedef struct {
+  uint64_t counts[LOADGEN_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+} loadgen_histogram_t;
+
+typedef struct {
+  uint64_t deadline;
+} loadgen_timer_t;
+
+typedef struct loadgen_worker_t loadgen_worker_t;
+
+typedef struct {
+  int index;
+  lwmqtt_linux_network_t network;
+  loadgen_state_t state;
+  loadgen_worker_t *worker;
+
+  lwmqtt_client_t client;
+  loadgen_timer_t keep_alive_timer, command_timer;
+  uint8_t *write_buf, *read_buf;
+
+  char id[32];
+  char topic[64];
+  bool publisher, subscriber;
+
+  uint64_t connect_start;
+  uint64_t next_publish;
+  uint64_t next_attempt;
+  uint32_t sequence;
+
+  uint64_t latency_sum;
+  uint64_t latency_count;
+} loadgen_client_t;
+
+typedef struct {
+  uint64_t connects;
+  uint64_t disconnects;
+  uint64_t connect_errors;
+  uint64_t errors;
+  uint64_t published;
+  uint64_t backlogged;
+  uint64_t received;
+  uint64_t bytes_out;
+  uint64_t bytes_in;
+  uint64_t connected;
+} loadgen_counters_t;
+
+struct loadgen_worker_t {
+  int index;
+  int epoll;
+  pthread_t thread;
+  uint64_t random;
+
+  loadgen_client_t *clients;
+  int count;
+  int pending;
+  double ramp;
+  uint64_t next_open;
+
+  loadgen_counters_t counters;
+  loadgen_histogram_t connect_latency;
+  loadgen_histogram_t message_latency;
+};
+
+static struct {
+  const char *host;
+  int port;
+  int clients;
+  int threads;
+  int duration;
+  int interval;
+  double rate;
+  int size;
+  int qos;
+  int keep_alive;
+  int subscribers;
+  int idle;
+  double ramp;
+  uint32_t timeout;
+  size_t buffer;
+  const char *prefix;
+  struct sockaddr_storage address;
+  socklen_t address_len;
+} loadgen_options = {
+    .host = "127.0.0.1",
+    .port = 1883,
+    .clients = 1000,
+    .threads = 4,
+    .duration = 30,
+    .interval = 1,
+    .rate = 1,
+    .size = 64,
+    .qos = 0,
+    .keep_alive = 60,
+    .subscribers = 100,
+    .idle = 0,
+    .ramp = 0,
+    .timeout = 5000,
+    .buffer = 1024,
+    .prefix = "loadgen",
+};
+
+static volatile sig_atomic_t loadgen_stop = 0;
+
+static uint64_t loadgen_now(void) {
+  // get monotonic time in microseconds
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t loadgen_random(loadgen_worker_t *worker) {
+  // advance xorshift64 state
+  uint64_t x = worker->random;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  worker->random = x;
+
+  return x;
+}
+
+static uint64_t loadgen_exponential(loadgen_worker_t *worker, double rate) {
+  // draw an exponentially distributed interval in microseconds to model independent devices
+  double u = (double)(loadgen_random(worker) >> 11) / (double)(1ull << 53);
+  return (uint64_t)(-log(1.0 - u) / rate * 1000000.0);
+}
+
+static void loadgen_count(uint64_t *counter, uint64_t value) {
+  // counters are read by the main thread while workers are running
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t loadgen_load(uint64_t *counter) { return __atomic_load_n(counter, __ATOMIC_RELAXED); }
+
+static int loadgen_bucket(uint64_t value) {
+  // values below the sub bucket count are recorded exactly
+  if (value < LOADGEN_SUB_BUCKETS) {
+    return (int)value;
+  }
+
+  // otherwise use the most significant bit and the following four bits
+  int msb = 63 - __builtin_clzll(value);
+  int index = (msb - 3) * LOADGEN_SUB_BUCKETS + (int)((value >> (msb - 4)) & (LOADGEN_SUB_BUCKETS - 1));
+  if (index >= LOADGEN_BUCKETS) {
+    index = LOADGEN_BUCKETS - 1;
+  }
+
+  return index;
+}
+
+static uint64_t loadgen_bucket_value(int index) {
+  // return the lower bound of the bucket
+  if (index < LOADGEN_SUB_BUCKETS) {
+    return (uint64_t)index;
+  }
+  int msb = index / LOADGEN_SUB_BUCKETS + 3;
+  uint64_t sub = (uint64_t)(index % LOADGEN_SUB_BUCKETS);
+  return (1ull << msb) | (sub << (msb - 4));
+}
+
+static void loadgen_record(loadgen_histogram_t *histogram, uint64_t value) {
+  histogram->counts[loadgen_bucket(value)]++;
+  histogram->total++;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+static void loadgen_merge(loadgen_histogram_t *dst, loadgen_histogram_t *src) {
+  for (int i = 0; i < LOADGEN_BUCKETS; i++) {
+    dst->counts[i] += src->counts[i];
+  }
+  dst->total += src->total;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+static uint64_t loadgen_percentile(loadgen_histogram_t *histogram, double percentile) {
+  // find the bucket that contains the requested rank
+  uint64_t rank = (uint64_t)ceil(percentile / 100.0 * (double)histogram->total);
+  uint64_t seen = 0;
+  for (int i = 0; i < LOADGEN_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank && seen > 0) {
+      return loadgen_bucket_value(i);
+    }
+  }
+
+  return histogram->max;
+}
+
+static void loadgen_print_histogram(const char *name, loadgen_histogram_t *histogram) {
+  if (histogram->total == 0) {
+    printf("%-18s no samples\n", name);
+    return;
+  }
+
+  printf("%-18s n=%llu p50=%.2fms p90=%.2fms p99=%.2fms p99.9=%.2fms max=%.2fms\n", name,
+         (unsigned long long)histogram->total, loadgen_percentile(histogram, 50) / 1000.0,
+         loadgen_percentile(histogram, 90) / 1000.0, loadgen_percentile(histogram, 99) / 1000.0,
+         loadgen_percentile(histogram, 99.9) / 1000.0, histogram->max / 1000.0);
+}
+
+static void loadgen_timer_set(void *ref, uint32_t timeout) {
+  // store deadline
+  ((loadgen_timer_t *)ref)->deadline = loadgen_now() + (uint64_t)timeout * 1000;
+}
+
+static int32_t loadgen_timer_get(void *ref) {
+  // return remaining milliseconds
+  int64_t remaining = (int64_t)((loadgen_timer_t *)ref)->deadline - (int64_t)loadgen_now();
+  return (int32_t)(remaining / 1000);
+}
+
+static lwmqtt_err_t loadgen_network_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout) {
+  loadgen_client_t *c = (loadgen_client_t *)ref;
+
+  // read using the backend and count the traffic
+  lwmqtt_err_t err = lwmqtt_linux_network_read(&c->network, buf, len, read, timeout);
+  if (err == LWMQTT_SUCCESS) {
+    loadgen_count(&c->worker->counters.bytes_in, (uint64_t)*read);
+  }
+
+  return err;
+}
+
+static lwmqtt_err_t loadgen_network_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout) {
+  loadgen_client_t *c = (loadgen_client_t *)ref;
+
+  // write using the backend and count the traffic
+  lwmqtt_err_t err = lwmqtt_linux_network_write(&c->network, buf, len, sent, timeout);
+  if (err == LWMQTT_SUCCESS) {
+    loadgen_count(&c->worker->counters.bytes_out, (uint64_t)*sent);
+  }
+
+  return err;
+}
+
+static void loadgen_message(lwmqtt_client_t *client, void *ref, lwmqtt_string_t topic, lwmqtt_message_t msg) {
+  (void)client;
+  (void)topic;
+  loadgen_client_t *c = (loadgen_client_t *)ref;
+
+  // count message
+  loadgen_count(&c->worker->counters.received, 1);
+
+  // the first eight bytes carry the send time
+  if (msg.payload_len < sizeof(uint64_t)) {
+    return;
+  }
+  uint64_t sent;
+  memcpy(&sent, msg.payload, sizeof(sent));
+  uint64_t now = loadgen_now();
+  if (sent > now) {
+    return;
+  }
+
+  // record latency
+  loadgen_record(&c->worker->message_latency, now - sent);
+  c->latency_sum += now - sent;
+  c->latency_count++;
+}
+
+static void loadgen_close(loadgen_client_t *c, bool failed) {
+  // update counters
+  if (c->state == LOADGEN_CONNECTED) {
+    loadgen_count(&c->worker->counters.connected, (uint64_t)-1);
+    loadgen_count(&c->worker->counters.disconnects, 1);
+  } else if (c->state == LOADGEN_CONNECTING || c->state == LOADGEN_HANDSHAKING) {
+    c->worker->pending--;
+  }
+  if (failed) {
+    loadgen_count(c->state == LOADGEN_CONNECTED ? &c->worker->counters.errors : &c->worker->counters.connect_errors, 1);
+  }
+
+  // close socket, the descriptor is removed from the epoll set automatically
+  lwmqtt_linux_network_disconnect(&c->network);
+  c->state = LOADGEN_IDLE;
+
+  // retry after a randomized backoff to avoid reconnect storms
+  c->next_attempt = loadgen_now() + 1000000 + loadgen_random(c->worker) % 1000000;
+}
+
+static void loadgen_open(loadgen_client_t *c) {
+  // create non-blocking socket
+  c->network.fd = socket(loadgen_options.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c->network.fd < 0) {
+    loadgen_count(&c->worker->counters.connect_errors, 1);
+    c->next_attempt = loadgen_now() + 1000000;
+    return;
+  }
+
+  // disable nagle as most packets are small
+  int one = 1;
+  setsockopt(c->network.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  // start connection
+  c->connect_start = loadgen_now();
+  c->state = LOADGEN_CONNECTING;
+  c->worker->pending++;
+  int rc = connect(c->network.fd, (struct sockaddr *)&loadgen_options.address, loadgen_options.address_len);
+  if (rc < 0 && errno != EINPROGRESS) {
+    loadgen_close(c, true);
+    return;
+  }
+
+  // await writability which signals an established connection
+  struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = c};
+  if (epoll_ctl(c->worker->epoll, EPOLL_CTL_ADD, c->network.fd, &ev) < 0) {
+    loadgen_close(c, true);
+  }
+}
+
+static void loadgen_handshake(loadgen_client_t *c) {
+  // check connection result
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(c->network.fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+    loadgen_close(c, true);
+    return;
+  }
+
+  // prepare client
+  lwmqtt_init(&c->client, c->write_buf, loadgen_options.buffer, c->read_buf, loadgen_options.buffer);
+  lwmqtt_set_network(&c->client, c, loadgen_network_read, loadgen_network_write);
+  lwmqtt_set_timers(&c->client, &c->keep_alive_timer, &c->command_timer, loadgen_timer_set, loadgen_timer_get);
+  lwmqtt_set_callback(&c->client, c, loadgen_message);
+
+  // prepare options, the connack is decoded once the socket becomes readable
+  lwmqtt_connect_options_t options = lwmqtt_default_connect_options;
+  options.client_id = lwmqtt_string(c->id);
+  options.keep_alive = (uint16_t)loadgen_options.keep_alive;
+  options.skip_ack = true;
+
+  // send connect and subscribe with a single write if supported
+  lwmqtt_err_t err;
+#if LWMQTT_ENABLE_PIPELINE
+  lwmqtt_string_t filter = lwmqtt_string(c->topic);
+  lwmqtt_qos_t qos = (lwmqtt_qos_t)loadgen_options.qos;
+  err = lwmqtt_connect_pipelined(&c->client, &options, NULL, c->subscriber ? 1 : 0, &filter, &qos, 0, NULL, NULL,
+                                 loadgen_options.timeout);
+#else
+  err = lwmqtt_connect(&c->client, &options, NULL, loadgen_options.timeout);
+#endif
+  if (err != LWMQTT_SUCCESS) {
+    loadgen_close(c, true);
+    return;
+  }
+
+  // switch to readability events
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = c};
+  if (epoll_ctl(c->worker->epoll, EPOLL_CTL_MOD, c->network.fd, &ev) < 0) {
+    loadgen_close(c, true);
+    return;
+  }
+
+  // update state
+  c->state = LOADGEN_HANDSHAKING;
+}
+
+static void loadgen_connack(loadgen_client_t *c) {
+  // get available bytes
+  size_t available = 0;
+  if (lwmqtt_linux_network_peek(&c->network, &available) != LWMQTT_SUCCESS || available == 0) {
+    // readable without data means the peer closed the connection
+    loadgen_close(c, true);
+    return;
+  } else if (available < 4) {
+    // wait until the complete connack arrived
+    return;
+  }
+
+  // decode connack
+  lwmqtt_err_t err = lwmqtt_finish_connect(&c->client, NULL, loadgen_options.timeout);
+#if !LWMQTT_ENABLE_PIPELINE
+  // without pipelining the subscription is only sent now and awaited on the socket
+  if (err == LWMQTT_SUCCESS && c->subscriber) {
+    err = lwmqtt_subscribe_one(&c->client, lwmqtt_string(c->topic), (lwmqtt_qos_t)loadgen_options.qos,
+                               loadgen_options.timeout);
+  }
+#endif
+  if (err != LWMQTT_SUCCESS) {
+    loadgen_close(c, true);
+    return;
+  }
+
+  // update state
+  c->worker->pending--;
+  c->state = LOADGEN_CONNECTED;
+  uint64_t now = loadgen_now();
+  loadgen_record(&c->worker->connect_latency, now - c->connect_start);
+  loadgen_count(&c->worker->counters.connects, 1);
+  loadgen_count(&c->worker->counters.connected, 1);
+
+  // schedule first publish
+  if (c->publisher) {
+    c->next_publish = now + loadgen_exponential(c->worker, loadgen_options.rate);
+  }
+}
+
+static void loadgen_receive(loadgen_client_t *c) {
+  // get available bytes
+  size_t available = 0;
+  if (lwmqtt_linux_network_peek(&c->network, &available) != LWMQTT_SUCCESS) {
+    loadgen_close(c, true);
+    return;
+  } else if (available == 0) {
+    // readable without data means the peer closed the connection
+    loadgen_close(c, true);
+    return;
+  }
+
+  // process the packets that are already in flight
+  lwmqtt_err_t err = lwmqtt_yield(&c->client, available, loadgen_options.timeout);
+  if (err != LWMQTT_SUCCESS) {
+    loadgen_close(c, true);
+  }
+}
+
+static void loadgen_publish(loadgen_client_t *c, uint64_t now) {
+  // prepare payload with send time and sequence
+  uint8_t payload[loadgen_options.size];
+  memset(payload, 0, sizeof(payload));
+  memcpy(payload, &now, sizeof(now));
+  if (sizeof(payload) >= sizeof(now) + sizeof(c->sequence)) {
+    memcpy(payload + sizeof(now), &c->sequence, sizeof(c->sequence));
+  }
+  c->sequence++;
+
+  // publish without awaiting the acknowledgement, which is processed once it arrives
+  lwmqtt_message_t msg = lwmqtt_default_message;
+  msg.qos = (lwmqtt_qos_t)loadgen_options.qos;
+  msg.payload = payload;
+  msg.payload_len = sizeof(payload);
+  lwmqtt_publish_options_t options = lwmqtt_default_publish_options;
+  options.skip_ack = true;
+  lwmqtt_err_t err = lwmqtt_publish(&c->client, &options, lwmqtt_string(c->topic), msg, loadgen_options.timeout);
+  if (err == LWMQTT_PACKET_IDS_EXHAUSTED) {
+    // the broker is not keeping up with acknowledgements
+    loadgen_count(&c->worker->counters.backlogged, 1);
+  } else if (err != LWMQTT_SUCCESS) {
+    loadgen_close(c, true);
+    return;
+  } else {
+    loadgen_count(&c->worker->counters.published, 1);
+  }
+
+  // schedule next publish
+  c->next_publish = now + loadgen_exponential(c->worker, loadgen_options.rate);
+}
+
+static uint64_t loadgen_service(loadgen_worker_t *w) {
+  // service timed work and return the next deadline
+  uint64_t now = loadgen_now();
+  uint64_t next = now + 100000;
+  for (int i = 0; i < w->count && !loadgen_stop; i++) {
+    loadgen_client_t *c = &w->clients[i];
+
+    // open idle clients within the ramp and pending limits
+    if (c->state == LOADGEN_IDLE) {
+      if (c->next_attempt > now) {
+        next = c->next_attempt < next ? c->next_attempt : next;
+        continue;
+      } else if (w->pending >= LOADGEN_MAX_PENDING || w->next_open > now) {
+        next = w->next_open > now && w->next_open < next ? w->next_open : next;
+        continue;
+      }
+      loadgen_open(c);
+      if (w->ramp > 0) {
+        w->next_open = now + (uint64_t)(1000000.0 / w->ramp);
+      }
+      continue;
+    } else if (c->state != LOADGEN_CONNECTED) {
+      // abort connection attempts that did not complete in time
+      uint64_t deadline = c->connect_start + (uint64_t)loadgen_options.timeout * 1000;
+      if (deadline <= now) {
+        loadgen_close(c, true);
+      } else if (deadline < next) {
+        next = deadline;
+      }
+      continue;
+    }
+
+    // publish if due
+    if (c->publisher && c->next_publish <= now) {
+      loadgen_publish(c, now);
+      if (c->state != LOADGEN_CONNECTED) {
+        continue;
+      }
+    }
+    if (c->publisher && c->next_publish < next) {
+      next = c->next_publish;
+    }
+
+    // send ping if due
+    uint32_t deadline = lwmqtt_next_deadline(&c->client);
+    if (deadline == 0) {
+      lwmqtt_err_t err = lwmqtt_keep_alive(&c->client, loadgen_options.timeout);
+      if (err != LWMQTT_SUCCESS) {
+        loadgen_close(c, true);
+        continue;
+      }
+      deadline = lwmqtt_next_deadline(&c->client);
+    }
+    if (deadline != UINT32_MAX && now + (uint64_t)deadline * 1000 < next) {
+      next = now + (uint64_t)deadline * 1000;
+    }
+  }
+
+  return next;
+}
+
+static void *loadgen_run(void *arg) {
+  loadgen_worker_t *w = (loadgen_worker_t *)arg;
+  struct epoll_event events[256];
+
+  while (!loadgen_stop) {
+    // service deadlines
+    uint64_t next = loadgen_service(w);
+
+    // wait for events until the next deadline
+    uint64_t now = loadgen_now();
+    int timeout = next > now ? (int)((next - now + 999) / 1000) : 0;
+    int n = epoll_wait(w->epoll, events, 256, timeout);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+
+    // handle events
+    for (int i = 0; i < n; i++) {
+      loadgen_client_t *c = (loadgen_client_t *)events[i].data.ptr;
+      if (c->state == LOADGEN_CONNECTING) {
+        loadgen_handshake(c);
+      } else if (c->state == LOADGEN_HANDSHAKING) {
+        loadgen_connack(c);
+      } else if (c->state == LOADGEN_CONNECTED) {
+        loadgen_receive(c);
+      }
+    }
+  }
+
+  // disconnect gracefully
+  for (int i = 0; i < w->count; i++) {
+    loadgen_client_t *c = &w->clients[i];
+    if (c->state == LOADGEN_CONNECTED) {
+      lwmqtt_disconnect(&c->client, loadgen_options.timeout);
+    }
+    if (c->state != LOADGEN_IDLE) {
+      loadgen_close(c, false);
+    }
+  }
+
+  return NULL;
+}
+
+static void loadgen_sum(loadgen_worker_t *workers, loadgen_counters_t *sum) {
+  memset(sum, 0, sizeof(*sum));
+  for (int i = 0; i < loadgen_options.threads; i++) {
+    loadgen_counters_t *c = &workers[i].counters;
+    sum->connects += loadgen_load(&c->connects);
+    sum->disconnects += loadgen_load(&c->disconnects);
+    sum->connect_errors += loadgen_load(&c->connect_errors);
+    sum->errors += loadgen_load(&c->errors);
+    sum->published += loadgen_load(&c->published);
+    sum->backlogged += loadgen_load(&c->backlogged);
+    sum->received += loadgen_load(&c->received);
+    sum->bytes_out += loadgen_load(&c->bytes_out);
+    sum->bytes_in += loadgen_load(&c->bytes_in);
+    sum->connected += loadgen_load(&c->connected);
+  }
+}
+
+static void loadgen_usage(void) {
+  fprintf(stderr,
+          "usage: loadgen [options]\n"
+          "  -h, --host HOST         broker host (default 127.0.0.1)\n"
+          "  -p, --port PORT         broker port (default 1883)\n"
+          "  -c, --clients N         number of simulated devices (default 1000)\n"
+          "  -t, --threads N         number of worker threads (default 4)\n"
+          "  -d, --duration S        test duration in seconds (default 30)\n"
+          "  -i, --interval S        report interval in seconds (default 1)\n"
+          "  -r, --rate R            publishes per second per publishing device (default 1)\n"
+          "  -s, --size N            payload size in bytes, at least 8 (default 64)\n"
+          "  -q, --qos N             publish and subscribe qos 0 or 1 (default 0)\n"
+          "  -k, --keep-alive S      keep alive interval in seconds (default 60)\n"
+          "  -S, --subscribers PCT   percentage of devices subscribing to their own topic (default 100)\n"
+          "  -I, --idle PCT          percentage of devices that only keep the connection alive (default 0)\n"
+          "  -R, --ramp N            connection attempts per second, zero for unlimited (default 0)\n"
+          "  -T, --timeout MS        command timeout in milliseconds (default 5000)\n"
+          "  -b, --buffer N          read and write buffer size per device (default 1024)\n"
+          "  -P, --prefix STR        client id and topic prefix (default loadgen)\n");
+}
+
+static void loadgen_signal(int sig) {
+  (void)sig;
+  loadgen_stop = 1;
+}
+
+int main(int argc, char **argv) {
+  // parse options
+  static struct option long_options[] = {
+      {"host", required_argument, 0, 'h'},
+      {"port", required_argument, 0, 'p'},
+      {"clients", required_argument, 0, 'c'},
+      {"threads", required_argument, 0, 't'},
+      {"duration", required_argument, 0, 'd'},
+      {"interval", required_argument, 0, 'i'},
+      {"rate", required_argument, 0, 'r'},
+      {"size", required_argument, 0, 's'},
+      {"qos", required_argument, 0, 'q'},
+      {"keep-alive", required_argument, 0, 'k'},
+      {"subscribers", required_argument, 0, 'S'},
+      {"idle", required_argument, 0, 'I'},
+      {"ramp", required_argument, 0, 'R'},
+      {"timeout", required_argument, 0, 'T'},
+      {"buffer", required_argument, 0, 'b'},
+      {"prefix", required_argument, 0, 'P'},
+      {"help", no_argument, 0, '?'},
+      {0, 0, 0, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h:p:c:t:d:i:r:s:q:k:S:I:R:T:b:P:", long_options, NULL)) != -1) {
+    switch (opt) {
+      case 'h':
+        loadgen_options.host = optarg;
+        break;
+      case 'p':
+        loadgen_options.port = atoi(optarg);
+        break;
+      case 'c':
+        loadgen_options.clients = atoi(optarg);
+        break;
+      case 't':
+        loadgen_options.threads = atoi(optarg);
+        break;
+      case 'd':
+        loadgen_options.duration = atoi(optarg);
+        break;
+      case 'i':
+        loadgen_options.interval = atoi(optarg);
+        break;
+      case 'r':
+        loadgen_options.rate = atof(optarg);
+        break;
+      case 's':
+        loadgen_options.size = atoi(optarg);
+        break;
+      case 'q':
+        loadgen_options.qos = atoi(optarg);
+        break;
+      case 'k':
+        loadgen_options.keep_alive = atoi(optarg);
+        break;
+      case 'S':
+        loadgen_options.subscribers = atoi(optarg);
+        break;
+      case 'I':
+        loadgen_options.idle = atoi(optarg);
+        break;
+      case 'R':
+        loadgen_options.ramp = atof(optarg);
+        break;
+      case 'T':
+        loadgen_options.timeout = (uint32_t)atoi(optarg);
+        break;
+      case 'b':
+        loadgen_options.buffer = (size_t)atoi(optarg);
+        break;
+      case 'P':
+        loadgen_options.prefix = optarg;
+        break;
+      default:
+        loadgen_usage();
+        return 1;
+    }
+  }
+
+  // validate options
+  if (loadgen_options.clients <= 0 || loadgen_options.threads <= 0 || loadgen_options.interval <= 0 ||
+      loadgen_options.rate <= 0 || loadgen_options.size < 8 || loadgen_options.qos < 0 || loadgen_options.qos > 1 ||
+      (size_t)loadgen_options.size + 80 > loadgen_options.buffer) {
+    fprintf(stderr, "invalid options, the payload and topic must fit into the buffer\n");
+    loadgen_usage();
+    return 1;
+  }
+  if (loadgen_options.threads > loadgen_options.clients) {
+    loadgen_options.threads = loadgen_options.clients;
+  }
+
+  // resolve broker address
+  char port[8];
+  snprintf(port, sizeof(port), "%d", loadgen_options.port);
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *res = NULL;
+  int rc = getaddrinfo(loadgen_options.host, port, &hints, &res);
+  if (rc != 0) {
+    fprintf(stderr, "failed to resolve %s: %s\n", loadgen_options.host, gai_strerror(rc));
+    return 1;
+  }
+  memcpy(&loadgen_options.address, res->ai_addr, res->ai_addrlen);
+  loadgen_options.address_len = res->ai_addrlen;
+  freeaddrinfo(res);
+
+  // raise the descriptor limit as far as allowed
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < (rlim_t)loadgen_options.clients + 64) {
+      fprintf(stderr, "warning: descriptor limit %llu is below the number of clients\n",
+              (unsigned long long)limit.rlim_cur);
+    }
+  }
+
+  // handle interrupts
+  signal(SIGINT, loadgen_signal);
+  signal(SIGTERM, loadgen_signal);
+
+  // prepare workers
+  loadgen_worker_t *workers = calloc((size_t)loadgen_options.threads, sizeof(loadgen_worker_t));
+  for (int i = 0; i < loadgen_options.threads; i++) {
+    loadgen_worker_t *w = &workers[i];
+    w->index = i;
+    w->epoll = epoll_create1(EPOLL_CLOEXEC);
+    w->random = 0x9e3779b97f4a7c15ull * (uint64_t)(i + 1);
+    w->ramp = loadgen_options.ramp / loadgen_options.threads;
+    w->count = loadgen_options.clients / loadgen_options.threads;
+    if (i < loadgen_options.clients % loadgen_options.threads) {
+      w->count++;
+    }
+    w->clients = calloc((size_t)w->count, sizeof(loadgen_client_t));
+  }
+
+  // prepare clients, every device with the same index plays the same role across runs
+  for (int n = 0; n < loadgen_options.clients; n++) {
+    loadgen_worker_t *w = &workers[n % loadgen_options.threads];
+    loadgen_client_t *c = &w->clients[n / loadgen_options.threads];
+    c->index = n;
+    c->network.fd = -1;
+    c->worker = w;
+    c->write_buf = malloc(loadgen_options.buffer);
+    c->read_buf = malloc(loadgen_options.buffer);
+    snprintf(c->id, sizeof(c->id), "%s-%d", loadgen_options.prefix, n);
+    snprintf(c->topic, sizeof(c->topic), "%s/%d", loadgen_options.prefix, n);
+    int role = (int)((uint64_t)n * 7919 % 100);
+    c->publisher = role >= loadgen_options.idle;
+    c->subscriber = c->publisher && (int)((uint64_t)n * 104729 % 100) < loadgen_options.subscribers;
+  }
+
+  // start workers
+  printf("loadgen: %d clients on %d threads against %s:%d\n", loadgen_options.clients, loadgen_options.threads,
+         loadgen_options.host, loadgen_options.port);
+  uint64_t start = loadgen_now();
+  for (int i = 0; i < loadgen_options.threads; i++) {
+    pthread_create(&workers[i].thread, NULL, loadgen_run, &workers[i]);
+  }
+
+  // report progress
+  printf("%6s %9s %9s %9s %10s %10s %9s %9s\n", "time", "connected", "conn/s", "errors", "pub/s", "recv/s",
+         "backlog", "MB/s out");
+  loadgen_counters_t last;
+  memset(&last, 0, sizeof(last));
+  uint64_t last_time = start;
+  while (!loadgen_stop && loadgen_now() - start < (uint64_t)loadgen_options.duration * 1000000) {
+    // sleep until the next report
+    uint64_t wake = last_time + (uint64_t)loadgen_options.interval * 1000000;
+    uint64_t now = loadgen_now();
+    if (wake > now) {
+      usleep((useconds_t)(wake - now > 100000 ? 100000 : wake - now));
+      continue;
+    }
+
+    // print interval rates
+    loadgen_counters_t sum;
+    loadgen_sum(workers, &sum);
+    double secs = (double)(now - last_time) / 1000000.0;
+    printf("%6.0f %9llu %9.0f %9llu %10.0f %10.0f %9llu %9.2f\n", (double)(now - start) / 1000000.0,
+           (unsigned long long)sum.connected, (double)(sum.connects - last.connects) / secs,
+           (unsigned long long)(sum.errors + sum.connect_errors), (double)(sum.published - last.published) / secs,
+           (double)(sum.received - last.received) / secs, (unsigned long long)(sum.backlogged - last.backlogged),
+           (double)(sum.bytes_out - last.bytes_out) / secs / 1000000.0);
+    fflush(stdout);
+    last = sum;
+    last_time = now;
+  }
+
+  // stop workers
+  loadgen_stop = 1;
+  for (int i = 0; i < loadgen_options.threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  double elapsed = (double)(loadgen_now() - start) / 1000000.0;
+
+  // merge histograms and collect per client mean latencies
+  loadgen_counters_t sum;
+  loadgen_sum(workers, &sum);
+  loadgen_histogram_t *connect = calloc(1, sizeof(loadgen_histogram_t));
+  loadgen_histogram_t *message = calloc(1, sizeof(loadgen_histogram_t));
+  loadgen_histogram_t *clients = calloc(1, sizeof(loadgen_histogram_t));
+  for (int i = 0; i < loadgen_options.threads; i++) {
+    loadgen_merge(connect, &workers[i].connect_latency);
+    loadgen_merge(message, &workers[i].message_latency);
+    for (int j = 0; j < workers[i].count; j++) {
+      loadgen_client_t *c = &workers[i].clients[j];
+      if (c->latency_count > 0) {
+        loadgen_record(clients, c->latency_sum / c->latency_count);
+      }
+    }
+  }
+
+  // print summary
+  printf("\nsummary over %.1fs:\n", elapsed);
+  printf("%-18s %llu (%.0f/s), %llu failed, %llu dropped\n", "connects", (unsigned long long)sum.connects,
+         (double)sum.connects / elapsed, (unsigned long long)sum.connect_errors, (unsigned long long)sum.errors);
+  printf("%-18s %llu (%.0f/s), %llu backlogged\n", "published", (unsigned long long)sum.published,
+         (double)sum.published / elapsed, (unsigned long long)sum.backlogged);
+  printf("%-18s %llu (%.0f/s)\n", "received", (unsigned long long)sum.received, (double)sum.received / elapsed);
+  printf("%-18s %.2f MB out, %.2f MB in\n", "traffic", (double)sum.bytes_out / 1000000.0,
+         (double)sum.bytes_in / 1000000.0);
+  loadgen_print_histogram("connect latency", connect);
+  loadgen_print_histogram("message latency", message);
+  loadgen_print_histogram("client mean", clients);
+
+  return 0;
+}
@@ -0,0 +1,204 @@
+// Reproducible throughput and timeout benchmarks of the lwmqtt client over simulated links.
+//
+// Every scenario runs one client against the simulated broker of netsim.c for a span of virtual time. The client
+// publishes at a fixed interval or back to back, keeps the connection alive and reconnects after errors. As the
+// virtual clock jumps over idle periods, an hour of simulated traffic takes milliseconds and runs with the same seed
+// produce identical results.
+//
+// Build using "make netsim" and run "extras/netsim/bench [scenario] [seed]".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "netsim.h"
+
+typedef struct {
+  const char *name;
+  netsim_config_t config;
+  uint32_t duration;  // virtual seconds
+  uint32_t interval;  // milliseconds between publishes, zero for back to back
+  lwmqtt_qos_t qos;
+  size_t payload;
+  uint16_t keep_alive;
+  uint32_t timeout;
+} bench_scenario_t;
+
+typedef struct {
+  uint64_t published;
+  uint64_t received;
+  uint64_t timeouts;
+  uint64_t errors;
+  uint64_t reconnects;
+  uint64_t pings;
+} bench_result_t;
+
+static bench_scenario_t bench_scenarios[] = {
+    // fast wired link, throughput is bound by the round trip
+    {"lan", {.latency = 1}, 60, 0, LWMQTT_QOS1, 64, 60, 1000},
+    // cellular link with jitter, little bandwidth, fragmented reads and short writes
+    {"cellular",
+     {.latency = 80, .jitter = 40, .bandwidth = 16000, .max_read = 32, .max_write = 64},
+     3600,
+     1000,
+     LWMQTT_QOS1,
+     256,
+     60,
+     5000},
+    // cellular link that stalls for two seconds, longer than the command timeout
+    {"stalls",
+     {.latency = 50, .jitter = 20, .stall_chance = 2000, .stall_time = 2000, .max_read = 16},
+     3600,
+     500,
+     LWMQTT_QOS1,
+     64,
+     30,
+     1000},
+    // link that drops the connection now and then
+    {"drops", {.latency = 100, .jitter = 50, .drop_chance = 500}, 3600, 1000, LWMQTT_QOS1, 64, 60, 5000},
+    // satellite link with high latency and low bandwidth, publishing back to back
+    {"satellite", {.latency = 300, .jitter = 50, .bandwidth = 4000}, 600, 0, LWMQTT_QOS1, 512, 120, 5000},
+    // idle connection to a broker that does not answer pings
+    {"silent", {.latency = 40, .broker_ignore_pings = true}, 600, 0, LWMQTT_QOS0, 0, 30, 5000},
+};
+
+static void bench_callback(lwmqtt_client_t *client, void *ref, lwmqtt_string_t topic, lwmqtt_message_t msg) {
+  (void)client;
+  (void)topic;
+  (void)msg;
+  ((bench_result_t *)ref)->received++;
+}
+
+static void bench_fail(netsim_t *sim, bench_result_t *res, lwmqtt_err_t err) {
+  // count error, commands whose acknowledgement did not arrive before the timeout fail with a missing packet
+  if (err == LWMQTT_NETWORK_TIMEOUT || err == LWMQTT_PONG_TIMEOUT || err == LWMQTT_MISSING_OR_WRONG_PACKET) {
+    res->timeouts++;
+  } else {
+    res->errors++;
+  }
+
+  // close connection
+  netsim_drop(sim);
+}
+
+static bool bench_connect(lwmqtt_client_t *client, netsim_t *sim, bench_scenario_t *s, bench_result_t *res) {
+  // open connection
+  netsim_connect(sim);
+
+  // connect client
+  lwmqtt_connect_options_t options = lwmqtt_default_connect_options;
+  options.client_id = lwmqtt_string("netsim");
+  options.keep_alive = s->keep_alive;
+  lwmqtt_err_t err = lwmqtt_connect(client, &options, NULL, s->timeout);
+  if (err == LWMQTT_SUCCESS) {
+    err = lwmqtt_subscribe_one(client, lwmqtt_string("netsim/echo"), LWMQTT_QOS0, s->timeout);
+  }
+  if (err != LWMQTT_SUCCESS) {
+    bench_fail(sim, res, err);
+    return false;
+  }
+
+  return true;
+}
+
+static void bench_run(bench_scenario_t *s, uint64_t seed) {
+  // prepare simulation
+  netsim_t sim;
+  netsim_config_t config = s->config;
+  config.seed = seed;
+  netsim_init(&sim, config);
+
+  // prepare client
+  static uint8_t write_buf[2048], read_buf[2048];
+  static uint8_t payload[1024];
+  lwmqtt_client_t client;
+  netsim_timer_t keep_alive_timer, command_timer;
+  bench_result_t res;
+  memset(&res, 0, sizeof(res));
+  netsim_timer_init(&keep_alive_timer, &sim);
+  netsim_timer_init(&command_timer, &sim);
+  lwmqtt_init(&client, write_buf, sizeof(write_buf), read_buf, sizeof(read_buf));
+  lwmqtt_set_network(&client, &sim, netsim_read, netsim_write);
+  lwmqtt_set_timers(&client, &keep_alive_timer, &command_timer, netsim_timer_set, netsim_timer_get);
+  lwmqtt_set_callback(&client, &res, bench_callback);
+
+  // run until the virtual time is up
+  clock_t start = clock();
+  uint64_t end = (uint64_t)s->duration * 1000;
+  uint64_t next_publish = 0;
+  bool connected = false;
+  while (netsim_millis(&sim) < end) {
+    // reconnect after a second
+    if (!connected) {
+      if (res.reconnects++ > 0) {
+        netsim_sleep(&sim, 1000);
+      }
+      connected = bench_connect(&client, &sim, s, &res);
+      continue;
+    }
+
+    // publish if due
+    uint64_t now = netsim_millis(&sim);
+    if (s->payload > 0 && now >= next_publish) {
+      lwmqtt_message_t msg = {s->qos, false, payload, s->payload};
+      lwmqtt_err_t err = lwmqtt_publish(&client, NULL, lwmqtt_string("netsim/echo"), msg, s->timeout);
+      if (err != LWMQTT_SUCCESS) {
+        bench_fail(&sim, &res, err);
+        connected = false;
+        continue;
+      }
+      res.published++;
+      next_publish = s->interval > 0 ? now + s->interval : 0;
+      if (s->interval == 0) {
+        continue;
+      }
+    }
+
+    // wait for incoming packets until the next publish or keep alive
+    uint32_t wait = lwmqtt_next_deadline(&client);
+    if (s->payload > 0 && next_publish - now < wait) {
+      wait = (uint32_t)(next_publish - now);
+    }
+    if (wait > end - now) {
+      wait = (uint32_t)(end - now);
+    }
+    lwmqtt_err_t err = lwmqtt_yield(&client, 0, wait > 0 ? wait : 1);
+    if (err == LWMQTT_SUCCESS && lwmqtt_next_deadline(&client) == 0) {
+      res.pings++;
+      err = lwmqtt_keep_alive(&client, s->timeout);
+    }
+    if (err != LWMQTT_SUCCESS) {
+      bench_fail(&sim, &res, err);
+      connected = false;
+    }
+  }
+  double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  // print result
+  double secs = (double)netsim_millis(&sim) / 1000.0;
+  printf("%-10s %7.0fs %7.3fs %9.0fx %9llu %8.1f/s %8llu %8llu %6llu %6llu %6llu %7llu %7llu\n", s->name, secs, wall,
+         wall > 0 ? secs / wall : 0, (unsigned long long)res.published, (double)res.published / secs,
+         (unsigned long long)res.received, (unsigned long long)res.pings, (unsigned long long)res.timeouts,
+         (unsigned long long)res.errors, (unsigned long long)(res.reconnects - 1), (unsigned long long)sim.stats.stalls,
+         (unsigned long long)sim.stats.short_writes);
+
+  netsim_free(&sim);
+}
+
+int main(int argc, char **argv) {
+  // parse arguments
+  const char *filter = argc > 1 ? argv[1] : NULL;
+  uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+
+  // run scenarios
+  printf("%-10s %8s %8s %10s %9s %10s %8s %8s %6s %6s %6s %7s %7s\n", "scenario", "virtual", "wall", "speedup",
+         "published", "rate", "received", "pings", "tmouts", "errors", "recon", "stalls", "shortw");
+  for (size_t i = 0; i < sizeof(bench_scenarios) / sizeof(bench_scenarios[0]); i++) {
+    if (filter == NULL || strcmp(filter, bench_scenarios[i].name) == 0) {
+      bench_run(&bench_scenarios[i], seed);
+    }
+  }
+
+  return 0;
+}
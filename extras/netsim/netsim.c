@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "netsim.h"
+#include "packet.h"
+
+static uint64_t netsim_random(netsim_t *sim) {
+  // advance xorshift64 state
+  sim->random ^= sim->random << 13;
+  sim->random ^= sim->random >> 7;
+  sim->random ^= sim->random << 17;
+  return sim->random;
+}
+
+static bool netsim_chance(netsim_t *sim, uint32_t per_million) {
+  return per_million > 0 && netsim_random(sim) % 1000000 < per_million;
+}
+
+static void netsim_pipe_clear(netsim_pipe_t *pipe) {
+  // free segments
+  for (size_t i = pipe->head; i < pipe->count; i++) {
+    free(pipe->segments[i].data);
+  }
+  pipe->head = 0;
+  pipe->count = 0;
+  pipe->free_at = 0;
+  pipe->last_at = 0;
+}
+
+static netsim_segment_t *netsim_pipe_peek(netsim_pipe_t *pipe) {
+  return pipe->head < pipe->count ? &pipe->segments[pipe->head] : NULL;
+}
+
+static void netsim_pipe_pop(netsim_pipe_t *pipe) {
+  // free segment
+  free(pipe->segments[pipe->head].data);
+  pipe->head++;
+
+  // reset when empty
+  if (pipe->head == pipe->count) {
+    pipe->head = 0;
+    pipe->count = 0;
+  }
+}
+
+static void netsim_transmit(netsim_t *sim, netsim_pipe_t *pipe, uint8_t *data, size_t len) {
+  // serialize onto the link, bytes queue up behind earlier bytes if bandwidth is limited
+  uint64_t start = pipe->free_at > sim->now ? pipe->free_at : sim->now;
+  if (sim->config.bandwidth > 0) {
+    start += (uint64_t)len * 1000000 / sim->config.bandwidth;
+  }
+  pipe->free_at = start;
+
+  // add latency and jitter but keep bytes in order like tcp does
+  uint64_t at = start + (uint64_t)sim->config.latency * 1000;
+  if (sim->config.jitter > 0) {
+    at += netsim_random(sim) % ((uint64_t)sim->config.jitter * 1000);
+  }
+  if (at < pipe->last_at) {
+    at = pipe->last_at;
+  }
+  pipe->last_at = at;
+
+  // grow segment array
+  if (pipe->count == pipe->cap) {
+    pipe->cap = pipe->cap == 0 ? 16 : pipe->cap * 2;
+    pipe->segments = realloc(pipe->segments, pipe->cap * sizeof(netsim_segment_t));
+  }
+
+  // append segment
+  netsim_segment_t *seg = &pipe->segments[pipe->count++];
+  seg->at = at;
+  seg->len = len;
+  seg->off = 0;
+  seg->data = malloc(len);
+  memcpy(seg->data, data, len);
+}
+
+static void netsim_respond(netsim_t *sim, uint8_t *data, size_t len) {
+  // send after the processing delay
+  uint64_t now = sim->now;
+  sim->now += (uint64_t)sim->config.broker_delay * 1000;
+  netsim_transmit(sim, &sim->down, data, len);
+  sim->now = now;
+  sim->stats.packets_down++;
+}
+
+static void netsim_respond_ack(netsim_t *sim, lwmqtt_packet_type_t type, uint16_t packet_id) {
+  // encode and send ack
+  uint8_t buf[4];
+  size_t len;
+  lwmqtt_encode_ack(buf, sizeof(buf), &len, type, packet_id);
+  netsim_respond(sim, buf, len);
+}
+
+static void netsim_handle_publish(netsim_t *sim, uint8_t *buf, size_t len) {
+  // decode publish
+  bool dup;
+  uint16_t packet_id = 0;
+  lwmqtt_string_t topic;
+  lwmqtt_message_t msg;
+  if (lwmqtt_decode_publish(buf, len, &dup, &packet_id, &topic, &msg) != LWMQTT_SUCCESS) {
+    netsim_drop(sim);
+    return;
+  }
+
+  // acknowledge
+  if (msg.qos == LWMQTT_QOS1) {
+    netsim_respond_ack(sim, LWMQTT_PUBACK_PACKET, packet_id);
+  } else if (msg.qos == LWMQTT_QOS2) {
+    netsim_respond_ack(sim, LWMQTT_PUBREC_PACKET, packet_id);
+  }
+
+  // echo to matching subscriptions with qos 0
+  for (int i = 0; i < sim->filter_count; i++) {
+    if (lwmqtt_topic_match(lwmqtt_string(sim->filters[i]), topic)) {
+      lwmqtt_message_t echo = msg;
+      echo.qos = LWMQTT_QOS0;
+      echo.retained = false;
+      size_t out_len;
+      uint8_t *out = malloc(len + 8);
+      lwmqtt_encode_publish(out, len + 8, &out_len, false, 0, topic, echo);
+      memcpy(out + out_len, msg.payload, msg.payload_len);
+      netsim_respond(sim, out, out_len + msg.payload_len);
+      free(out);
+      break;
+    }
+  }
+}
+
+static void netsim_handle_subscribe(netsim_t *sim, uint8_t *buf, uint8_t *end, bool subscribe) {
+  // read packet id
+  uint16_t packet_id;
+  if (lwmqtt_read_num(&buf, end, &packet_id) != LWMQTT_SUCCESS) {
+    netsim_drop(sim);
+    return;
+  }
+
+  // read filters
+  uint8_t codes[NETSIM_MAX_FILTERS];
+  int count = 0;
+  while (buf < end && count < NETSIM_MAX_FILTERS) {
+    lwmqtt_string_t filter;
+    uint8_t qos = 0;
+    if (lwmqtt_read_string(&buf, end, &filter) != LWMQTT_SUCCESS ||
+        (subscribe && lwmqtt_read_byte(&buf, end, &qos) != LWMQTT_SUCCESS) || filter.len >= 64) {
+      netsim_drop(sim);
+      return;
+    }
+
+    // add or remove filter
+    int found = -1;
+    for (int i = 0; i < sim->filter_count; i++) {
+      if (lwmqtt_strcmp(filter, sim->filters[i]) == 0) {
+        found = i;
+      }
+    }
+    if (subscribe && found < 0 && sim->filter_count < NETSIM_MAX_FILTERS) {
+      memcpy(sim->filters[sim->filter_count], filter.data, filter.len);
+      sim->filters[sim->filter_count++][filter.len] = 0;
+    } else if (!subscribe && found >= 0) {
+      memcpy(sim->filters[found], sim->filters[--sim->filter_count], 64);
+    }
+    codes[count++] = qos;
+  }
+
+  // send unsuback
+  if (!subscribe) {
+    netsim_respond_ack(sim, LWMQTT_UNSUBACK_PACKET, packet_id);
+    return;
+  }
+
+  // send suback granting the requested levels
+  uint8_t out[4 + NETSIM_MAX_FILTERS] = {LWMQTT_SUBACK_PACKET << 4, (uint8_t)(2 + count), (uint8_t)(packet_id >> 8),
+                                         (uint8_t)packet_id};
+  memcpy(out + 4, codes, (size_t)count);
+  netsim_respond(sim, out, 4 + (size_t)count);
+}
+
+static void netsim_handle(netsim_t *sim, uint8_t *buf, size_t len, uint8_t *body) {
+  // count packet
+  sim->stats.packets_up++;
+
+  switch (buf[0] >> 4) {
+    case LWMQTT_CONNECT_PACKET: {
+      uint8_t connack[] = {LWMQTT_CONNACK_PACKET << 4, 2, 0, LWMQTT_CONNECTION_ACCEPTED};
+      sim->filter_count = 0;
+      netsim_respond(sim, connack, sizeof(connack));
+      break;
+    }
+    case LWMQTT_PUBLISH_PACKET:
+      netsim_handle_publish(sim, buf, len);
+      break;
+    case LWMQTT_PUBREL_PACKET: {
+      uint16_t packet_id;
+      if (lwmqtt_decode_packet_id(buf, len, &packet_id) == LWMQTT_SUCCESS) {
+        netsim_respond_ack(sim, LWMQTT_PUBCOMP_PACKET, packet_id);
+      }
+      break;
+    }
+    case LWMQTT_SUBSCRIBE_PACKET:
+      netsim_handle_subscribe(sim, body, buf + len, true);
+      break;
+    case LWMQTT_UNSUBSCRIBE_PACKET:
+      netsim_handle_subscribe(sim, body, buf + len, false);
+      break;
+    case LWMQTT_PINGREQ_PACKET:
+      if (!sim->config.broker_ignore_pings) {
+        uint8_t pingresp[] = {LWMQTT_PINGRESP_PACKET << 4, 0};
+        netsim_respond(sim, pingresp, sizeof(pingresp));
+      }
+      break;
+    case LWMQTT_DISCONNECT_PACKET:
+      sim->connected = false;
+      break;
+    default:
+      break;
+  }
+}
+
+static void netsim_pump(netsim_t *sim) {
+  // move arrived uplink bytes to the broker inbox
+  netsim_segment_t *seg;
+  while ((seg = netsim_pipe_peek(&sim->up)) != NULL && seg->at <= sim->now) {
+    if (sim->inbox_len + seg->len > sim->inbox_cap) {
+      sim->inbox_cap = (sim->inbox_len + seg->len) * 2;
+      sim->inbox = realloc(sim->inbox, sim->inbox_cap);
+    }
+    memcpy(sim->inbox + sim->inbox_len, seg->data, seg->len);
+    sim->inbox_len += seg->len;
+    netsim_pipe_pop(&sim->up);
+  }
+
+  // handle complete packets
+  size_t off = 0;
+  while (sim->connected && sim->inbox_len - off >= 2) {
+    // read remaining length
+    uint8_t *ptr = sim->inbox + off + 1;
+    uint32_t rem_len;
+    lwmqtt_err_t err = lwmqtt_read_varnum(&ptr, sim->inbox + sim->inbox_len, &rem_len);
+    if (err == LWMQTT_BUFFER_TOO_SHORT) {
+      break;
+    } else if (err != LWMQTT_SUCCESS) {
+      netsim_drop(sim);
+      return;
+    }
+
+    // check if the packet is complete
+    size_t total = (size_t)(ptr - (sim->inbox + off)) + rem_len;
+    if (sim->inbox_len - off < total) {
+      break;
+    }
+
+    // handle packet
+    netsim_handle(sim, sim->inbox + off, total, ptr);
+    off += total;
+  }
+
+  // remove handled bytes
+  if (sim->connected && off > 0) {
+    memmove(sim->inbox, sim->inbox + off, sim->inbox_len - off);
+    sim->inbox_len -= off;
+  }
+}
+
+void netsim_init(netsim_t *sim, netsim_config_t config) {
+  // reset object
+  memset(sim, 0, sizeof(netsim_t));
+  sim->config = config;
+  sim->random = config.seed != 0 ? config.seed : 1;
+}
+
+void netsim_free(netsim_t *sim) {
+  // free memory
+  netsim_pipe_clear(&sim->up);
+  netsim_pipe_clear(&sim->down);
+  free(sim->up.segments);
+  free(sim->down.segments);
+  free(sim->inbox);
+}
+
+void netsim_connect(netsim_t *sim) {
+  // reset link and broker
+  netsim_pipe_clear(&sim->up);
+  netsim_pipe_clear(&sim->down);
+  sim->inbox_len = 0;
+  sim->filter_count = 0;
+  sim->stall_until = 0;
+  sim->connected = true;
+}
+
+void netsim_drop(netsim_t *sim) {
+  // drop connection
+  if (sim->connected) {
+    sim->stats.drops++;
+  }
+  sim->connected = false;
+  netsim_pipe_clear(&sim->up);
+  netsim_pipe_clear(&sim->down);
+  sim->inbox_len = 0;
+}
+
+void netsim_sleep(netsim_t *sim, uint32_t ms) {
+  // advance through uplink arrivals so the broker responds in time
+  uint64_t target = sim->now + (uint64_t)ms * 1000;
+  netsim_segment_t *seg;
+  while ((seg = netsim_pipe_peek(&sim->up)) != NULL && seg->at <= target) {
+    if (seg->at > sim->now) {
+      sim->now = seg->at;
+    }
+    netsim_pump(sim);
+  }
+  sim->now = target;
+  netsim_pump(sim);
+}
+
+uint64_t netsim_millis(netsim_t *sim) { return sim->now / 1000; }
+
+lwmqtt_err_t netsim_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout) {
+  // get simulation
+  netsim_t *sim = (netsim_t *)ref;
+  sim->stats.reads++;
+
+  uint64_t deadline = sim->now + (uint64_t)timeout * 1000;
+  bool stalled = false;
+  for (;;) {
+    // check connection
+    if (!sim->connected) {
+      return LWMQTT_NETWORK_FAILED_READ;
+    }
+
+    // let the broker process arrived bytes
+    netsim_pump(sim);
+
+    // serve arrived bytes unless stalled
+    netsim_segment_t *seg = netsim_pipe_peek(&sim->down);
+    if (seg != NULL && seg->at <= sim->now && sim->now >= sim->stall_until) {
+      // stall the downlink once per read with the configured chance
+      if (!stalled && netsim_chance(sim, sim->config.stall_chance)) {
+        stalled = true;
+        sim->stall_until = sim->now + (uint64_t)sim->config.stall_time * 1000;
+        sim->stats.stalls++;
+        continue;
+      }
+
+      // fragment read
+      size_t n = seg->len - seg->off;
+      if (n > len) {
+        n = len;
+      }
+      if (sim->config.max_read > 0) {
+        size_t max = 1 + netsim_random(sim) % sim->config.max_read;
+        n = n > max ? max : n;
+      }
+
+      // copy bytes
+      memcpy(buf, seg->data + seg->off, n);
+      seg->off += n;
+      if (seg->off == seg->len) {
+        netsim_pipe_pop(&sim->down);
+      }
+      sim->stats.bytes_down += n;
+      *read = n;
+
+      return LWMQTT_SUCCESS;
+    }
+
+    // find next event
+    uint64_t next = UINT64_MAX;
+    netsim_segment_t *up = netsim_pipe_peek(&sim->up);
+    if (up != NULL && up->at > sim->now) {
+      next = up->at;
+    }
+    if (seg != NULL) {
+      uint64_t at = seg->at > sim->stall_until ? seg->at : sim->stall_until;
+      next = at < next ? at : next;
+    }
+
+    // jump to the deadline if nothing arrives before, the caller detects the timeout using its timer
+    if (next > deadline) {
+      sim->now = deadline > sim->now ? deadline : sim->now;
+      *read = 0;
+      return LWMQTT_SUCCESS;
+    }
+
+    // jump to next event
+    sim->now = next;
+  }
+}
+
+lwmqtt_err_t netsim_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout) {
+  // get simulation
+  netsim_t *sim = (netsim_t *)ref;
+  (void)timeout;
+  sim->stats.writes++;
+
+  // check connection and drop it by chance
+  if (!sim->connected) {
+    return LWMQTT_NETWORK_FAILED_WRITE;
+  } else if (netsim_chance(sim, sim->config.drop_chance)) {
+    netsim_drop(sim);
+    return LWMQTT_NETWORK_FAILED_WRITE;
+  }
+
+  // cut write short
+  size_t n = len;
+  if (sim->config.max_write > 0) {
+    size_t max = 1 + netsim_random(sim) % sim->config.max_write;
+    if (n > max) {
+      n = max;
+      sim->stats.short_writes++;
+    }
+  }
+
+  // transmit bytes
+  netsim_transmit(sim, &sim->up, buf, n);
+  sim->stats.bytes_up += n;
+  *sent = n;
+
+  return LWMQTT_SUCCESS;
+}
+
+void netsim_timer_init(netsim_timer_t *timer, netsim_t *sim) {
+  // bind timer
+  timer->sim = sim;
+  timer->deadline = 0;
+}
+
+void netsim_timer_set(void *ref, uint32_t timeout) {
+  // set deadline
+  netsim_timer_t *t = (netsim_timer_t *)ref;
+  t->deadline = t->sim->now + (uint64_t)timeout * 1000;
+}
+
+int32_t netsim_timer_get(void *ref) {
+  // return remaining milliseconds rounded up
+  netsim_timer_t *t = (netsim_timer_t *)ref;
+  if (t->deadline <= t->sim->now) {
+    return 0;
+  }
+  return (int32_t)((t->deadline - t->sim->now + 999) / 1000);
+}
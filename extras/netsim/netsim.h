@@ -0,0 +1,169 @@
+#ifndef NETSIM_H
+#define NETSIM_H
+
+#include "lwmqtt.h"
+
+/**
+ * The maximum number of topic filters the simulated broker keeps per connection.
+ */
+#define NETSIM_MAX_FILTERS 8
+
+/**
+ * The impairments of the simulated link. All probabilities are given per million events.
+ */
+typedef struct {
+  uint32_t latency;        // one-way latency in milliseconds
+  uint32_t jitter;         // maximum random one-way latency added in milliseconds, bytes stay in order
+  uint32_t bandwidth;      // bytes per second and direction, zero for unlimited
+  size_t max_read;         // maximum bytes returned per read, reads are fragmented randomly, zero for unlimited
+  size_t max_write;        // maximum bytes accepted per write, writes are cut short randomly, zero for unlimited
+  uint32_t stall_chance;   // probability that the downlink stalls before a read is served
+  uint32_t stall_time;     // duration of a stall in milliseconds
+  uint32_t drop_chance;    // probability that the connection drops on a write
+  uint32_t broker_delay;   // processing time of the simulated broker in milliseconds
+  bool broker_ignore_pings;  // whether the simulated broker leaves pings unanswered
+  uint64_t seed;           // the seed of the random generator, runs with the same seed are identical
+} netsim_config_t;
+
+/**
+ * The counters of a simulation.
+ */
+typedef struct {
+  uint64_t bytes_up, bytes_down;
+  uint64_t packets_up, packets_down;
+  uint64_t reads, writes;
+  uint64_t short_writes;
+  uint64_t stalls;
+  uint64_t drops;
+} netsim_stats_t;
+
+/**
+ * A chunk of bytes in flight.
+ */
+typedef struct {
+  uint64_t at;
+  size_t len, off;
+  uint8_t *data;
+} netsim_segment_t;
+
+/**
+ * One direction of the simulated link.
+ */
+typedef struct {
+  netsim_segment_t *segments;
+  size_t head, count, cap;
+  uint64_t free_at;
+  uint64_t last_at;
+} netsim_pipe_t;
+
+/**
+ * The simulation object holding the virtual clock, the link and the broker state.
+ */
+typedef struct {
+  netsim_config_t config;
+  uint64_t now;
+  uint64_t random;
+  bool connected;
+  uint64_t stall_until;
+
+  netsim_pipe_t up, down;
+
+  uint8_t *inbox;
+  size_t inbox_len, inbox_cap;
+  char filters[NETSIM_MAX_FILTERS][64];
+  int filter_count;
+
+  netsim_stats_t stats;
+} netsim_t;
+
+/**
+ * The timer object driven by the virtual clock of a simulation.
+ */
+typedef struct {
+  netsim_t *sim;
+  uint64_t deadline;
+} netsim_timer_t;
+
+/**
+ * Will initialize the simulation with the virtual clock at zero and the link disconnected.
+ *
+ * @param sim The simulation.
+ * @param config The link configuration.
+ */
+void netsim_init(netsim_t *sim, netsim_config_t config);
+
+/**
+ * Will free all memory of the simulation.
+ *
+ * @param sim The simulation.
+ */
+void netsim_free(netsim_t *sim);
+
+/**
+ * Will establish a fresh connection to the simulated broker, discarding bytes in flight and subscriptions.
+ *
+ * @param sim The simulation.
+ */
+void netsim_connect(netsim_t *sim);
+
+/**
+ * Will drop the connection. Subsequent reads and writes fail until netsim_connect() is called.
+ *
+ * @param sim The simulation.
+ */
+void netsim_drop(netsim_t *sim);
+
+/**
+ * Will advance the virtual clock while the broker keeps processing the uplink, e.g. when the application sleeps.
+ *
+ * @param sim The simulation.
+ * @param ms The milliseconds to advance.
+ */
+void netsim_sleep(netsim_t *sim, uint32_t ms);
+
+/**
+ * Will return the virtual time in milliseconds.
+ *
+ * @param sim The simulation.
+ * @return The virtual time.
+ */
+uint64_t netsim_millis(netsim_t *sim);
+
+/**
+ * Callback to read from the simulated link. If no bytes are deliverable, the virtual clock jumps to the next arrival
+ * or the timeout instead of waiting.
+ *
+ * @see lwmqtt_network_read_t.
+ */
+lwmqtt_err_t netsim_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout);
+
+/**
+ * Callback to write to the simulated link.
+ *
+ * @see lwmqtt_network_write_t.
+ */
+lwmqtt_err_t netsim_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout);
+
+/**
+ * Will bind the timer to the virtual clock of the simulation.
+ *
+ * @param timer The timer.
+ * @param sim The simulation.
+ */
+void netsim_timer_init(netsim_timer_t *timer, netsim_t *sim);
+
+/**
+ * Callback to set a virtual timer.
+ *
+ * @see lwmqtt_timer_set_t.
+ */
+void netsim_timer_set(void *ref, uint32_t timeout);
+
+/**
+ * Callback to read a virtual timer.
+ *
+ * @see lwmqtt_timer_get_t.
+ */
+int32_t netsim_timer_get(void *ref);
+
+#endif  // NETSIM_H
@@ -1,6 +1,9 @@
 #ifndef MQTT_H
 #define MQTT_H
 
+#include "MQTTBufferPool.h"
 #include "MQTTClient.h"
+#include "MQTTRPC.h"
+#include "MQTTReporter.h"
 
 #endif
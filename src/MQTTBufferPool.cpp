@@ -0,0 +1,94 @@
+#include "MQTTBufferPool.h"
+
+MQTTBufferPool::MQTTBufferPool(size_t _budget) {
+  // allocate arena
+  this->arena = (uint8_t *)malloc(_budget);
+  if (this->arena != nullptr) {
+    this->budget = _budget;
+  }
+}
+
+MQTTBufferPool::~MQTTBufferPool() {
+  // free arena
+  free(this->arena);
+}
+
+bool MQTTBufferPool::addClass(size_t size, int count) {
+  // check arguments and capacity
+  if (size == 0 || count <= 0 || count > MQTT_POOL_CLASS_BUFFERS || this->classCount >= MQTT_POOL_CLASSES) {
+    return false;
+  }
+
+  // check budget
+  if (size * (size_t)count > this->budget - this->assigned) {
+    return false;
+  }
+
+  // find position to keep classes ordered by size
+  int pos = this->classCount;
+  while (pos > 0 && this->classes[pos - 1].size > size) {
+    this->classes[pos] = this->classes[pos - 1];
+    pos--;
+  }
+
+  // carve buffers from arena
+  this->classes[pos] = {this->arena + this->assigned, size, count, 0};
+  this->assigned += size * (size_t)count;
+  this->classCount++;
+
+  return true;
+}
+
+uint8_t *MQTTBufferPool::borrow(size_t size, size_t *capacity) {
+  // take a free buffer of the smallest class that fits, falling back to larger classes
+  bool fits = false;
+  for (int i = 0; i < this->classCount; i++) {
+    MQTTBufferPoolClass *c = &this->classes[i];
+    if (c->size < size) {
+      continue;
+    }
+    for (int j = 0; j < c->count; j++) {
+      if ((c->used & ((uint32_t)1 << j)) == 0) {
+        // mark buffer
+        c->used |= (uint32_t)1 << j;
+
+        // update stats, a buffer of a larger class than needed means the fitting class was exhausted
+        this->_stats.borrows++;
+        if (fits) {
+          this->_stats.upgrades++;
+        }
+        this->_stats.used += c->size;
+        if (this->_stats.used > this->_stats.peak) {
+          this->_stats.peak = this->_stats.used;
+        }
+
+        *capacity = c->size;
+        return c->base + c->size * (size_t)j;
+      }
+    }
+    fits = true;
+  }
+
+  // count miss
+  this->_stats.misses++;
+  *capacity = 0;
+
+  return nullptr;
+}
+
+void MQTTBufferPool::giveBack(uint8_t *buf) {
+  // find class and mark buffer as free
+  for (int i = 0; i < this->classCount; i++) {
+    MQTTBufferPoolClass *c = &this->classes[i];
+    if (buf >= c->base && buf < c->base + c->size * (size_t)c->count) {
+      c->used &= ~((uint32_t)1 << ((size_t)(buf - c->base) / c->size));
+      this->_stats.used -= c->size;
+      return;
+    }
+  }
+}
+
+void MQTTBufferPool::resetStats() {
+  // reset counters and start the peak at the current usage
+  this->_stats = {0, 0, 0, this->_stats.used, this->_stats.used};
+}
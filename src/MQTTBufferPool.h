@@ -0,0 +1,53 @@
+#ifndef MQTT_BUFFER_POOL_H
+#define MQTT_BUFFER_POOL_H
+
+#include <Arduino.h>
+
+// the maximum number of size classes of a buffer pool
+#ifndef MQTT_POOL_CLASSES
+#define MQTT_POOL_CLASSES 4
+#endif
+
+// the maximum number of buffers per size class
+#define MQTT_POOL_CLASS_BUFFERS 32
+
+typedef struct {
+  uint8_t *base;
+  size_t size;
+  int count;
+  uint32_t used;
+} MQTTBufferPoolClass;
+
+typedef struct {
+  uint32_t borrows;
+  uint32_t upgrades;
+  uint32_t misses;
+  size_t used;
+  size_t peak;
+} MQTTBufferPoolStats;
+
+class MQTTBufferPool {
+ private:
+  uint8_t *arena = nullptr;
+  size_t budget = 0;
+  size_t assigned = 0;
+  MQTTBufferPoolClass classes[MQTT_POOL_CLASSES];
+  int classCount = 0;
+  MQTTBufferPoolStats _stats = {0, 0, 0, 0, 0};
+
+ public:
+  explicit MQTTBufferPool(size_t budget);
+
+  ~MQTTBufferPool();
+
+  bool addClass(size_t size, int count);
+  size_t maxSize() { return this->classCount > 0 ? this->classes[this->classCount - 1].size : 0; }
+
+  uint8_t *borrow(size_t size, size_t *capacity);
+  void giveBack(uint8_t *buf);
+
+  MQTTBufferPoolStats stats() { return this->_stats; }
+  void resetStats();
+};
+
+#endif
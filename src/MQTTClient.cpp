@@ -43,6 +43,136 @@ inline int32_t lwmqtt_arduino_timer_get(void *ref) {
   }
 }
 
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+static size_t lwmqtt_arduino_network_room(lwmqtt_arduino_network_t *n, size_t len) {
+  // get room in the send buffer (most clients report zero if unsupported)
+  int room = n->client->availableForWrite();
+  if (room > 0) {
+    n->outbound->reportsRoom = true;
+  }
+
+  // limit length once the client has proven to report its room
+  if (n->outbound->reportsRoom && room < (int)len) {
+    return room > 0 ? (size_t)room : 0;
+  }
+
+  return len;
+}
+
+static bool lwmqtt_arduino_packet_size(const uint8_t *buf, size_t size, size_t head, size_t length, size_t *total) {
+  // decode the remaining length that follows the header byte
+  uint32_t rem = 0;
+  for (size_t i = 1; i < 5 && i < length; i++) {
+    uint8_t b = buf[(head + i) % size];
+    rem |= (uint32_t)(b & 127) << (7 * (i - 1));
+    if ((b & 128) == 0) {
+      *total = 1 + i + rem;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static size_t lwmqtt_arduino_network_queued(lwmqtt_arduino_network_t *n) {
+  // return the number of queued bytes
+  lwmqtt_arduino_outbound_t *o = n->outbound;
+  return o != nullptr ? o->queues[0].length + o->queues[1].length : 0;
+}
+
+static void lwmqtt_arduino_network_drain(lwmqtt_arduino_network_t *n) {
+  // get queues
+  lwmqtt_arduino_outbound_t *o = n->outbound;
+  if (o == nullptr) {
+    return;
+  }
+
+  // write queued bytes while the client accepts them
+  for (;;) {
+    // continue the current packet
+    int8_t cls = o->sendClass;
+    size_t left = o->sendLeft;
+
+    // otherwise select the next packet at a packet boundary, high priority packets first
+    if (cls < 0) {
+      cls = o->queues[0].length > 0 ? 0 : o->queues[1].length > 0 ? 1 : -1;
+      if (cls < 0) {
+        return;
+      }
+
+      // get packet size (the header may not yet be queued completely)
+      lwmqtt_arduino_queue_t *q = &o->queues[cls];
+      if (!lwmqtt_arduino_packet_size(q->buf, q->size, q->head, q->length, &left)) {
+        return;
+      }
+    }
+
+    // get contiguous chunk of the packet (its rest may not yet be queued)
+    lwmqtt_arduino_queue_t *q = &o->queues[cls];
+    size_t chunk = q->size - q->head;
+    if (chunk > q->length) {
+      chunk = q->length;
+    }
+    if (chunk > left) {
+      chunk = left;
+    }
+
+    // limit chunk to the available room
+    chunk = lwmqtt_arduino_network_room(n, chunk);
+    if (chunk == 0) {
+      return;
+    }
+
+    // write chunk
+    size_t written = n->client->write(q->buf + q->head, chunk);
+    if (written == 0) {
+      return;
+    }
+
+    // advance queue
+    q->head = (q->head + written) % q->size;
+    q->length -= written;
+    if (q->length == 0) {
+      q->head = 0;
+    }
+
+    // stay with a packet once it has been started until it has been sent completely
+    o->sendLeft = left - written;
+    o->sendClass = o->sendLeft > 0 ? cls : (int8_t)-1;
+  }
+}
+
+static void lwmqtt_arduino_network_flush(lwmqtt_arduino_network_t *n, uint32_t timeout) {
+  // send queued bytes until the queues are empty or the timeout has been reached
+  uint32_t start = millis();
+  while (lwmqtt_arduino_network_queued(n) > 0 && millis() - start < timeout) {
+    lwmqtt_arduino_network_drain(n);
+    if (lwmqtt_arduino_network_queued(n) > 0) {
+      delay(1);
+    }
+  }
+}
+
+static void lwmqtt_arduino_network_reset(lwmqtt_arduino_network_t *n) {
+  // get queues
+  lwmqtt_arduino_outbound_t *o = n->outbound;
+  if (o == nullptr) {
+    return;
+  }
+
+  // discard queued bytes
+  for (auto &q : o->queues) {
+    q.head = 0;
+    q.length = 0;
+  }
+
+  // reset packet boundaries
+  o->writeLeft = 0;
+  o->sendClass = -1;
+  o->sendLeft = 0;
+}
+#endif
+
 inline lwmqtt_err_t lwmqtt_arduino_network_read(void *ref, uint8_t *buffer, size_t len, size_t *read,
                                                 uint32_t timeout) {
   // cast network reference
@@ -56,6 +186,13 @@ inline lwmqtt_err_t lwmqtt_arduino_network_read(void *ref, uint8_t *buffer, size
 
   // read until all bytes have been read or timeout has been reached
   while (len > 0 && (millis() - start < timeout)) {
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+    // continue sending queued bytes (e.g. a packet that is being acknowledged)
+    if (lwmqtt_arduino_network_queued(n) > 0) {
+      lwmqtt_arduino_network_drain(n);
+    }
+#endif
+
     // read from connection
     int r = n->client->read(buffer, len);
 
@@ -85,43 +222,309 @@ inline lwmqtt_err_t lwmqtt_arduino_network_read(void *ref, uint8_t *buffer, size
   return LWMQTT_SUCCESS;
 }
 
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+static lwmqtt_err_t lwmqtt_arduino_network_enqueue(lwmqtt_arduino_network_t *n, uint8_t *buffer, size_t len,
+                                                   size_t *sent) {
+  // get queues
+  lwmqtt_arduino_outbound_t *o = n->outbound;
+
+  // classify a new packet, only publish packets written with bulk priority use the bulk queue
+  if (o->writeLeft == 0) {
+    if (!lwmqtt_arduino_packet_size(buffer, len, 0, len, &o->writeLeft)) {
+      o->writeLeft = len;
+    }
+    bool publish = (buffer[0] >> 4) == 3;  // publish packet type
+    o->writeClass = publish && n->priority == MQTT_PRIORITY_BULK && o->queues[1].buf != nullptr ? 1 : 0;
+  }
+
+  // write queued bytes first to free room
+  lwmqtt_arduino_network_drain(n);
+
+  // queue bytes of the current packet that fit
+  lwmqtt_arduino_queue_t *q = &o->queues[o->writeClass];
+  *sent = 0;
+  while (*sent < len && *sent < o->writeLeft && q->length < q->size) {
+    q->buf[(q->head + q->length) % q->size] = buffer[*sent];
+    q->length++;
+    (*sent)++;
+  }
+  o->writeLeft -= *sent;
+  n->accepted += *sent;
+
+  // write what the client accepts right now
+  lwmqtt_arduino_network_drain(n);
+
+  // check connection if no progress has been made, the caller retries until the command timeout
+  if (*sent == 0) {
+    if (!n->client->connected()) {
+      return LWMQTT_NETWORK_FAILED_WRITE;
+    }
+    delay(1);
+  }
+
+  return LWMQTT_SUCCESS;
+}
+#endif
+
 inline lwmqtt_err_t lwmqtt_arduino_network_write(void *ref, uint8_t *buffer, size_t len, size_t *sent,
                                                  uint32_t /*timeout*/) {
   // cast network reference
   auto n = (lwmqtt_arduino_network_t *)ref;
 
-  // write bytes
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // queue bytes if a queue is configured
+  if (n->outbound != nullptr) {
+    return lwmqtt_arduino_network_enqueue(n, buffer, len, sent);
+  }
+#endif
+
+  // write bytes directly
   *sent = n->client->write(buffer, len);
   if (*sent <= 0) {
     return LWMQTT_NETWORK_FAILED_WRITE;
   }
+  n->accepted += *sent;
 
   return LWMQTT_SUCCESS;
 }
 
-static void MQTTClientHandler(lwmqtt_client_t * /*client*/, void *ref, lwmqtt_string_t topic,
-                              lwmqtt_message_t message) {
-  // get callback
-  auto cb = (MQTTClientCallback *)ref;
+typedef struct {
+  MQTTClientPayloadWriter writer;
+  void *ref;
+  size_t written;
+} lwmqtt_arduino_payload_t;
 
-  // null terminate topic
-  char terminated_topic[topic.len + 1];
-  memcpy(terminated_topic, topic.data, topic.len);
-  terminated_topic[topic.len] = '\0';
+inline lwmqtt_err_t lwmqtt_arduino_payload_write(void *ref, uint8_t *buffer, size_t len, size_t *written) {
+  // cast payload reference
+  auto p = (lwmqtt_arduino_payload_t *)ref;
 
-  // null terminate payload if available
-  if (message.payload != nullptr) {
-    message.payload[message.payload_len] = '\0';
+  // let the writer serialize the payload
+  MQTTClientPayload payload(buffer, len);
+  p->writer(payload, p->ref);
+
+  // check overflow
+  if (payload.overflowed()) {
+    return LWMQTT_BUFFER_TOO_SHORT;
+  }
+
+  // set written length
+  *written = payload.length();
+  p->written = *written;
+
+  return LWMQTT_SUCCESS;
+}
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+static void MQTTClientBucketRefill(MQTTClientBucket *b, uint32_t now) {
+  // add tokens (in thousandths) for the elapsed time, up to one second worth of tokens
+  int64_t max = (int64_t)b->rate * 1000;
+  int64_t tokens = (int64_t)b->tokens + (int64_t)(now - b->last) * b->rate;
+  b->tokens = (int32_t)(tokens > max ? max : tokens);
+  b->last = now;
+}
+
+static uint32_t MQTTClientBucketWait(MQTTClientBucket *b, size_t cost) {
+  // return immediately if unlimited
+  if (b->rate == 0) {
+    return 0;
+  }
+
+  // costs larger than one second worth of tokens only require a full bucket
+  int64_t max = (int64_t)b->rate * 1000;
+  int64_t need = (int64_t)cost * 1000;
+  if (need > max) {
+    need = max;
+  }
+
+  // return time until the tokens are available
+  if (b->tokens >= need) {
+    return 0;
+  }
+
+  return (uint32_t)((need - b->tokens + b->rate - 1) / b->rate);
+}
+
+static void MQTTClientBucketTake(MQTTClientBucket *b, size_t cost) {
+  // return immediately if unlimited
+  if (b->rate == 0) {
+    return;
+  }
+
+  // take tokens, the debt of oversized costs is limited to one second worth of tokens
+  int64_t max = (int64_t)b->rate * 1000;
+  int64_t tokens = (int64_t)b->tokens - (int64_t)cost * 1000;
+  b->tokens = (int32_t)(tokens < -max ? -max : tokens);
+}
+
+static char *MQTTClientCopyString(lwmqtt_string_t str) {
+  // allocate string
+  auto copy = (char *)malloc(str.len + 1);
+  if (copy == nullptr) {
+    return nullptr;
+  }
+
+  // copy string from flash or memory
+#if LWMQTT_ENABLE_PROGMEM
+  if (str.flash) {
+    memcpy_P(copy, str.data, str.len);
+  } else {
+    memcpy(copy, str.data, str.len);
+  }
+#else
+  memcpy(copy, str.data, str.len);
+#endif
+  copy[str.len] = 0;
+
+  return copy;
+}
+#endif
+
+#if LWMQTT_ENABLE_TRACE
+static uint32_t MQTTClientMillis() { return millis(); }
+
+class MQTTClientCounter : public Print {
+ public:
+  size_t count = 0;
+
+  size_t write(uint8_t) override {
+    this->count++;
+    return 1;
+  }
+  using Print::write;
+};
+
+static void MQTTClientPrintEvent(Print &out, lwmqtt_trace_event_t *event) {
+  // print time
+  out.print(event->time);
+
+  // print event type
+  switch (event->type) {
+    case LWMQTT_TRACE_PACKET_SENT:
+      out.print(F(" sent"));
+      break;
+    case LWMQTT_TRACE_PACKET_RECEIVED:
+      out.print(F(" received"));
+      break;
+    case LWMQTT_TRACE_NETWORK_READ:
+      out.print(F(" read"));
+      break;
+    case LWMQTT_TRACE_NETWORK_WRITE:
+      out.print(F(" write"));
+      break;
+    case LWMQTT_TRACE_TIMEOUT:
+      out.print(F(" timeout"));
+      break;
+    default:
+      out.print(F(" error"));
+      break;
   }
 
+  // print packet type
+  switch (event->packet) {
+    case 0:
+      break;
+    case 1:
+      out.print(F(" CONNECT"));
+      break;
+    case 2:
+      out.print(F(" CONNACK"));
+      break;
+    case 3:
+      out.print(F(" PUBLISH"));
+      break;
+    case 4:
+      out.print(F(" PUBACK"));
+      break;
+    case 5:
+      out.print(F(" PUBREC"));
+      break;
+    case 6:
+      out.print(F(" PUBREL"));
+      break;
+    case 7:
+      out.print(F(" PUBCOMP"));
+      break;
+    case 8:
+      out.print(F(" SUBSCRIBE"));
+      break;
+    case 9:
+      out.print(F(" SUBACK"));
+      break;
+    case 10:
+      out.print(F(" UNSUBSCRIBE"));
+      break;
+    case 11:
+      out.print(F(" UNSUBACK"));
+      break;
+    case 12:
+      out.print(F(" PINGREQ"));
+      break;
+    case 13:
+      out.print(F(" PINGRESP"));
+      break;
+    default:
+      out.print(F(" DISCONNECT"));
+      break;
+  }
+
+  // print packet id, value and duration
+  if (event->packet_id > 0) {
+    out.print(F(" id="));
+    out.print(event->packet_id);
+  }
+  out.print(F(" value="));
+  out.print((long)event->value);
+  if (event->duration > 0) {
+    out.print(F(" ms="));
+    out.print(event->duration);
+  }
+  out.print('\n');
+}
+
+static void MQTTClientTraceWriter(MQTTClientPayload &payload, void *ref) {
+  // cast client
+  auto c = (lwmqtt_client_t *)ref;
+
+  // find the oldest event from which on the newest events fit into the payload
+  uint32_t count = c->trace_count < c->trace_size ? c->trace_count : (uint32_t)c->trace_size;
+  uint32_t first = c->trace_count;
+  MQTTClientCounter counter;
+  while (first > c->trace_count - count) {
+    MQTTClientPrintEvent(counter, &c->trace_events[(first - 1) % c->trace_size]);
+    if (counter.count > payload.capacity()) {
+      break;
+    }
+    first--;
+  }
+
+  // print events
+  for (uint32_t i = first; i != c->trace_count; i++) {
+    MQTTClientPrintEvent(payload, &c->trace_events[i % c->trace_size]);
+  }
+}
+#endif
+
+static uint16_t MQTTClientChecksum(const uint8_t *buf, size_t len) {
+  // calculate fletcher-16 checksum
+  uint16_t sum1 = 0;
+  uint16_t sum2 = 0;
+  for (size_t i = 0; i < len; i++) {
+    sum1 = (uint16_t)((sum1 + buf[i]) % 255);
+    sum2 = (uint16_t)((sum2 + sum1) % 255);
+  }
+
+  return (uint16_t)((sum2 << 8) | sum1);
+}
+
+static void MQTTClientCall(MQTTClientCallback *cb, char topic[], char payload[], int length) {
   // call the advanced callback and return if available
   if (cb->advanced != nullptr) {
-    cb->advanced(cb->client, terminated_topic, (char *)message.payload, (int)message.payload_len);
+    cb->advanced(cb->client, topic, payload, length);
     return;
   }
 #if MQTT_HAS_FUNCTIONAL
   if (cb->functionAdvanced != nullptr) {
-    cb->functionAdvanced(cb->client, terminated_topic, (char *)message.payload, (int)message.payload_len);
+    cb->functionAdvanced(cb->client, topic, payload, length);
     return;
   }
 #endif
@@ -138,12 +541,12 @@ static void MQTTClientHandler(lwmqtt_client_t * /*client*/, void *ref, lwmqtt_st
 #endif
 
   // create topic string
-  String str_topic = String(terminated_topic);
+  String str_topic = String(topic);
 
   // create payload string
   String str_payload;
-  if (message.payload != nullptr) {
-    str_payload = String((const char *)message.payload);
+  if (payload != nullptr) {
+    str_payload = String((const char *)payload);
   }
 
   // call simple callback
@@ -158,6 +561,194 @@ static void MQTTClientHandler(lwmqtt_client_t * /*client*/, void *ref, lwmqtt_st
 #endif
 }
 
+static void MQTTClientDispatch(MQTTClientCallback *cb, char topic[], char payload[], int length) {
+#if LWMQTT_ENABLE_HANDLER_STATS
+  // call callback and measure its duration
+  uint32_t start = micros();
+  MQTTClientCall(cb, topic, payload, length);
+  uint32_t duration = micros() - start;
+
+  // update statistics
+  MQTTClientHandlerStats *s = &cb->stats;
+  if (s->count == 0 || duration < s->min) {
+    s->min = duration;
+  }
+  if (duration > s->max) {
+    s->max = duration;
+  }
+  s->count++;
+  cb->handlerTotal += duration;
+
+  // report slow handlers
+  if (cb->handlerBudget > 0 && duration > cb->handlerBudget) {
+    s->slow++;
+    if (cb->slowHandler != nullptr) {
+      cb->slowHandler(cb->client, topic, duration);
+    }
+  }
+#else
+  // call callback
+  MQTTClientCall(cb, topic, payload, length);
+#endif
+}
+
+static bool MQTTClientStore(char **buf, size_t *size, const void *data, size_t len) {
+  // grow buffer if needed
+  if (*size < len + 1) {
+    auto grown = (char *)realloc(*buf, len + 1);
+    if (grown == nullptr) {
+      return false;
+    }
+    *buf = grown;
+    *size = len + 1;
+  }
+
+  // copy data (null terminated)
+  if (len > 0) {
+    memcpy(*buf, data, len);
+  }
+  (*buf)[len] = '\0';
+
+  return true;
+}
+
+static void MQTTClientFreeSlots(MQTTClientConflated *slots, int count) {
+  // free slot buffers and list
+  for (int i = 0; i < count; i++) {
+    free(slots[i].topic);
+    free(slots[i].payload);
+  }
+  free(slots);
+}
+
+static bool MQTTClientHold(MQTTClientConflation *c, lwmqtt_string_t topic, lwmqtt_message_t message) {
+  // check filters
+  bool matched = false;
+  for (int i = 0; i < c->filterCount && !matched; i++) {
+    matched = lwmqtt_topic_match(lwmqtt_string(c->filters[i]), topic);
+  }
+  if (!matched) {
+    return false;
+  }
+
+  // replace payload of an already held message with the same topic
+  for (int i = 0; i < c->heldCount; i++) {
+    MQTTClientConflated *slot = &c->held[i];
+    if (lwmqtt_strcmp(topic, slot->topic) == 0) {
+      if (!MQTTClientStore(&slot->payload, &slot->payloadSize, message.payload, message.payload_len)) {
+        return false;
+      }
+      slot->length = (int)message.payload_len;
+      c->collapsed++;
+      return true;
+    }
+  }
+
+  // add a slot if all slots of earlier loops are in use
+  if (c->heldCount == c->slotCount) {
+    auto held = (MQTTClientConflated *)realloc(c->held, sizeof(MQTTClientConflated) * (c->slotCount + 1));
+    if (held == nullptr) {
+      return false;
+    }
+    c->held = held;
+    c->held[c->slotCount] = {nullptr, 0, nullptr, 0, 0};
+    c->slotCount++;
+  }
+
+  // otherwise hold a new message, the buffers of the slot are reused across loops
+  MQTTClientConflated *slot = &c->held[c->heldCount];
+  if (!MQTTClientStore(&slot->topic, &slot->topicSize, topic.data, topic.len) ||
+      !MQTTClientStore(&slot->payload, &slot->payloadSize, message.payload, message.payload_len)) {
+    return false;
+  }
+  slot->length = (int)message.payload_len;
+  c->heldCount++;
+
+  return true;
+}
+
+static void MQTTClientRelease(MQTTClientCallback *cb) {
+  // take held messages (the callback may clear the conflation while they are dispatched)
+  MQTTClientConflation *c = cb->conflation;
+  MQTTClientConflated *held = c->held;
+  int heldCount = c->heldCount;
+  int slotCount = c->slotCount;
+  c->held = nullptr;
+  c->heldCount = 0;
+  c->slotCount = 0;
+
+  // dispatch held messages in order of their first arrival
+  for (int i = 0; i < heldCount; i++) {
+    MQTTClientDispatch(cb, held[i].topic, held[i].payload, held[i].length);
+  }
+
+  // keep the slots for the next loop unless the conflation has been cleared meanwhile
+  c = cb->conflation;
+  if (c != nullptr && c->held == nullptr) {
+    c->held = held;
+    c->slotCount = slotCount;
+  } else {
+    MQTTClientFreeSlots(held, slotCount);
+  }
+}
+
+static void MQTTClientHandler(lwmqtt_client_t * /*client*/, void *ref, lwmqtt_string_t topic,
+                              lwmqtt_message_t message) {
+  // get callback
+  auto cb = (MQTTClientCallback *)ref;
+
+  // null terminate topic
+  char terminated_topic[topic.len + 1];
+  memcpy(terminated_topic, topic.data, topic.len);
+  terminated_topic[topic.len] = '\0';
+
+  // null terminate payload if available
+  if (message.payload != nullptr) {
+    message.payload[message.payload_len] = '\0';
+  }
+
+  // pass message to interceptor which may consume it
+  if (cb->interceptor != nullptr && cb->interceptor(cb->client, cb->interceptorRef, terminated_topic,
+                                                    (char *)message.payload, (int)message.payload_len)) {
+    return;
+  }
+
+  // hold message if it is conflated within the current loop
+  if (cb->conflation != nullptr && cb->conflation->active && MQTTClientHold(cb->conflation, topic, message)) {
+    return;
+  }
+
+  // dispatch message
+  MQTTClientDispatch(cb, terminated_topic, (char *)message.payload, (int)message.payload_len);
+}
+
+size_t MQTTClientPayload::write(uint8_t byte) { return this->write(&byte, 1); }
+
+size_t MQTTClientPayload::write(const uint8_t *data, size_t size) {
+  // check capacity
+  if (size > this->cap - this->len) {
+    this->overflow = true;
+    return 0;
+  }
+
+  // append data
+  memcpy(this->buf + this->len, data, size);
+  this->len += size;
+
+  return size;
+}
+
+void MQTTClientPayload::setLength(size_t length) {
+  // check capacity
+  if (length > this->cap) {
+    this->overflow = true;
+    return;
+  }
+
+  // set length
+  this->len = length;
+}
+
 MQTTClient::MQTTClient(int readBufSize, int writeBufSize) {
   // allocate buffers
   this->readBufSize = (size_t)readBufSize;
@@ -166,24 +757,83 @@ MQTTClient::MQTTClient(int readBufSize, int writeBufSize) {
   this->writeBuf = (uint8_t *)malloc((size_t)writeBufSize);
 }
 
+MQTTClient::MQTTClient(int bufSize, MQTTClientBufferMode mode) {
+  // allocate read buffer
+  this->readBufSize = (size_t)bufSize;
+  this->writeBufSize = (size_t)bufSize;
+  this->readBuf = (uint8_t *)malloc((size_t)bufSize + 1);
+
+  // allocate write buffer unless the read buffer serves both directions
+  this->writeBuf = mode == MQTT_BUFFER_SHARED ? this->readBuf : (uint8_t *)malloc((size_t)bufSize);
+}
+
+#if LWMQTT_ENABLE_BUFFER_POOL
+MQTTClient::MQTTClient(int bufSize, MQTTBufferPool &_pool) {
+  // set pool and the maximum packet size
+  this->pool = &_pool;
+  this->poolLimit = (size_t)bufSize;
+
+  // allocate local buffers for small packets, larger packets borrow a buffer from the pool
+  this->readBufSize = MQTT_POOL_LOCAL_SIZE;
+  this->writeBufSize = MQTT_POOL_LOCAL_SIZE;
+  this->readBuf = (uint8_t *)malloc(MQTT_POOL_LOCAL_SIZE + 1);
+  this->writeBuf = (uint8_t *)malloc(MQTT_POOL_LOCAL_SIZE);
+}
+#endif
+
 MQTTClient::~MQTTClient() {
+#if LWMQTT_ENABLE_WILL
   // free will
   this->clearWill();
+#endif
+
+#if LWMQTT_ENABLE_PIPELINE
+  // free staged packets
+  this->clearStaged();
+#endif
 
   // free hostname
   if (this->hostname != nullptr) {
     free((void *)this->hostname);
   }
 
+#if LWMQTT_ENABLE_ENDPOINTS
+  // free endpoints
+  this->clearEndpoints();
+#endif
+
+  // free conflation
+  this->clearConflation();
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // free rate limits
+  this->clearRateLimits();
+#endif
+
+  // return borrowed buffers
+  this->giveBackRead();
+  this->giveBackWrite();
+
   // free buffers
   free(this->readBuf);
-  free(this->writeBuf);
+  if (this->writeBuf != this->readBuf) {
+    free(this->writeBuf);
+  }
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // free outbound queues
+  this->setOutboundQueue(0);
+#endif
 }
 
 void MQTTClient::begin(Client &_client) {
   // set client
   this->netClient = &_client;
 
+  // return borrowed buffers
+  this->giveBackRead();
+  this->giveBackWrite();
+
   // initialize client
   lwmqtt_init(&this->client, this->writeBuf, this->writeBufSize, this->readBuf, this->readBufSize);
 
@@ -195,6 +845,13 @@ void MQTTClient::begin(Client &_client) {
 
   // set callback
   lwmqtt_set_callback(&this->client, (void *)&this->callback, MQTTClientHandler);
+
+#if LWMQTT_ENABLE_BUFFER_POOL
+  // borrow buffers for large incoming packets from the pool
+  if (this->pool != nullptr) {
+    lwmqtt_set_read_hook(&this->client, this, MQTTClient::poolHook);
+  }
+#endif
 }
 
 void MQTTClient::onMessage(MQTTClientCallbackSimple cb) {
@@ -242,6 +899,9 @@ void MQTTClient::onMessageAdvanced(MQTTClientCallbackAdvancedFunction cb) {
 void MQTTClient::setClockSource(MQTTClientClockSource cb) {
   this->timer1.millis = cb;
   this->timer2.millis = cb;
+#if LWMQTT_ENABLE_TRACE
+  this->client.trace_clock = cb != nullptr ? cb : MQTTClientMillis;
+#endif
 }
 
 void MQTTClient::setHost(IPAddress _address, int _port) {
@@ -261,45 +921,145 @@ void MQTTClient::setHost(const char _hostname[], int _port) {
   this->port = _port;
 }
 
-void MQTTClient::setWill(const char topic[], const char payload[], bool retained, int qos) {
-  // return if topic is missing
-  if (topic == nullptr || strlen(topic) == 0) {
-    return;
+#if LWMQTT_ENABLE_ENDPOINTS
+bool MQTTClient::addEndpoint(const char _hostname[], int _port) {
+  // return if hostname is empty
+  if (_hostname == nullptr || strlen(_hostname) == 0) {
+    return false;
   }
 
-  // clear existing will
-  this->clearWill();
+  // copy hostname
+  char *copy = strdup(_hostname);
+  if (copy == nullptr) {
+    return false;
+  }
 
-  // allocate will
-  this->will = (lwmqtt_will_t *)malloc(sizeof(lwmqtt_will_t));
-  memset(this->will, 0, sizeof(lwmqtt_will_t));
+  // append endpoint
+  auto list = (MQTTClientEndpoint *)realloc(this->endpointList, sizeof(MQTTClientEndpoint) * (this->endpointCount + 1));
+  if (list == nullptr) {
+    free(copy);
+    return false;
+  }
+  this->endpointList = list;
+  this->endpointList[this->endpointCount] = {copy, IPAddress(), (uint16_t)_port, false, 0, 0, 0, 0};
+  this->endpointCount++;
 
-  // set topic
-  this->will->topic = lwmqtt_string(strdup(topic));
+  return true;
+}
 
-  // set payload if available
-  if (payload != nullptr && strlen(payload) > 0) {
-    this->will->payload = lwmqtt_string(strdup(payload));
+bool MQTTClient::addEndpoint(IPAddress _address, int _port) {
+  // append endpoint
+  auto list = (MQTTClientEndpoint *)realloc(this->endpointList, sizeof(MQTTClientEndpoint) * (this->endpointCount + 1));
+  if (list == nullptr) {
+    return false;
   }
+  this->endpointList = list;
+  this->endpointList[this->endpointCount] = {nullptr, _address, (uint16_t)_port, true, 0, 0, 0, 0};
+  this->endpointCount++;
 
-  // set flags
-  this->will->retained = retained;
-  this->will->qos = (lwmqtt_qos_t)qos;
+  return true;
 }
 
-void MQTTClient::clearWill() {
-  // return if not set
-  if (this->will == nullptr) {
-    return;
+void MQTTClient::clearEndpoints() {
+  // free hostnames
+  for (int i = 0; i < this->endpointCount; i++) {
+    free(this->endpointList[i].hostname);
   }
 
-  // free payload if set
-  if (this->will->payload.len > 0) {
+  // free list
+  free(this->endpointList);
+  this->endpointList = nullptr;
+  this->endpointCount = 0;
+  this->endpointIndex = -1;
+}
+
+void MQTTClient::setResolver(MQTTClientResolver cb, uint32_t ttl) {
+  // set resolver and time to live
+  this->resolver = cb;
+  this->resolverTTL = ttl;
+
+  // forget resolved hostnames
+  for (int i = 0; i < this->endpointCount; i++) {
+    if (this->endpointList[i].hostname != nullptr) {
+      this->endpointList[i].resolved = false;
+    }
+  }
+}
+#endif
+
+#if LWMQTT_ENABLE_TLS_SESSION
+void MQTTClient::setTLSSessionHooks(MQTTClientTLSHook restore, MQTTClientTLSHook save) {
+  // set hooks
+  this->tlsRestore = restore;
+  this->tlsSave = save;
+}
+
+void MQTTClient::resetTLSStats() {
+  // reset stats
+  this->_tlsStats = {0, 0, 0, 0, 0};
+}
+#endif
+
+#if LWMQTT_ENABLE_WILL
+void MQTTClient::setWill(const char topic[], const char payload[], bool retained, int qos) {
+  // return if topic is missing
+  if (topic == nullptr || strlen(topic) == 0) {
+    return;
+  }
+
+  // copy payload if available
+  char *payloadCopy = nullptr;
+  if (payload != nullptr && strlen(payload) > 0) {
+    payloadCopy = strdup(payload);
+  }
+
+  // set will with copied topic and payload
+  this->setWill(lwmqtt_string(strdup(topic)), lwmqtt_string(payloadCopy), retained, qos, true);
+}
+
+void MQTTClient::setWill(const __FlashStringHelper *topic, const __FlashStringHelper *payload, bool retained,
+                         int qos) {
+  // return if topic is missing
+  lwmqtt_string_t topicStr = lwmqtt_flash_string((const char *)topic);
+  if (topicStr.len == 0) {
+    return;
+  }
+
+  // set will that references topic and payload in flash
+  this->setWill(topicStr, lwmqtt_flash_string((const char *)payload), retained, qos, false);
+}
+
+void MQTTClient::setWill(lwmqtt_string_t topic, lwmqtt_string_t payload, bool retained, int qos, bool copied) {
+  // clear existing will
+  this->clearWill();
+
+  // allocate will
+  this->will = (lwmqtt_will_t *)malloc(sizeof(lwmqtt_will_t));
+  memset(this->will, 0, sizeof(lwmqtt_will_t));
+
+  // set topic and payload
+  this->will->topic = topic;
+  this->will->payload = payload;
+  this->willCopied = copied;
+
+  // set flags
+  this->will->retained = retained;
+  this->will->qos = (lwmqtt_qos_t)qos;
+}
+
+void MQTTClient::clearWill() {
+  // return if not set
+  if (this->will == nullptr) {
+    return;
+  }
+
+  // free payload if copied
+  if (this->willCopied && this->will->payload.len > 0) {
     free(this->will->payload.data);
   }
 
-  // free topic if set
-  if (this->will->topic.len > 0) {
+  // free topic if copied
+  if (this->willCopied && this->will->topic.len > 0) {
     free(this->will->topic.data);
   }
 
@@ -307,19 +1067,796 @@ void MQTTClient::clearWill() {
   free(this->will);
   this->will = nullptr;
 }
+#endif
+
+#if LWMQTT_ENABLE_PIPELINE
+bool MQTTClient::stageSubscribe(const char topic[], int qos) {
+  // prepare subscription
+  MQTTClientStaged item = {lwmqtt_string(topic), lwmqtt_default_message, true};
+  item.message.qos = (lwmqtt_qos_t)qos;
+
+  return this->stage(item);
+}
+
+bool MQTTClient::stagePublish(const char topic[], const char payload[], int length, bool retained, int qos) {
+  // prepare publication
+  MQTTClientStaged item = {lwmqtt_string(topic), lwmqtt_default_message, false};
+  item.message.payload = (uint8_t *)payload;
+  item.message.payload_len = (size_t)length;
+  item.message.retained = retained;
+  item.message.qos = (lwmqtt_qos_t)qos;
+
+  return this->stage(item);
+}
+
+bool MQTTClient::stage(MQTTClientStaged item) {
+  // return if topic is missing
+  if (item.topic.len == 0) {
+    return false;
+  }
+
+  // grow list
+  auto list = (MQTTClientStaged *)realloc(this->staged, sizeof(MQTTClientStaged) * (this->stagedCount + 1));
+  if (list == nullptr) {
+    return false;
+  }
+
+  // append item
+  list[this->stagedCount] = item;
+  this->staged = list;
+  this->stagedCount++;
+
+  return true;
+}
+
+void MQTTClient::clearStaged() {
+  // free list
+  free(this->staged);
+  this->staged = nullptr;
+  this->stagedCount = 0;
+}
+#endif
+
+bool MQTTClient::conflate(const char filter[]) {
+  // return if filter is missing
+  if (filter == nullptr || strlen(filter) == 0) {
+    return false;
+  }
+
+  // allocate conflation
+  if (this->callback.conflation == nullptr) {
+    this->callback.conflation = new MQTTClientConflation();
+  }
+  MQTTClientConflation *c = this->callback.conflation;
+
+  // grow list
+  auto list = (char **)realloc(c->filters, sizeof(char *) * (c->filterCount + 1));
+  if (list == nullptr) {
+    return false;
+  }
+  c->filters = list;
+
+  // append filter
+  c->filters[c->filterCount] = strdup(filter);
+  c->filterCount++;
+
+  return true;
+}
+
+void MQTTClient::clearConflation() {
+  // return if not set
+  MQTTClientConflation *c = this->callback.conflation;
+  if (c == nullptr) {
+    return;
+  }
+
+  // free filters
+  for (int i = 0; i < c->filterCount; i++) {
+    free(c->filters[i]);
+  }
+  free(c->filters);
+
+  // free held messages and slots
+  MQTTClientFreeSlots(c->held, c->slotCount);
+
+  // free conflation
+  delete c;
+  this->callback.conflation = nullptr;
+}
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+bool MQTTClient::setOutboundQueue(size_t size, size_t bulkSize) {
+  // free existing queues
+  lwmqtt_arduino_outbound_t *o = this->network.outbound;
+  if (o != nullptr) {
+    free(o->queues[0].buf);
+    free(o->queues[1].buf);
+    free(o);
+    this->network.outbound = nullptr;
+  }
+
+  // return if disabled
+  if (size == 0) {
+    return true;
+  }
+
+  // allocate queue state
+  o = (lwmqtt_arduino_outbound_t *)calloc(1, sizeof(lwmqtt_arduino_outbound_t));
+  if (o == nullptr) {
+    return false;
+  }
+  o->sendClass = -1;
+
+  // allocate queues
+  size_t sizes[2] = {size, bulkSize};
+  for (int i = 0; i < 2; i++) {
+    if (sizes[i] == 0) {
+      continue;
+    }
+    o->queues[i].buf = (uint8_t *)malloc(sizes[i]);
+    if (o->queues[i].buf == nullptr) {
+      free(o->queues[0].buf);
+      free(o);
+      return false;
+    }
+    o->queues[i].size = sizes[i];
+  }
+
+  // enable queues
+  this->network.outbound = o;
+
+  return true;
+}
+#endif
+
+bool MQTTClient::bufferBusy() {
+  // check if the shared buffer holds the packet that is being dispatched
+  if (this->writeBuf != this->readBuf || !this->client.dispatching) {
+    return false;
+  }
+
+  // set error, the connection stays open
+  this->_lastError = LWMQTT_SHARED_BUFFER_BUSY;
+
+  return true;
+}
+
+bool MQTTClient::outboundRoom(size_t length) {
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // always accept packets if no queue is configured
+  lwmqtt_arduino_outbound_t *o = this->network.outbound;
+  if (o == nullptr) {
+    return true;
+  }
+
+  // continue sending queued bytes
+  lwmqtt_arduino_network_drain(&this->network);
+
+  // get the queue that will take the publish packet
+  lwmqtt_arduino_queue_t *q = &o->queues[0];
+  if (this->network.priority == MQTT_PRIORITY_BULK && o->queues[1].buf != nullptr) {
+    q = &o->queues[1];
+  }
+
+  // accept packets that fit into the queue, and larger packets only into an empty queue (which then blocks)
+  return q->length == 0 || length <= q->size - q->length;
+#else
+  // always accept packets without queues
+  (void)length;
+
+  return true;
+#endif
+}
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+bool MQTTClient::setRateLimit(uint32_t messages, uint32_t bytes, MQTTClientRateMode mode) {
+  // set global limit
+  if (!this->setRateLimit(nullptr, messages, bytes)) {
+    return false;
+  }
+
+  // set mode
+  this->limiter->mode = mode;
+
+  return true;
+}
+
+bool MQTTClient::setRateLimit(const char filter[], uint32_t messages, uint32_t bytes) {
+  // return if filter is empty
+  if (filter != nullptr && strlen(filter) == 0) {
+    return false;
+  }
+
+  // allocate limiter
+  if (this->limiter == nullptr) {
+    this->limiter = new MQTTClientRateLimiter();
+  }
+  MQTTClientRateLimiter *l = this->limiter;
+
+  // find existing limit
+  MQTTClientRateLimit *limit = nullptr;
+  for (int i = 0; i < l->limitCount; i++) {
+    char *f = l->limits[i].filter;
+    if ((f == nullptr && filter == nullptr) || (f != nullptr && filter != nullptr && strcmp(f, filter) == 0)) {
+      limit = &l->limits[i];
+    }
+  }
+
+  // otherwise append limit
+  if (limit == nullptr) {
+    auto list = (MQTTClientRateLimit *)realloc(l->limits, sizeof(MQTTClientRateLimit) * (l->limitCount + 1));
+    if (list == nullptr) {
+      return false;
+    }
+    l->limits = list;
+    limit = &l->limits[l->limitCount];
+    limit->filter = filter != nullptr ? strdup(filter) : nullptr;
+    l->limitCount++;
+  }
+
+  // set rates (limited to keep one second worth of tokens in range) and fill buckets
+  uint32_t now = this->now();
+  limit->messages = {messages < 1000000 ? messages : 1000000, 0, now};
+  limit->bytes = {bytes < 1000000 ? bytes : 1000000, 0, now};
+  limit->messages.tokens = (int32_t)(limit->messages.rate * 1000);
+  limit->bytes.tokens = (int32_t)(limit->bytes.rate * 1000);
+
+  return true;
+}
+
+void MQTTClient::clearRateLimits() {
+  // return if not set
+  MQTTClientRateLimiter *l = this->limiter;
+  if (l == nullptr) {
+    return;
+  }
+
+  // free limits
+  for (int i = 0; i < l->limitCount; i++) {
+    free(l->limits[i].filter);
+  }
+  free(l->limits);
+
+  // free pending messages
+  for (int i = 0; i < l->pendingCount; i++) {
+    free(l->pending[i].topic);
+    free(l->pending[i].payload);
+  }
+  free(l->pending);
+
+  // free limiter
+  delete l;
+  this->limiter = nullptr;
+}
+
+uint32_t MQTTClient::rateWait(lwmqtt_string_t topic, size_t bytes) {
+  // get current time
+  uint32_t now = this->now();
+
+  // get longest wait of the global and all matching limits
+  uint32_t wait = 0;
+  for (int i = 0; i < this->limiter->limitCount; i++) {
+    MQTTClientRateLimit *limit = &this->limiter->limits[i];
+    if (limit->filter != nullptr && !lwmqtt_topic_match(lwmqtt_string(limit->filter), topic)) {
+      continue;
+    }
+
+    // refill buckets
+    MQTTClientBucketRefill(&limit->messages, now);
+    MQTTClientBucketRefill(&limit->bytes, now);
+
+    // update wait
+    uint32_t w = MQTTClientBucketWait(&limit->messages, 1);
+    if (w > wait) {
+      wait = w;
+    }
+    w = MQTTClientBucketWait(&limit->bytes, bytes);
+    if (w > wait) {
+      wait = w;
+    }
+  }
+
+  return wait;
+}
+
+void MQTTClient::rateTake(lwmqtt_string_t topic, size_t bytes) {
+  // take tokens from the global and all matching limits
+  for (int i = 0; i < this->limiter->limitCount; i++) {
+    MQTTClientRateLimit *limit = &this->limiter->limits[i];
+    if (limit->filter == nullptr || lwmqtt_topic_match(lwmqtt_string(limit->filter), topic)) {
+      MQTTClientBucketTake(&limit->messages, 1);
+      MQTTClientBucketTake(&limit->bytes, bytes);
+    }
+  }
+}
+
+bool MQTTClient::rateAdmit(lwmqtt_string_t topic, size_t bytes, bool queueable) {
+  // admit messages that are released from the queue
+  MQTTClientRateLimiter *l = this->limiter;
+  if (l->releasing) {
+    return true;
+  }
+
+  // get wait time, messages queue up behind already queued messages to keep their order
+  uint32_t wait = this->rateWait(topic, bytes);
+  if (wait == 0 && l->pendingCount == 0) {
+    return true;
+  }
+
+  // increment counter
+  l->limited++;
+
+  // wait for the budget if it becomes available within the command timeout
+  if (l->mode == MQTT_RATE_DELAY && wait <= this->commandTimeout()) {
+    uint32_t start = millis();
+    while (millis() - start < wait) {
+      uint32_t step = wait - (millis() - start);
+      delay(step < MQTT_WAIT_POLL_INTERVAL ? step : MQTT_WAIT_POLL_INTERVAL);
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+      // continue sending queued bytes
+      if (this->outboundQueued() > 0) {
+        lwmqtt_arduino_network_drain(&this->network);
+      }
+#endif
+    }
+
+    return true;
+  }
+
+  // otherwise set error unless the message is queued by the caller
+  if (l->mode != MQTT_RATE_QUEUE || !queueable) {
+    this->_lastError = LWMQTT_RATE_LIMITED;
+  }
+
+  return false;
+}
+
+bool MQTTClient::rateQueue(lwmqtt_string_t topic, const char payload[], int length, bool retained, int qos) {
+  // check queue size
+  MQTTClientRateLimiter *l = this->limiter;
+  if (l->pendingCount >= MQTT_RATE_QUEUE_SIZE) {
+    this->_lastError = LWMQTT_RATE_LIMITED;
+    return false;
+  }
+
+  // grow list
+  auto list = (MQTTClientRatePending *)realloc(l->pending, sizeof(MQTTClientRatePending) * (l->pendingCount + 1));
+  if (list == nullptr) {
+    this->_lastError = LWMQTT_RATE_LIMITED;
+    return false;
+  }
+  l->pending = list;
+
+  // copy message
+  MQTTClientRatePending *p = &l->pending[l->pendingCount];
+  p->topic = MQTTClientCopyString(topic);
+  p->payload = (char *)malloc(length > 0 ? (size_t)length : 1);
+  if (p->topic == nullptr || p->payload == nullptr) {
+    free(p->topic);
+    free(p->payload);
+    this->_lastError = LWMQTT_RATE_LIMITED;
+    return false;
+  }
+  if (length > 0) {
+    memcpy(p->payload, payload, (size_t)length);
+  }
+  p->length = length;
+  p->retained = retained;
+  p->qos = qos;
+  l->pendingCount++;
+
+  return true;
+}
+
+void MQTTClient::rateRelease() {
+  // send queued messages in order while their budget is available
+  MQTTClientRateLimiter *l = this->limiter;
+  while (l->pendingCount > 0 && this->connected()) {
+    MQTTClientRatePending *p = &l->pending[0];
+    lwmqtt_string_t topic = lwmqtt_string(p->topic);
+    if (this->rateWait(topic, (size_t)p->length) > 0) {
+      return;
+    }
+
+    // publish message
+    l->releasing = true;
+    bool ok = this->publish(topic, p->payload, p->length, p->retained, p->qos);
+    l->releasing = false;
+
+    // keep message if the outbound queue is full
+    if (!ok && this->_lastError == LWMQTT_OUTBOUND_QUEUE_FULL) {
+      return;
+    }
+
+    // remove message (it is dropped if the publish failed)
+    free(p->topic);
+    free(p->payload);
+    l->pendingCount--;
+    memmove(l->pending, l->pending + 1, sizeof(MQTTClientRatePending) * l->pendingCount);
+  }
+}
+
+uint32_t MQTTClient::rateBudget(const char topic[], bool bytes) {
+  // return maximum if unlimited
+  if (this->limiter == nullptr) {
+    return UINT32_MAX;
+  }
+
+  // refill matching buckets
+  lwmqtt_string_t str = lwmqtt_string(topic);
+  this->rateWait(str, 0);
+
+  // get smallest budget of the global and all limits that match the topic
+  uint32_t budget = UINT32_MAX;
+  for (int i = 0; i < this->limiter->limitCount; i++) {
+    MQTTClientRateLimit *limit = &this->limiter->limits[i];
+    if (limit->filter != nullptr && (topic == nullptr || !lwmqtt_topic_match(lwmqtt_string(limit->filter), str))) {
+      continue;
+    }
+    MQTTClientBucket *b = bytes ? &limit->bytes : &limit->messages;
+    if (b->rate > 0) {
+      uint32_t tokens = b->tokens > 0 ? (uint32_t)b->tokens / 1000 : 0;
+      if (tokens < budget) {
+        budget = tokens;
+      }
+    }
+  }
+
+  return budget;
+}
+#endif
 
 void MQTTClient::setKeepAlive(int _keepAlive) { this->keepAlive = _keepAlive; }
 
-void MQTTClient::setCleanSession(bool _cleanSession) { this->cleanSession = _cleanSession; }
+void MQTTClient::setCleanSession(bool _cleanSession) { this->cleanSession = _cleanSession; }
+
+void MQTTClient::setTimeout(int _timeout) { this->timeout = _timeout; }
+
+#if LWMQTT_ENABLE_RTT
+void MQTTClient::setAdaptiveTimeout(uint32_t _minTimeout, uint32_t _maxTimeout) {
+  // set bounds (zero disables adaptive timeouts)
+  this->minTimeout = _minTimeout;
+  this->maxTimeout = _maxTimeout;
+}
+#endif
+
+uint32_t MQTTClient::commandTimeout() {
+#if !LWMQTT_ENABLE_RTT
+  // use fixed timeout if round-trip times are not measured
+  return this->timeout;
+#else
+  // use fixed timeout if adaptive timeouts are disabled
+  if (this->maxTimeout == 0) {
+    return this->timeout;
+  }
+
+  // use fixed timeout until a round-trip time has been measured
+  uint32_t adaptive = lwmqtt_adaptive_timeout(&this->client);
+  if (adaptive == 0) {
+    return this->timeout;
+  }
+
+  // clamp timeout
+  if (adaptive < this->minTimeout) {
+    return this->minTimeout;
+  } else if (adaptive > this->maxTimeout) {
+    return this->maxTimeout;
+  }
+
+  return adaptive;
+#endif
+}
+
+#if LWMQTT_ENABLE_READ_LIMIT
+bool MQTTClient::setReadBufferLimit(size_t limit, uint32_t _shrinkAfter) {
+#if LWMQTT_ENABLE_BUFFER_POOL
+  // the read buffer of a pooled client is sized by the pool
+  if (this->pool != nullptr) {
+    return false;
+  }
+#endif
+
+  // shrink to the initial size and remove hook if disabled
+  if (limit == 0) {
+    if (this->readBufBase > 0 && !this->resizeReadBuffer(this->readBufBase)) {
+      return false;
+    }
+    this->readBufBase = 0;
+    this->readBufLimit = 0;
+    lwmqtt_set_read_hook(&this->client, nullptr, nullptr);
+    return true;
+  }
+
+  // remember the initial size, to which the buffer shrinks after a quiet period
+  if (this->readBufBase == 0) {
+    this->readBufBase = this->readBufSize;
+  }
+
+  // set limit and hook
+  this->readBufLimit = limit > this->readBufBase ? limit : this->readBufBase;
+  this->shrinkAfter = _shrinkAfter;
+  lwmqtt_set_read_hook(&this->client, this, MQTTClient::readHook);
+
+  return true;
+}
+
+bool MQTTClient::readHook(lwmqtt_client_t * /*client*/, void *ref, size_t size) {
+  // get client
+  auto c = (MQTTClient *)ref;
+
+  // remember the last packet that needed more than the initial size
+  if (size > c->readBufBase) {
+    c->lastLarge = c->now();
+  }
+
+  // return if the packet fits or cannot fit
+  if (size <= c->readBufSize) {
+    return true;
+  } else if (size > c->readBufLimit) {
+    return false;
+  }
+
+  // grow by doubling up to the limit
+  size_t next = c->readBufSize;
+  while (next < size) {
+    next *= 2;
+  }
+  if (next > c->readBufLimit) {
+    next = c->readBufLimit;
+  }
+
+  return c->resizeReadBuffer(next);
+}
+
+bool MQTTClient::resizeReadBuffer(size_t size) {
+  // a shared buffer never shrinks below the initial size that the write buffer relies on
+  bool shared = this->writeBuf == this->readBuf;
+  if (shared && size < this->writeBufSize) {
+    size = this->writeBufSize;
+  }
+
+  // return if unchanged
+  if (size == this->readBufSize) {
+    return true;
+  }
+
+  // keep the buffer while the message callback refers to a packet in it, a larger packet that is received by a
+  // command issued from the callback is dropped or fails as if the limit had been reached
+  if (this->client.dispatching) {
+    return false;
+  }
+
+  // reallocate buffer with room for the null terminator
+  auto buf = (uint8_t *)realloc(this->readBuf, size + 1);
+  if (buf == nullptr) {
+    return false;
+  }
+
+  // update buffer
+  this->readBuf = buf;
+  this->readBufSize = size;
+  this->client.read_buf = buf;
+  this->client.read_buf_size = size;
+  if (shared) {
+    this->writeBuf = buf;
+    this->client.write_buf = buf;
+  }
+
+  return true;
+}
+#endif
+
+#if LWMQTT_ENABLE_BUFFER_POOL
+bool MQTTClient::poolHook(lwmqtt_client_t *client, void *ref, size_t size) {
+  // get client
+  auto c = (MQTTClient *)ref;
+
+  // the header bytes read so far (at most five) have to move along with the buffer
+  size_t header = size < 5 ? size : 5;
+
+  // go back to the local buffer if the packet fits, unless the borrowed buffer holds a message that is being dispatched
+  if (size <= c->readBufSize && !client->dispatching) {
+    if (c->borrowedRead != nullptr) {
+      memcpy(c->readBuf, c->borrowedRead, header);
+      c->giveBackRead();
+    }
+    return true;
+  }
+
+  // return if the packet fits or cannot fit (with room for the null terminator)
+  if (size <= client->read_buf_size) {
+    return true;
+  } else if (size > c->poolLimit || size + 1 > c->pool->maxSize()) {
+    return false;
+  }
+
+  // keep the borrowed buffer while the message callback refers to a packet in it, a larger packet that is received
+  // by a command issued from the callback is dropped or fails as if it exceeded the maximum packet size
+  if (client->dispatching && c->borrowedRead != nullptr) {
+    return false;
+  }
+
+  // borrow a buffer with room for the null terminator
+  size_t capacity;
+  uint8_t *buf = c->pool->borrow(size + 1, &capacity);
+  if (buf == nullptr) {
+    return false;
+  }
+
+  // move header and return the previous buffer
+  memcpy(buf, client->read_buf, header);
+  if (c->borrowedRead != nullptr) {
+    c->pool->giveBack(c->borrowedRead);
+  }
+
+  // update buffer
+  c->borrowedRead = buf;
+  client->read_buf = buf;
+  client->read_buf_size = capacity - 1;
+
+  return true;
+}
+#endif
+
+bool MQTTClient::borrowWrite(size_t size) {
+#if LWMQTT_ENABLE_BUFFER_POOL
+  // return a buffer left by an outer command, its packet has already been written
+  this->giveBackWrite();
+
+  // use the local buffer if the packet fits
+  if (this->pool == nullptr || size <= this->writeBufSize) {
+    return true;
+  }
+
+  // borrow a buffer for at most the maximum packet size
+  size_t limit = this->writeLimit();
+  if (size > limit) {
+    size = limit;
+  }
+  size_t capacity;
+  uint8_t *buf = this->pool->borrow(size, &capacity);
+  if (buf == nullptr) {
+    // set error, the connection stays open
+    this->_lastError = LWMQTT_BUFFER_POOL_EXHAUSTED;
+    return false;
+  }
+
+  // update buffer
+  this->borrowedWrite = buf;
+  this->client.write_buf = buf;
+  this->client.write_buf_size = capacity < limit ? capacity : limit;
+
+  return true;
+#else
+  // always use the local buffer
+  (void)size;
+
+  return true;
+#endif
+}
+
+size_t MQTTClient::writeLimit() {
+#if LWMQTT_ENABLE_BUFFER_POOL
+  // the maximum packet size of a pooled client is limited by the largest class of the pool
+  if (this->pool != nullptr) {
+    size_t max = this->pool->maxSize();
+    return this->poolLimit < max ? this->poolLimit : max;
+  }
+#endif
+
+  return this->writeBufSize;
+}
+
+void MQTTClient::giveBackRead() {
+#if LWMQTT_ENABLE_BUFFER_POOL
+  // return if nothing is borrowed
+  if (this->borrowedRead == nullptr) {
+    return;
+  }
+
+  // restore local buffer
+  this->client.read_buf = this->readBuf;
+  this->client.read_buf_size = this->readBufSize;
+
+  // return buffer
+  this->pool->giveBack(this->borrowedRead);
+  this->borrowedRead = nullptr;
+#endif
+}
+
+void MQTTClient::giveBackWrite() {
+#if LWMQTT_ENABLE_BUFFER_POOL
+  // return if nothing is borrowed
+  if (this->borrowedWrite == nullptr) {
+    return;
+  }
+
+  // restore local buffer
+  this->client.write_buf = this->writeBuf;
+  this->client.write_buf_size = this->writeBufSize;
+
+  // return buffer
+  this->pool->giveBack(this->borrowedWrite);
+  this->borrowedWrite = nullptr;
+#endif
+}
+
+void MQTTClient::dropOverflow(bool enabled) {
+  // configure drop overflow
+  lwmqtt_drop_overflow(&this->client, enabled, &this->_droppedMessages);
+}
+
+void MQTTClient::ackBeforeDispatch(bool enabled) {
+  // configure ack ordering
+  lwmqtt_ack_before_dispatch(&this->client, enabled);
+}
+
+void MQTTClient::intercept(MQTTClientInterceptor cb, void *_ref) {
+  // set interceptor
+  this->callback.client = this;
+  this->callback.interceptor = cb;
+  this->callback.interceptorRef = _ref;
+}
+
+#if LWMQTT_ENABLE_HANDLER_STATS
+void MQTTClient::onSlowHandler(MQTTClientSlowHandler cb, uint32_t budget) {
+  // set hook and budget
+  this->callback.client = this;
+  this->callback.slowHandler = cb;
+  this->callback.handlerBudget = budget;
+}
+
+MQTTClientHandlerStats MQTTClient::handlerStats() {
+  // copy statistics and calculate average
+  MQTTClientHandlerStats stats = this->callback.stats;
+  if (stats.count > 0) {
+    stats.avg = (uint32_t)(this->callback.handlerTotal / stats.count);
+  }
+
+  return stats;
+}
+
+void MQTTClient::resetHandlerStats() {
+  // reset statistics
+  this->callback.stats = {0, 0, 0, 0, 0};
+  this->callback.handlerTotal = 0;
+}
+#endif
+
+#if LWMQTT_ENABLE_TRACE
+void MQTTClient::setTrace(lwmqtt_trace_event_t events[], size_t size) {
+  // configure trace with the configured clock
+  MQTTClientClockSource clock = this->timer1.millis != nullptr ? this->timer1.millis : MQTTClientMillis;
+  lwmqtt_set_trace(&this->client, events, size, clock);
+}
+
+void MQTTClient::printTrace(Print &out) {
+  // return if not tracing
+  if (this->client.trace_events == nullptr) {
+    return;
+  }
+
+  // print events from oldest to newest
+  uint32_t count = this->client.trace_count;
+  uint32_t size = (uint32_t)this->client.trace_size;
+  for (uint32_t i = count > size ? count - size : 0; i != count; i++) {
+    MQTTClientPrintEvent(out, &this->client.trace_events[i % size]);
+  }
+}
 
-void MQTTClient::setTimeout(int _timeout) { this->timeout = _timeout; }
+bool MQTTClient::publishTrace(const char topic[], bool retained, int qos) {
+  // return if not tracing
+  if (this->client.trace_events == nullptr) {
+    return false;
+  }
 
-void MQTTClient::dropOverflow(bool enabled) {
-  // configure drop overflow
-  lwmqtt_drop_overflow(&this->client, enabled, &this->_droppedMessages);
+  // publish the newest events that fit into the write buffer
+  return this->publish(lwmqtt_string(topic), MQTTClientTraceWriter, &this->client, retained, qos);
 }
+#endif
 
-bool MQTTClient::connect(const char clientID[], const char username[], const char password[], bool skip) {
+bool MQTTClient::connect(lwmqtt_string_t clientID, lwmqtt_string_t username, lwmqtt_string_t password, bool skip) {
   // close left open connection if still connected
   if (!skip && this->connected()) {
     this->close();
@@ -328,36 +1865,235 @@ bool MQTTClient::connect(const char clientID[], const char username[], const cha
   // save client
   this->network.client = this->netClient;
 
+#if LWMQTT_ENABLE_ENDPOINTS
+  // connect to the best endpoint if configured
+  if (!skip && this->endpointCount > 0) {
+    return this->connectEndpoints(clientID, username, password);
+  }
+#endif
+
   // connect to host
   if (!skip) {
-    int ret;
-    if (this->hostname != nullptr) {
-      ret = this->netClient->connect(this->hostname, (uint16_t)this->port);
-    } else {
-      ret = this->netClient->connect(this->address, (uint16_t)this->port);
-    }
+    int ret = this->connectNetwork(this->hostname, this->address, (uint16_t)this->port);
     if (ret <= 0) {
       this->_lastError = LWMQTT_NETWORK_FAILED_CONNECT;
       return false;
     }
   }
 
+  // perform handshake
+  if (!this->handshake(clientID, username, password)) {
+    return false;
+  }
+
+  // store session of the new secure connection
+  if (!skip) {
+    this->storeTLSSession();
+  }
+
+  return true;
+}
+
+int MQTTClient::connectNetwork(const char host[], IPAddress _address, uint16_t _port) {
+#if LWMQTT_ENABLE_TLS_SESSION
+  // hand a cached session to the secure client
+  this->_tlsResumed = false;
+  this->tlsOffered = this->tlsRestore != nullptr && this->tlsRestore(this, *this->netClient);
+
+  // connect and measure the time taken by the connection and security handshakes
+  uint32_t start = this->now();
+  int ret = host != nullptr ? this->netClient->connect(host, _port) : this->netClient->connect(_address, _port);
+  uint32_t end = this->now();
+  this->_tlsStats.lastTime = end - start;
+
+  return ret;
+#else
+  // connect
+  return host != nullptr ? this->netClient->connect(host, _port) : this->netClient->connect(_address, _port);
+#endif
+}
+
+void MQTTClient::storeTLSSession() {
+#if LWMQTT_ENABLE_TLS_SESSION
+  // return if no hook is set
+  if (this->tlsSave == nullptr) {
+    return;
+  }
+
+  // store session, the hook reports whether the offered session has been resumed
+  bool resumed = this->tlsSave(this, *this->netClient) && this->tlsOffered;
+  this->_tlsResumed = resumed;
+
+  // update counters and smoothed connect times
+  MQTTClientTLSStats *s = &this->_tlsStats;
+  uint32_t *avg = resumed ? &s->resumedTime : &s->fullTime;
+  *avg = *avg > 0 ? (*avg * 3 + s->lastTime) / 4 : s->lastTime;
+  s->handshakes++;
+  if (resumed) {
+    s->resumed++;
+  }
+#endif
+}
+
+#if LWMQTT_ENABLE_ENDPOINTS
+int MQTTClient::pickEndpoint(const bool tried[], uint32_t now) {
+  // pick the untried endpoint with the lowest score, failed endpoints are backed off exponentially (up to 64 seconds)
+  // and only picked if all other endpoints are backed off as well, ties are broken by the order of the list
+  int best = -1;
+  bool bestWaiting = false;
+  uint32_t bestScore = 0;
+  for (int i = 0; i < this->endpointCount; i++) {
+    if (tried[i]) {
+      continue;
+    }
+
+    // check back off
+    MQTTClientEndpoint *e = &this->endpointList[i];
+    uint32_t backOff = e->failures > 0 ? (uint32_t)1000 << (e->failures < 6 ? e->failures - 1 : 6) : 0;
+    bool waiting = e->failures > 0 && now - e->failedAt < backOff;
+
+    // endpoints without a measured latency are assumed to take the command timeout, each recent failure adds another
+    uint32_t timeout = this->commandTimeout();
+    uint32_t score = (e->latency > 0 ? e->latency : timeout) + (uint32_t)e->failures * timeout;
+
+    // keep better endpoint
+    if (best < 0 || (bestWaiting && !waiting) || (bestWaiting == waiting && score < bestScore)) {
+      best = i;
+      bestWaiting = waiting;
+      bestScore = score;
+    }
+  }
+
+  return best;
+}
+
+bool MQTTClient::connectEndpoints(lwmqtt_string_t clientID, lwmqtt_string_t username, lwmqtt_string_t password) {
+  // try every endpoint at most once, best first
+  bool tried[this->endpointCount];
+  memset(tried, 0, sizeof(tried));
+  for (int attempt = 0; attempt < this->endpointCount; attempt++) {
+    // pick endpoint
+    uint32_t start = this->now();
+    int index = this->pickEndpoint(tried, start);
+    tried[index] = true;
+    this->endpointIndex = index;
+    MQTTClientEndpoint *e = &this->endpointList[index];
+
+    // resolve hostname if a resolver is set and the cached address is missing or expired
+    if (e->hostname != nullptr && this->resolver != nullptr &&
+        (!e->resolved || start - e->resolvedAt >= this->resolverTTL)) {
+      e->resolved = this->resolver(e->hostname, e->address);
+      e->resolvedAt = start;
+    }
+
+    // connect to host, using the hostname if it cannot be resolved by the application
+    this->_returnCode = LWMQTT_UNKNOWN_RETURN_CODE;
+    int ret = 0;
+    if (e->hostname == nullptr || e->resolved) {
+      ret = this->connectNetwork(nullptr, e->address, e->port);
+    } else if (this->resolver == nullptr) {
+      ret = this->connectNetwork(e->hostname, e->address, e->port);
+    }
+
+    // perform handshake
+    bool ok = false;
+    if (ret > 0) {
+      ok = this->handshake(clientID, username, password);
+    } else {
+      this->_lastError = LWMQTT_NETWORK_FAILED_CONNECT;
+    }
+
+    // update health with the smoothed connect latency
+    uint32_t now = this->now();
+    if (ok) {
+      uint32_t latency = now - start > 0 ? now - start : 1;
+      e->latency = e->latency > 0 ? (e->latency * 3 + latency) / 4 : latency;
+      e->failures = 0;
+      this->storeTLSSession();
+      return true;
+    }
+
+    // do not fail over if the broker refused the client itself, as the other brokers would refuse it as well
+    if (this->_returnCode != LWMQTT_CONNECTION_ACCEPTED && this->_returnCode != LWMQTT_SERVER_UNAVAILABLE &&
+        this->_returnCode != LWMQTT_UNKNOWN_RETURN_CODE) {
+      return false;
+    }
+
+    // record failure and resolve the hostname again on the next attempt
+    if (e->failures < UINT16_MAX) {
+      e->failures++;
+    }
+    e->failedAt = now;
+    if (e->hostname != nullptr) {
+      e->resolved = false;
+    }
+  }
+
+  return false;
+}
+#endif
+
+bool MQTTClient::handshake(lwmqtt_string_t clientID, lwmqtt_string_t username, lwmqtt_string_t password) {
   // prepare options
   lwmqtt_connect_options_t options = lwmqtt_default_connect_options;
   options.keep_alive = this->keepAlive;
   options.clean_session = this->cleanSession;
-  options.client_id = lwmqtt_string(clientID);
+  options.client_id = clientID;
+  options.username = username;
+  options.password = password;
 
-  // set username and password if available
-  if (username != nullptr) {
-    options.username = lwmqtt_string(username);
-  }
-  if (password != nullptr) {
-    options.password = lwmqtt_string(password);
+  // get will
+#if LWMQTT_ENABLE_WILL
+  lwmqtt_will_t *will = this->will;
+#else
+  lwmqtt_will_t *will = nullptr;
+#endif
+
+  // borrow a buffer for the connect packet (and the staged packets)
+  if (!this->borrowWrite(this->writeLimit())) {
+    this->close();
+    return false;
   }
 
   // connect to broker
-  this->_lastError = lwmqtt_connect(&this->client, &options, this->will, this->timeout);
+#if LWMQTT_ENABLE_PIPELINE
+  if (this->stagedCount > 0) {
+    // split staged packets
+    int subCount = 0;
+    int pubCount = 0;
+    lwmqtt_string_t subTopics[this->stagedCount];
+    lwmqtt_qos_t subQos[this->stagedCount];
+    lwmqtt_string_t pubTopics[this->stagedCount];
+    lwmqtt_message_t pubMessages[this->stagedCount];
+    for (int i = 0; i < this->stagedCount; i++) {
+      if (this->staged[i].subscribe) {
+        subTopics[subCount] = this->staged[i].topic;
+        subQos[subCount] = this->staged[i].message.qos;
+        subCount++;
+      } else {
+        pubTopics[pubCount] = this->staged[i].topic;
+        pubMessages[pubCount] = this->staged[i].message;
+        pubCount++;
+      }
+    }
+
+    // send connect and staged packets in one flight
+    this->_lastError = lwmqtt_connect_pipelined(&this->client, &options, will, subCount, subTopics, subQos, pubCount,
+                                                pubTopics, pubMessages, this->commandTimeout());
+
+    // staged packets are consumed once the broker accepted the connection
+    if (options.return_code == LWMQTT_CONNECTION_ACCEPTED) {
+      this->clearStaged();
+    }
+  } else {
+    this->_lastError = lwmqtt_connect(&this->client, &options, will, this->commandTimeout());
+  }
+#else
+  this->_lastError = lwmqtt_connect(&this->client, &options, will, this->commandTimeout());
+#endif
+
+  // return borrowed buffer
+  this->giveBackWrite();
 
   // copy return code
   this->_returnCode = options.return_code;
@@ -379,30 +2115,69 @@ bool MQTTClient::connect(const char clientID[], const char username[], const cha
   return true;
 }
 
-bool MQTTClient::publish(const char topic[], const char payload[], int length, bool retained, int qos) {
+bool MQTTClient::publish(lwmqtt_string_t topic, const char payload[], int length, bool retained, int qos, bool flash) {
   // return immediately if not connected
   if (!this->connected()) {
     return false;
   }
 
+  // reject commands from the message callback that would overwrite the received packet in a shared buffer
+  if (this->bufferBusy()) {
+    return false;
+  }
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // apply rate limits and queue limited messages if configured (payloads in flash cannot be copied to the queue)
+  if (this->limiter != nullptr && !this->rateAdmit(topic, (size_t)length, !flash)) {
+    if (this->limiter->mode == MQTT_RATE_QUEUE && !flash) {
+      return this->rateQueue(topic, payload, length, retained, qos);
+    }
+    return false;
+  }
+#endif
+
+  // apply back-pressure if the packet (with the largest possible header) does not fit into the outbound queue
+  if (!this->outboundRoom(9 + topic.len + (size_t)length)) {
+    this->_lastError = LWMQTT_OUTBOUND_QUEUE_FULL;
+    return false;
+  }
+
   // prepare message
   lwmqtt_message_t message = lwmqtt_default_message;
   message.payload = (uint8_t *)payload;
   message.payload_len = (size_t)length;
   message.retained = retained;
   message.qos = lwmqtt_qos_t(qos);
+#if LWMQTT_ENABLE_PROGMEM
+  message.flash = flash;
+#else
+  (void)flash;
+#endif
 
   // prepare options
   lwmqtt_publish_options_t options = lwmqtt_default_publish_options;
 
-  // set duplicate packet id if available
-  if (this->nextDupPacketID > 0) {
-    options.dup_id = &this->nextDupPacketID;
-    this->nextDupPacketID = 0;
+  // set duplicate packet id if available (it is kept for another attempt until the packet has been written)
+  uint16_t dupPacketID = this->nextDupPacketID;
+  if (dupPacketID > 0) {
+    options.dup_id = &dupPacketID;
+  }
+
+  // borrow a buffer for the header if it exceeds the local buffer, the payload is written directly
+  if (!this->borrowWrite(9 + topic.len)) {
+    return false;
   }
 
   // publish message
-  this->_lastError = lwmqtt_publish(&this->client, &options, lwmqtt_string(topic), message, this->timeout);
+  uint32_t accepted = this->network.accepted;
+  this->_lastError = lwmqtt_publish(&this->client, &options, topic, message, this->commandTimeout());
+  this->giveBackWrite();
+
+  // forget duplicate packet id once the packet has been written
+  if (this->network.accepted != accepted) {
+    this->nextDupPacketID = 0;
+  }
+
   if (this->_lastError != LWMQTT_SUCCESS) {
     // close connection
     this->close();
@@ -410,6 +2185,98 @@ bool MQTTClient::publish(const char topic[], const char payload[], int length, b
     return false;
   }
 
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // take rate limit tokens
+  if (this->limiter != nullptr) {
+    this->rateTake(topic, (size_t)length);
+  }
+#endif
+
+  return true;
+}
+
+bool MQTTClient::publish(lwmqtt_string_t topic, const __FlashStringHelper *payload, bool retained, int qos) {
+  // stream payload from flash to the network after the header
+#if LWMQTT_ENABLE_PROGMEM
+  return this->publish(topic, (const char *)payload, (int)strlen_P((const char *)payload), retained, qos, true);
+#else
+  return this->publish(topic, (const char *)payload, (int)strlen((const char *)payload), retained, qos, false);
+#endif
+}
+
+bool MQTTClient::publish(lwmqtt_string_t topic, MQTTClientPayloadWriter writer, void *ref, bool retained, int qos) {
+  // return immediately if not connected
+  if (!this->connected()) {
+    return false;
+  }
+
+  // reject commands from the message callback that would overwrite the received packet in a shared buffer
+  if (this->bufferBusy()) {
+    return false;
+  }
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // apply rate limits (the payload size is unknown beforehand and the message cannot be queued)
+  if (this->limiter != nullptr && !this->rateAdmit(topic, 0, false)) {
+    return false;
+  }
+#endif
+
+  // apply back-pressure if the packet (limited by the write buffer) does not fit into the outbound queue
+  if (!this->outboundRoom(this->writeLimit())) {
+    this->_lastError = LWMQTT_OUTBOUND_QUEUE_FULL;
+    return false;
+  }
+
+  // prepare message
+  lwmqtt_message_t message = lwmqtt_default_message;
+  message.retained = retained;
+  message.qos = lwmqtt_qos_t(qos);
+
+  // prepare options
+  lwmqtt_publish_options_t options = lwmqtt_default_publish_options;
+
+  // set duplicate packet id if available (it is kept for another attempt until the packet has been written)
+  uint16_t dupPacketID = this->nextDupPacketID;
+  if (dupPacketID > 0) {
+    options.dup_id = &dupPacketID;
+  }
+
+  // prepare payload writer
+  lwmqtt_arduino_payload_t payload = {writer, ref, 0};
+
+  // borrow a buffer for the whole packet
+  if (!this->borrowWrite(this->writeLimit())) {
+    return false;
+  }
+
+  // publish message
+  uint32_t accepted = this->network.accepted;
+  this->_lastError = lwmqtt_publish_in_place(&this->client, &options, topic, message, lwmqtt_arduino_payload_write,
+                                             &payload, this->commandTimeout());
+  this->giveBackWrite();
+
+  // forget duplicate packet id once the packet has been written
+  if (this->network.accepted != accepted) {
+    this->nextDupPacketID = 0;
+  }
+
+  if (this->_lastError != LWMQTT_SUCCESS) {
+    // close connection unless the packet failed locally (e.g. the writer overflowed) before anything was written
+    if (this->network.accepted != accepted) {
+      this->close();
+    }
+
+    return false;
+  }
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // take rate limit tokens
+  if (this->limiter != nullptr) {
+    this->rateTake(topic, payload.written);
+  }
+#endif
+
   return true;
 }
 
@@ -423,14 +2290,94 @@ void MQTTClient::prepareDuplicate(uint16_t packetID) {
   this->nextDupPacketID = packetID;
 }
 
-bool MQTTClient::subscribe(const char topic[], int qos) {
+size_t MQTTClient::saveSession(uint8_t buf[], size_t size) {
+  // check size
+  if (size < MQTT_SESSION_SIZE) {
+    return 0;
+  }
+
+  // write magic and version
+  buf[0] = 'M';
+  buf[1] = 4;
+
+  // write last packet id
+  buf[2] = (uint8_t)(this->client.last_packet_id >> 8);
+  buf[3] = (uint8_t)(this->client.last_packet_id & 0xFF);
+
+  // write prepared duplicate packet id
+  buf[4] = (uint8_t)(this->nextDupPacketID >> 8);
+  buf[5] = (uint8_t)(this->nextDupPacketID & 0xFF);
+
+  // write round-trip time estimation (zero if not measured)
+  for (int i = 0; i < 4; i++) {
+#if LWMQTT_ENABLE_RTT
+    buf[6 + i] = (uint8_t)(this->client.rtt_smoothed >> (24 - i * 8));
+    buf[10 + i] = (uint8_t)(this->client.rtt_variance >> (24 - i * 8));
+#else
+    buf[6 + i] = 0;
+    buf[10 + i] = 0;
+#endif
+  }
+
+  // write checksum
+  uint16_t checksum = MQTTClientChecksum(buf, MQTT_SESSION_SIZE - 2);
+  buf[MQTT_SESSION_SIZE - 2] = (uint8_t)(checksum >> 8);
+  buf[MQTT_SESSION_SIZE - 1] = (uint8_t)(checksum & 0xFF);
+
+  return MQTT_SESSION_SIZE;
+}
+
+bool MQTTClient::restoreSession(const uint8_t buf[], size_t size) {
+  // check size, magic and version
+  if (size < MQTT_SESSION_SIZE || buf[0] != 'M' || buf[1] != 4) {
+    return false;
+  }
+
+  // verify checksum (e.g. uninitialized RTC memory after a power loss)
+  uint16_t checksum = MQTTClientChecksum(buf, MQTT_SESSION_SIZE - 2);
+  if (buf[MQTT_SESSION_SIZE - 2] != (uint8_t)(checksum >> 8) ||
+      buf[MQTT_SESSION_SIZE - 1] != (uint8_t)(checksum & 0xFF)) {
+    return false;
+  }
+
+  // restore last packet id
+  this->client.last_packet_id = (uint16_t)((buf[2] << 8) | buf[3]);
+
+  // restore prepared duplicate packet id
+  this->nextDupPacketID = (uint16_t)((buf[4] << 8) | buf[5]);
+
+#if LWMQTT_ENABLE_RTT
+  // restore round-trip time estimation
+  this->client.rtt_smoothed = 0;
+  this->client.rtt_variance = 0;
+  for (int i = 0; i < 4; i++) {
+    this->client.rtt_smoothed = (this->client.rtt_smoothed << 8) | buf[6 + i];
+    this->client.rtt_variance = (this->client.rtt_variance << 8) | buf[10 + i];
+  }
+#endif
+
+  return true;
+}
+
+bool MQTTClient::subscribe(lwmqtt_string_t topic, int qos) {
   // return immediately if not connected
   if (!this->connected()) {
     return false;
   }
 
+  // reject commands from the message callback that would overwrite the received packet in a shared buffer
+  if (this->bufferBusy()) {
+    return false;
+  }
+
+  // borrow a buffer if the packet exceeds the local buffer
+  if (!this->borrowWrite(10 + topic.len)) {
+    return false;
+  }
+
   // subscribe to topic
-  this->_lastError = lwmqtt_subscribe_one(&this->client, lwmqtt_string(topic), (lwmqtt_qos_t)qos, this->timeout);
+  this->_lastError = lwmqtt_subscribe_one(&this->client, topic, (lwmqtt_qos_t)qos, this->commandTimeout());
+  this->giveBackWrite();
   if (this->_lastError != LWMQTT_SUCCESS) {
     // close connection
     this->close();
@@ -441,14 +2388,25 @@ bool MQTTClient::subscribe(const char topic[], int qos) {
   return true;
 }
 
-bool MQTTClient::unsubscribe(const char topic[]) {
+bool MQTTClient::unsubscribe(lwmqtt_string_t topic) {
   // return immediately if not connected
   if (!this->connected()) {
     return false;
   }
 
+  // reject commands from the message callback that would overwrite the received packet in a shared buffer
+  if (this->bufferBusy()) {
+    return false;
+  }
+
+  // borrow a buffer if the packet exceeds the local buffer
+  if (!this->borrowWrite(9 + topic.len)) {
+    return false;
+  }
+
   // unsubscribe from topic
-  this->_lastError = lwmqtt_unsubscribe_one(&this->client, lwmqtt_string(topic), this->timeout);
+  this->_lastError = lwmqtt_unsubscribe_one(&this->client, topic, this->commandTimeout());
+  this->giveBackWrite();
   if (this->_lastError != LWMQTT_SUCCESS) {
     // close connection
     this->close();
@@ -465,12 +2423,37 @@ bool MQTTClient::loop() {
     return false;
   }
 
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // continue sending queued bytes
+  if (this->outboundQueued() > 0) {
+    lwmqtt_arduino_network_drain(&this->network);
+  }
+#endif
+
   // get available bytes on the network
   int available = this->netClient->available();
 
   // yield if data is available
   if (available > 0) {
-    this->_lastError = lwmqtt_yield(&this->client, available, this->timeout);
+    // hold conflated messages while processing the available data
+    MQTTClientConflation *c = this->callback.conflation;
+    if (c != nullptr) {
+      c->active = true;
+    }
+
+    // process available data
+    this->_lastError = lwmqtt_yield(&this->client, available, this->commandTimeout());
+
+    // dispatch the newest message of every conflated topic
+    if (c != nullptr) {
+      c->active = false;
+      MQTTClientRelease(&this->callback);
+    }
+
+    // return a borrowed read buffer once the messages have been dispatched
+    this->giveBackRead();
+
+    // handle error
     if (this->_lastError != LWMQTT_SUCCESS) {
       // close connection
       this->close();
@@ -479,8 +2462,28 @@ bool MQTTClient::loop() {
     }
   }
 
+#if LWMQTT_ENABLE_READ_LIMIT
+  // shrink a grown read buffer after a quiet period
+  if (this->readBufBase > 0 && this->readBufSize > this->readBufBase) {
+    uint32_t now = this->now();
+    if (now - this->lastLarge >= this->shrinkAfter) {
+      this->resizeReadBuffer(this->readBufBase);
+    }
+  }
+#endif
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // send queued rate limited messages whose budget is available
+  if (this->limiter != nullptr && this->limiter->pendingCount > 0) {
+    this->rateRelease();
+    if (!this->connected()) {
+      return false;
+    }
+  }
+#endif
+
   // keep the connection alive
-  this->_lastError = lwmqtt_keep_alive(&this->client, this->timeout);
+  this->_lastError = lwmqtt_keep_alive(&this->client, this->commandTimeout());
   if (this->_lastError != LWMQTT_SUCCESS) {
     // close connection
     this->close();
@@ -491,6 +2494,80 @@ bool MQTTClient::loop() {
   return true;
 }
 
+bool MQTTClient::loop(uint32_t maxWait) {
+  // return immediately if not connected
+  if (!this->connected()) {
+    return false;
+  }
+
+  // limit wait to the next protocol deadline
+  uint32_t deadline = this->nextDeadline();
+  if (maxWait > deadline) {
+    maxWait = deadline;
+  }
+
+  // wait until data is available or the wait time has elapsed
+  uint32_t start = millis();
+  while (this->netClient->available() <= 0) {
+    // check elapsed time
+    uint32_t elapsed = millis() - start;
+    if (elapsed >= maxWait) {
+      break;
+    }
+
+    // sleep until the next poll (allows RTOS based boards to enter light sleep)
+    uint32_t step = maxWait - elapsed;
+    if (step > MQTT_WAIT_POLL_INTERVAL) {
+      step = MQTT_WAIT_POLL_INTERVAL;
+    }
+    delay(step);
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+    // continue sending queued bytes
+    if (this->outboundQueued() > 0) {
+      lwmqtt_arduino_network_drain(&this->network);
+    }
+#endif
+
+    // stop waiting if the connection has been lost
+    if (!this->netClient->connected()) {
+      break;
+    }
+  }
+
+  return this->loop();
+}
+
+uint32_t MQTTClient::nextDeadline() {
+  // return immediately if not connected
+  if (!this->connected()) {
+    return 0;
+  }
+
+  // get next deadline from client
+  uint32_t deadline = lwmqtt_next_deadline(&this->client);
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  // wake up once the budget of the first queued rate limited message is available
+  if (this->limiter != nullptr && this->limiter->pendingCount > 0) {
+    MQTTClientRatePending *p = &this->limiter->pending[0];
+    uint32_t wait = this->rateWait(lwmqtt_string(p->topic), (size_t)p->length);
+    if (deadline > wait) {
+      deadline = wait;
+    }
+  }
+#endif
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // poll again soon if queued bytes are waiting for room in the send buffer
+  if (this->outboundQueued() > 0 && deadline > MQTT_WAIT_POLL_INTERVAL) {
+    deadline = MQTT_WAIT_POLL_INTERVAL;
+  }
+#endif
+
+  return deadline;
+}
+
 bool MQTTClient::connected() {
   // a client is connected if the network is connected, a client is available and
   // the connection has been properly initiated
@@ -503,8 +2580,18 @@ bool MQTTClient::disconnect() {
     return false;
   }
 
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // send queued bytes first as the disconnect packet would otherwise overtake queued bulk packets
+  lwmqtt_arduino_network_flush(&this->network, this->commandTimeout());
+#endif
+
   // cleanly disconnect
-  this->_lastError = lwmqtt_disconnect(&this->client, this->timeout);
+  this->_lastError = lwmqtt_disconnect(&this->client, this->commandTimeout());
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // send queued bytes before closing
+  lwmqtt_arduino_network_flush(&this->network, this->commandTimeout());
+#endif
 
   // close
   this->close();
@@ -518,4 +2605,15 @@ void MQTTClient::close() {
 
   // close network
   this->netClient->stop();
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  // discard queued bytes
+  lwmqtt_arduino_network_reset(&this->network);
+#endif
+
+  // return borrowed buffers, a read buffer holding a message that is being dispatched is returned by loop()
+  if (!this->client.dispatching) {
+    this->giveBackRead();
+  }
+  this->giveBackWrite();
 }
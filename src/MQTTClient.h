@@ -27,6 +27,26 @@
 #include <Client.h>
 #include <Stream.h>
 
+#include "MQTTBufferPool.h"
+
+// the interval in milliseconds in which a waiting loop checks for available data
+#ifndef MQTT_WAIT_POLL_INTERVAL
+#define MQTT_WAIT_POLL_INTERVAL 10
+#endif
+
+// the maximum number of rate limited messages that are queued for later
+#ifndef MQTT_RATE_QUEUE_SIZE
+#define MQTT_RATE_QUEUE_SIZE 8
+#endif
+
+// the size of the local buffers of a client that borrows larger buffers from a pool
+#ifndef MQTT_POOL_LOCAL_SIZE
+#define MQTT_POOL_LOCAL_SIZE 32
+#endif
+
+// the size of a session snapshot created by saveSession()
+#define MQTT_SESSION_SIZE 16
+
 extern "C" {
 #include "lwmqtt/lwmqtt.h"
 }
@@ -39,8 +59,35 @@ typedef struct {
   MQTTClientClockSource millis;
 } lwmqtt_arduino_timer_t;
 
+typedef enum { MQTT_BUFFER_SEPARATE = 0, MQTT_BUFFER_SHARED = 1 } MQTTClientBufferMode;
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+typedef enum { MQTT_PRIORITY_HIGH = 0, MQTT_PRIORITY_BULK = 1 } MQTTClientPriority;
+
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t head;
+  size_t length;
+} lwmqtt_arduino_queue_t;
+
+typedef struct {
+  lwmqtt_arduino_queue_t queues[2];
+  uint8_t writeClass;
+  size_t writeLeft;
+  int8_t sendClass;
+  size_t sendLeft;
+  bool reportsRoom;
+} lwmqtt_arduino_outbound_t;
+#endif
+
 typedef struct {
   Client *client;
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  lwmqtt_arduino_outbound_t *outbound;
+  MQTTClientPriority priority;
+#endif
+  uint32_t accepted;
 } lwmqtt_arduino_network_t;
 
 class MQTTClient;
@@ -53,8 +100,133 @@ typedef std::function<void(MQTTClient *client, char topic[], char bytes[], int l
     MQTTClientCallbackAdvancedFunction;
 #endif
 
+class MQTTClientPayload : public Print {
+ private:
+  uint8_t *buf;
+  size_t cap;
+  size_t len = 0;
+  bool overflow = false;
+
+ public:
+  MQTTClientPayload(uint8_t *buf, size_t cap) : buf(buf), cap(cap) {}
+
+  size_t write(uint8_t byte);
+  size_t write(const uint8_t *data, size_t size);
+  using Print::write;
+
+  uint8_t *buffer() { return this->buf; }
+  size_t capacity() { return this->cap; }
+  size_t length() { return this->len; }
+  void setLength(size_t length);
+  bool overflowed() { return this->overflow; }
+};
+
+typedef void (*MQTTClientPayloadWriter)(MQTTClientPayload &payload, void *ref);
+
+typedef struct {
+  char *topic;
+  size_t topicSize;
+  char *payload;
+  size_t payloadSize;
+  int length;
+} MQTTClientConflated;
+
+typedef struct {
+  char **filters = nullptr;
+  int filterCount = 0;
+  MQTTClientConflated *held = nullptr;
+  int heldCount = 0;
+  int slotCount = 0;
+  bool active = false;
+  uint32_t collapsed = 0;
+} MQTTClientConflation;
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+typedef enum { MQTT_RATE_REJECT = 0, MQTT_RATE_DELAY = 1, MQTT_RATE_QUEUE = 2 } MQTTClientRateMode;
+
+typedef struct {
+  uint32_t rate;
+  int32_t tokens;
+  uint32_t last;
+} MQTTClientBucket;
+
+typedef struct {
+  char *filter;
+  MQTTClientBucket messages;
+  MQTTClientBucket bytes;
+} MQTTClientRateLimit;
+
+typedef struct {
+  char *topic;
+  char *payload;
+  int length;
+  bool retained;
+  int qos;
+} MQTTClientRatePending;
+
+typedef struct {
+  MQTTClientRateMode mode = MQTT_RATE_REJECT;
+  MQTTClientRateLimit *limits = nullptr;
+  int limitCount = 0;
+  MQTTClientRatePending *pending = nullptr;
+  int pendingCount = 0;
+  bool releasing = false;
+  uint32_t limited = 0;
+} MQTTClientRateLimiter;
+#endif
+
+#if LWMQTT_ENABLE_ENDPOINTS
+typedef bool (*MQTTClientResolver)(const char hostname[], IPAddress &address);
+
+typedef struct {
+  char *hostname;
+  IPAddress address;
+  uint16_t port;
+  bool resolved;
+  uint32_t resolvedAt;
+  uint32_t latency;
+  uint16_t failures;
+  uint32_t failedAt;
+} MQTTClientEndpoint;
+#endif
+
+#if LWMQTT_ENABLE_TLS_SESSION
+typedef bool (*MQTTClientTLSHook)(MQTTClient *client, Client &net);
+
+typedef struct {
+  uint32_t handshakes;
+  uint32_t resumed;
+  uint32_t lastTime;
+  uint32_t fullTime;
+  uint32_t resumedTime;
+} MQTTClientTLSStats;
+#endif
+
+typedef bool (*MQTTClientInterceptor)(MQTTClient *client, void *ref, char topic[], char bytes[], int length);
+
+#if LWMQTT_ENABLE_HANDLER_STATS
+typedef void (*MQTTClientSlowHandler)(MQTTClient *client, const char topic[], uint32_t duration);
+
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t avg;
+  uint32_t max;
+  uint32_t slow;
+} MQTTClientHandlerStats;
+#endif
+
 typedef struct {
   MQTTClient *client = nullptr;
+  MQTTClientConflation *conflation = nullptr;
+  MQTTClientInterceptor interceptor = nullptr;
+  void *interceptorRef = nullptr;
+#if LWMQTT_ENABLE_HANDLER_STATS
+  MQTTClientSlowHandler slowHandler = nullptr;
+  uint32_t handlerBudget = 0;
+  MQTTClientHandlerStats stats = {0, 0, 0, 0, 0};
+  uint64_t handlerTotal = 0;
+#endif
   MQTTClientCallbackSimple simple = nullptr;
   MQTTClientCallbackAdvanced advanced = nullptr;
 #if MQTT_HAS_FUNCTIONAL
@@ -63,26 +235,74 @@ typedef struct {
 #endif
 } MQTTClientCallback;
 
+#if LWMQTT_ENABLE_PIPELINE
+typedef struct {
+  lwmqtt_string_t topic;
+  lwmqtt_message_t message;
+  bool subscribe;
+} MQTTClientStaged;
+#endif
+
 class MQTTClient {
  private:
   size_t readBufSize = 0;
   size_t writeBufSize = 0;
   uint8_t *readBuf = nullptr;
   uint8_t *writeBuf = nullptr;
+#if LWMQTT_ENABLE_READ_LIMIT
+  size_t readBufBase = 0;
+  size_t readBufLimit = 0;
+  uint32_t shrinkAfter = 0;
+  uint32_t lastLarge = 0;
+#endif
+#if LWMQTT_ENABLE_BUFFER_POOL
+  MQTTBufferPool *pool = nullptr;
+  size_t poolLimit = 0;
+  uint8_t *borrowedRead = nullptr;
+  uint8_t *borrowedWrite = nullptr;
+#endif
 
   uint16_t keepAlive = 10;
   bool cleanSession = true;
   uint32_t timeout = 1000;
+#if LWMQTT_ENABLE_RTT
+  uint32_t minTimeout = 0;
+  uint32_t maxTimeout = 0;
+#endif
   bool _sessionPresent = false;
 
   Client *netClient = nullptr;
   const char *hostname = nullptr;
   IPAddress address;
   int port = 0;
+#if LWMQTT_ENABLE_ENDPOINTS
+  MQTTClientEndpoint *endpointList = nullptr;
+  int endpointCount = 0;
+  int endpointIndex = -1;
+  MQTTClientResolver resolver = nullptr;
+  uint32_t resolverTTL = 0;
+#endif
+#if LWMQTT_ENABLE_TLS_SESSION
+  MQTTClientTLSHook tlsRestore = nullptr;
+  MQTTClientTLSHook tlsSave = nullptr;
+  bool tlsOffered = false;
+  bool _tlsResumed = false;
+  MQTTClientTLSStats _tlsStats = {0, 0, 0, 0, 0};
+#endif
+#if LWMQTT_ENABLE_WILL
   lwmqtt_will_t *will = nullptr;
+  bool willCopied = false;
+#endif
+#if LWMQTT_ENABLE_PIPELINE
+  MQTTClientStaged *staged = nullptr;
+  int stagedCount = 0;
+#endif
   MQTTClientCallback callback;
+#if LWMQTT_ENABLE_RATE_LIMIT
+  MQTTClientRateLimiter *limiter = nullptr;
+#endif
 
-  lwmqtt_arduino_network_t network = {nullptr};
+  lwmqtt_arduino_network_t network = lwmqtt_arduino_network_t();
   lwmqtt_arduino_timer_t timer1 = {0, 0, nullptr};
   lwmqtt_arduino_timer_t timer2 = {0, 0, nullptr};
   lwmqtt_client_t client = lwmqtt_client_t();
@@ -98,6 +318,10 @@ class MQTTClient {
 
   explicit MQTTClient(int bufSize = 128) : MQTTClient(bufSize, bufSize) {}
   MQTTClient(int readBufSize, int writeBufSize);
+  MQTTClient(int bufSize, MQTTClientBufferMode mode);
+#if LWMQTT_ENABLE_BUFFER_POOL
+  MQTTClient(int bufSize, MQTTBufferPool &pool);
+#endif
 
   ~MQTTClient();
 
@@ -121,34 +345,153 @@ class MQTTClient {
 #endif
 
   void setClockSource(MQTTClientClockSource cb);
+  uint32_t now() { return this->timer1.millis != nullptr ? this->timer1.millis() : millis(); }
 
   void setHost(const char _hostname[]) { this->setHost(_hostname, 1883); }
   void setHost(const char hostname[], int port);
   void setHost(IPAddress _address) { this->setHost(_address, 1883); }
   void setHost(IPAddress _address, int port);
 
+#if LWMQTT_ENABLE_ENDPOINTS
+  bool addEndpoint(const char hostname[], int port = 1883);
+  bool addEndpoint(IPAddress address, int port = 1883);
+  void clearEndpoints();
+  void setResolver(MQTTClientResolver cb, uint32_t ttl = 300000);
+  int endpoints() { return this->endpointCount; }
+  int currentEndpoint() { return this->endpointIndex; }
+  const MQTTClientEndpoint *endpoint(int index) {
+    return index >= 0 && index < this->endpointCount ? &this->endpointList[index] : nullptr;
+  }
+#endif
+
+#if LWMQTT_ENABLE_TLS_SESSION
+  void setTLSSessionHooks(MQTTClientTLSHook restore, MQTTClientTLSHook save);
+  bool tlsResumed() { return this->_tlsResumed; }
+  MQTTClientTLSStats tlsStats() { return this->_tlsStats; }
+  void resetTLSStats();
+#endif
+
+#if LWMQTT_ENABLE_WILL
   void setWill(const char topic[]) { this->setWill(topic, ""); }
   void setWill(const char topic[], const char payload[]) { this->setWill(topic, payload, false, 0); }
   void setWill(const char topic[], const char payload[], bool retained, int qos);
+  void setWill(const __FlashStringHelper *topic) { this->setWill(topic, nullptr, false, 0); }
+  void setWill(const __FlashStringHelper *topic, const __FlashStringHelper *payload) {
+    this->setWill(topic, payload, false, 0);
+  }
+  void setWill(const __FlashStringHelper *topic, const __FlashStringHelper *payload, bool retained, int qos);
   void clearWill();
+#endif
 
   void setKeepAlive(int keepAlive);
   void setCleanSession(bool cleanSession);
   void setTimeout(int timeout);
+#if LWMQTT_ENABLE_RTT
+  void setAdaptiveTimeout(uint32_t minTimeout, uint32_t maxTimeout);
+  uint32_t roundTripTime() { return this->client.rtt_smoothed >> 3; }
+#endif
   void setOptions(int _keepAlive, bool _cleanSession, int _timeout) {
     this->setKeepAlive(_keepAlive);
     this->setCleanSession(_cleanSession);
     this->setTimeout(_timeout);
   }
 
+#if LWMQTT_ENABLE_PIPELINE
+  bool stageSubscribe(const char topic[]) { return this->stageSubscribe(topic, 0); }
+  bool stageSubscribe(const char topic[], int qos);
+  bool stagePublish(const char topic[], const char payload[]) {
+    return this->stagePublish(topic, payload, (int)strlen(payload), false, 0);
+  }
+  bool stagePublish(const char topic[], const char payload[], bool retained, int qos) {
+    return this->stagePublish(topic, payload, (int)strlen(payload), retained, qos);
+  }
+  bool stagePublish(const char topic[], const char payload[], int length, bool retained, int qos);
+  void clearStaged();
+#endif
+
+#if LWMQTT_ENABLE_READ_LIMIT
+  bool setReadBufferLimit(size_t limit, uint32_t shrinkAfter = 60000);
+#endif
+  size_t readBufferSize() { return this->readBufSize; }
+#if LWMQTT_ENABLE_PEAKS
+  size_t readPeak() { return this->client.read_peak; }
+  size_t writePeak() { return this->client.write_peak; }
+  void resetPeaks() {
+    this->client.read_peak = 0;
+    this->client.write_peak = 0;
+  }
+#endif
+
   void dropOverflow(bool enabled);
   uint32_t droppedMessages() { return this->_droppedMessages; }
 
+  void ackBeforeDispatch(bool enabled);
+  void intercept(MQTTClientInterceptor cb, void *ref = nullptr);
+#if LWMQTT_ENABLE_HANDLER_STATS
+  void onSlowHandler(MQTTClientSlowHandler cb, uint32_t budget);
+  MQTTClientHandlerStats handlerStats();
+  void resetHandlerStats();
+#endif
+
+#if LWMQTT_ENABLE_TRACE
+  void setTrace(lwmqtt_trace_event_t events[], size_t size);
+  void printTrace(Print &out);
+  bool publishTrace(const char topic[], bool retained = false, int qos = 0);
+#endif
+
+  bool conflate(const char filter[]);
+  void clearConflation();
+  uint32_t conflatedMessages() {
+    return this->callback.conflation != nullptr ? this->callback.conflation->collapsed : 0;
+  }
+
+#if LWMQTT_ENABLE_OUTBOUND_QUEUE
+  bool setOutboundQueue(size_t size, size_t bulkSize = 0);
+  size_t outboundQueued() {
+    lwmqtt_arduino_outbound_t *o = this->network.outbound;
+    return o != nullptr ? o->queues[0].length + o->queues[1].length : 0;
+  }
+  void setPriority(MQTTClientPriority priority) { this->network.priority = priority; }
+#endif
+
+#if LWMQTT_ENABLE_RATE_LIMIT
+  bool setRateLimit(uint32_t messages, uint32_t bytes, MQTTClientRateMode mode = MQTT_RATE_REJECT);
+  bool setRateLimit(const char filter[], uint32_t messages, uint32_t bytes);
+  void clearRateLimits();
+  uint32_t messageBudget(const char topic[] = nullptr) { return this->rateBudget(topic, false); }
+  uint32_t byteBudget(const char topic[] = nullptr) { return this->rateBudget(topic, true); }
+  uint32_t rateLimitedMessages() { return this->limiter != nullptr ? this->limiter->limited : 0; }
+  int rateQueued() { return this->limiter != nullptr ? this->limiter->pendingCount : 0; }
+#endif
+
+#if LWMQTT_ENABLE_AUTH
   bool connect(const char clientId[], bool skip = false) { return this->connect(clientId, nullptr, nullptr, skip); }
   bool connect(const char clientId[], const char username[], bool skip = false) {
     return this->connect(clientId, username, nullptr, skip);
   }
-  bool connect(const char clientID[], const char username[], const char password[], bool skip = false);
+  bool connect(const char clientID[], const char username[], const char password[], bool skip = false) {
+    return this->connect(lwmqtt_string(clientID), lwmqtt_string(username), lwmqtt_string(password), skip);
+  }
+  bool connect(const __FlashStringHelper *clientId, bool skip = false) {
+    return this->connect(clientId, nullptr, nullptr, skip);
+  }
+  bool connect(const __FlashStringHelper *clientId, const __FlashStringHelper *username, bool skip = false) {
+    return this->connect(clientId, username, nullptr, skip);
+  }
+  bool connect(const __FlashStringHelper *clientID, const __FlashStringHelper *username,
+               const __FlashStringHelper *password, bool skip = false) {
+    return this->connect(lwmqtt_flash_string((const char *)clientID), lwmqtt_flash_string((const char *)username),
+                         lwmqtt_flash_string((const char *)password), skip);
+  }
+#else
+  bool connect(const char clientID[], bool skip = false) {
+    return this->connect(lwmqtt_string(clientID), lwmqtt_string(nullptr), lwmqtt_string(nullptr), skip);
+  }
+  bool connect(const __FlashStringHelper *clientID, bool skip = false) {
+    return this->connect(lwmqtt_flash_string((const char *)clientID), lwmqtt_string(nullptr), lwmqtt_string(nullptr),
+                         skip);
+  }
+#endif
 
   bool publish(const String &topic) { return this->publish(topic.c_str(), ""); }
   bool publish(const char topic[]) { return this->publish(topic, ""); }
@@ -169,20 +512,65 @@ class MQTTClient {
   bool publish(const char topic[], const char payload[], int length) {
     return this->publish(topic, payload, length, false, 0);
   }
-  bool publish(const char topic[], const char payload[], int length, bool retained, int qos);
+  bool publish(const char topic[], const char payload[], int length, bool retained, int qos) {
+    return this->publish(lwmqtt_string(topic), payload, length, retained, qos);
+  }
+  bool publish(const char topic[], MQTTClientPayloadWriter writer, void *ref) {
+    return this->publish(topic, writer, ref, false, 0);
+  }
+  bool publish(const char topic[], MQTTClientPayloadWriter writer, void *ref, bool retained, int qos) {
+    return this->publish(lwmqtt_string(topic), writer, ref, retained, qos);
+  }
+  bool publish(const char topic[], const __FlashStringHelper *payload) {
+    return this->publish(topic, payload, false, 0);
+  }
+  bool publish(const char topic[], const __FlashStringHelper *payload, bool retained, int qos) {
+    return this->publish(lwmqtt_string(topic), payload, retained, qos);
+  }
+  bool publish(const __FlashStringHelper *topic) { return this->publish(topic, "", 0, false, 0); }
+  bool publish(const __FlashStringHelper *topic, const char payload[]) {
+    return this->publish(topic, payload, (int)strlen(payload), false, 0);
+  }
+  bool publish(const __FlashStringHelper *topic, const char payload[], bool retained, int qos) {
+    return this->publish(topic, payload, (int)strlen(payload), retained, qos);
+  }
+  bool publish(const __FlashStringHelper *topic, const char payload[], int length, bool retained, int qos) {
+    return this->publish(lwmqtt_flash_string((const char *)topic), payload, length, retained, qos);
+  }
+  bool publish(const __FlashStringHelper *topic, const __FlashStringHelper *payload) {
+    return this->publish(topic, payload, false, 0);
+  }
+  bool publish(const __FlashStringHelper *topic, const __FlashStringHelper *payload, bool retained, int qos) {
+    return this->publish(lwmqtt_flash_string((const char *)topic), payload, retained, qos);
+  }
+  bool publish(const __FlashStringHelper *topic, MQTTClientPayloadWriter writer, void *ref, bool retained, int qos) {
+    return this->publish(lwmqtt_flash_string((const char *)topic), writer, ref, retained, qos);
+  }
 
   uint16_t lastPacketID();
   void prepareDuplicate(uint16_t packetID);
 
+  size_t saveSession(uint8_t buf[], size_t size);
+  bool restoreSession(const uint8_t buf[], size_t size);
+
   bool subscribe(const String &topic) { return this->subscribe(topic.c_str()); }
   bool subscribe(const String &topic, int qos) { return this->subscribe(topic.c_str(), qos); }
   bool subscribe(const char topic[]) { return this->subscribe(topic, 0); }
-  bool subscribe(const char topic[], int qos);
+  bool subscribe(const char topic[], int qos) { return this->subscribe(lwmqtt_string(topic), qos); }
+  bool subscribe(const __FlashStringHelper *topic) { return this->subscribe(topic, 0); }
+  bool subscribe(const __FlashStringHelper *topic, int qos) {
+    return this->subscribe(lwmqtt_flash_string((const char *)topic), qos);
+  }
 
   bool unsubscribe(const String &topic) { return this->unsubscribe(topic.c_str()); }
-  bool unsubscribe(const char topic[]);
+  bool unsubscribe(const char topic[]) { return this->unsubscribe(lwmqtt_string(topic)); }
+  bool unsubscribe(const __FlashStringHelper *topic) {
+    return this->unsubscribe(lwmqtt_flash_string((const char *)topic));
+  }
 
   bool loop();
+  bool loop(uint32_t maxWait);
+  uint32_t nextDeadline();
   bool connected();
   bool sessionPresent() { return this->_sessionPresent; }
 
@@ -192,6 +580,47 @@ class MQTTClient {
   bool disconnect();
 
  private:
+  uint32_t commandTimeout();
+#if LWMQTT_ENABLE_READ_LIMIT
+  static bool readHook(lwmqtt_client_t *client, void *ref, size_t size);
+  bool resizeReadBuffer(size_t size);
+#endif
+#if LWMQTT_ENABLE_BUFFER_POOL
+  static bool poolHook(lwmqtt_client_t *client, void *ref, size_t size);
+#endif
+  bool borrowWrite(size_t size);
+  size_t writeLimit();
+  void giveBackRead();
+  void giveBackWrite();
+  bool bufferBusy();
+  bool outboundRoom(size_t length);
+#if LWMQTT_ENABLE_RATE_LIMIT
+  uint32_t rateWait(lwmqtt_string_t topic, size_t bytes);
+  void rateTake(lwmqtt_string_t topic, size_t bytes);
+  bool rateAdmit(lwmqtt_string_t topic, size_t bytes, bool queueable);
+  bool rateQueue(lwmqtt_string_t topic, const char payload[], int length, bool retained, int qos);
+  void rateRelease();
+  uint32_t rateBudget(const char topic[], bool bytes);
+#endif
+#if LWMQTT_ENABLE_WILL
+  void setWill(lwmqtt_string_t topic, lwmqtt_string_t payload, bool retained, int qos, bool copied);
+#endif
+  bool connect(lwmqtt_string_t clientID, lwmqtt_string_t username, lwmqtt_string_t password, bool skip);
+#if LWMQTT_ENABLE_ENDPOINTS
+  bool connectEndpoints(lwmqtt_string_t clientID, lwmqtt_string_t username, lwmqtt_string_t password);
+  int pickEndpoint(const bool tried[], uint32_t now);
+#endif
+  int connectNetwork(const char host[], IPAddress address, uint16_t port);
+  bool handshake(lwmqtt_string_t clientID, lwmqtt_string_t username, lwmqtt_string_t password);
+  void storeTLSSession();
+  bool publish(lwmqtt_string_t topic, const char payload[], int length, bool retained, int qos, bool flash = false);
+  bool publish(lwmqtt_string_t topic, const __FlashStringHelper *payload, bool retained, int qos);
+  bool publish(lwmqtt_string_t topic, MQTTClientPayloadWriter writer, void *ref, bool retained, int qos);
+  bool subscribe(lwmqtt_string_t topic, int qos);
+  bool unsubscribe(lwmqtt_string_t topic);
+#if LWMQTT_ENABLE_PIPELINE
+  bool stage(MQTTClientStaged item);
+#endif
   void close();
 };
 
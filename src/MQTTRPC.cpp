@@ -0,0 +1,167 @@
+#include "MQTTRPC.h"
+
+MQTTRPC::MQTTRPC(MQTTClient &_client, int _slots) {
+  // set client
+  this->client = &_client;
+
+  // allocate calls
+  if (_slots > 0) {
+    this->calls = (MQTTRPCCall *)calloc((size_t)_slots, sizeof(MQTTRPCCall));
+    if (this->calls != nullptr) {
+      this->slots = _slots;
+    }
+  }
+}
+
+MQTTRPC::~MQTTRPC() {
+  // remove interceptor
+  if (this->replyTopic != nullptr) {
+    this->client->intercept(nullptr, nullptr);
+  }
+
+  // free reply topic and calls
+  free(this->replyTopic);
+  free(this->calls);
+}
+
+bool MQTTRPC::begin(const char _replyTopic[], int qos) {
+  // return if reply topic is empty
+  if (_replyTopic == nullptr || strlen(_replyTopic) == 0) {
+    return false;
+  }
+
+  // copy reply topic unless unchanged
+  if (this->replyTopic == nullptr || strcmp(this->replyTopic, _replyTopic) != 0) {
+    char *copy = strdup(_replyTopic);
+    if (copy == nullptr) {
+      return false;
+    }
+    free(this->replyTopic);
+    this->replyTopic = copy;
+    this->replyTopicLen = strlen(copy);
+  }
+
+  // install interceptor
+  this->client->intercept(MQTTRPC::intercept, this);
+
+  // subscribe to all replies using a single wildcard subscription
+  char filter[this->replyTopicLen + 3];
+  memcpy(filter, this->replyTopic, this->replyTopicLen);
+  memcpy(filter + this->replyTopicLen, "/+", 3);
+
+  return this->client->subscribe(filter, qos);
+}
+
+bool MQTTRPC::call(const char topic[], const char payload[], int length, MQTTRPCCallback cb, void *ref,
+                   uint32_t _timeout, int qos) {
+  // return if not started
+  if (this->replyTopic == nullptr) {
+    return false;
+  }
+
+  // find free call
+  MQTTRPCCall *call = nullptr;
+  for (int i = 0; i < this->slots && call == nullptr; i++) {
+    if (!this->calls[i].used) {
+      call = &this->calls[i];
+    }
+  }
+  if (call == nullptr) {
+    return false;
+  }
+
+  // get correlation id
+  uint32_t id = this->nextID++;
+  if (this->nextID == 0) {
+    this->nextID = 1;
+  }
+
+  // register call before publishing as the reply may arrive while waiting for the acknowledgement
+  *call = {id, this->client->now(), _timeout > 0 ? _timeout : this->timeout, cb, ref, true};
+  this->_pending++;
+
+  // publish request with the correlation id appended to the topic
+  size_t len = strlen(topic);
+  char requestTopic[len + 10];
+  memcpy(requestTopic, topic, len);
+  snprintf(requestTopic + len, 10, "/%08lx", (unsigned long)id);
+  if (this->client->publish(requestTopic, payload, length, false, qos)) {
+    return true;
+  }
+
+  // release call unless it has already been completed
+  if (call->used && call->id == id) {
+    call->used = false;
+    this->_pending--;
+    return false;
+  }
+
+  return true;
+}
+
+void MQTTRPC::loop() {
+  // fail calls whose timeout has elapsed
+  uint32_t now = this->client->now();
+  for (int i = 0; i < this->slots; i++) {
+    MQTTRPCCall *call = &this->calls[i];
+    if (call->used && now - call->sent >= call->timeout) {
+      this->_timeouts++;
+      this->finish(call, false, nullptr, 0);
+    }
+  }
+}
+
+void MQTTRPC::cancel() {
+  // fail all pending calls
+  for (int i = 0; i < this->slots; i++) {
+    if (this->calls[i].used) {
+      this->finish(&this->calls[i], false, nullptr, 0);
+    }
+  }
+}
+
+bool MQTTRPC::intercept(MQTTClient * /*client*/, void *ref, char topic[], char bytes[], int length) {
+  // handle message
+  return ((MQTTRPC *)ref)->handle(topic, bytes, length);
+}
+
+bool MQTTRPC::handle(char topic[], char bytes[], int length) {
+  // pass on messages that are not replies
+  if (strncmp(topic, this->replyTopic, this->replyTopicLen) != 0 || topic[this->replyTopicLen] != '/') {
+    return false;
+  }
+
+  // parse correlation id
+  char *end = nullptr;
+  char *str = topic + this->replyTopicLen + 1;
+  uint32_t id = (uint32_t)strtoul(str, &end, 16);
+  bool valid = end != str && *end == '\0';
+
+  // complete matching call
+  for (int i = 0; i < this->slots && valid; i++) {
+    MQTTRPCCall *call = &this->calls[i];
+    if (call->used && call->id == id) {
+      this->_completed++;
+      this->finish(call, true, bytes, length);
+      return true;
+    }
+  }
+
+  // consume replies to unknown, timed out or cancelled calls and malformed replies
+  this->_late++;
+
+  return true;
+}
+
+void MQTTRPC::finish(MQTTRPCCall *call, bool ok, char payload[], int length) {
+  // release call before calling back so that the callback may issue new calls
+  MQTTRPCCallback cb = call->cb;
+  void *ref = call->ref;
+  call->used = false;
+  this->_pending--;
+
+  // call back
+  if (cb != nullptr) {
+    cb(this, ref, ok, payload, length);
+  }
+}
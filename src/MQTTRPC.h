@@ -0,0 +1,63 @@
+#ifndef MQTT_RPC_H
+#define MQTT_RPC_H
+
+#include "MQTTClient.h"
+
+class MQTTRPC;
+
+typedef void (*MQTTRPCCallback)(MQTTRPC *rpc, void *ref, bool ok, char payload[], int length);
+
+typedef struct {
+  uint32_t id;
+  uint32_t sent;
+  uint32_t timeout;
+  MQTTRPCCallback cb;
+  void *ref;
+  bool used;
+} MQTTRPCCall;
+
+class MQTTRPC {
+ private:
+  MQTTClient *client;
+  MQTTRPCCall *calls = nullptr;
+  int slots = 0;
+  int _pending = 0;
+
+  char *replyTopic = nullptr;
+  size_t replyTopicLen = 0;
+  uint32_t timeout = 5000;
+  uint32_t nextID = 1;
+
+  uint32_t _completed = 0;
+  uint32_t _timeouts = 0;
+  uint32_t _late = 0;
+
+ public:
+  explicit MQTTRPC(MQTTClient &client, int slots = 8);
+
+  ~MQTTRPC();
+
+  bool begin(const char replyTopic[], int qos = 0);
+  void setTimeout(uint32_t timeout) { this->timeout = timeout; }
+
+  bool call(const char topic[], const char payload[], MQTTRPCCallback cb, void *ref = nullptr) {
+    return this->call(topic, payload, (int)strlen(payload), cb, ref, 0, 0);
+  }
+  bool call(const char topic[], const char payload[], int length, MQTTRPCCallback cb, void *ref, uint32_t timeout,
+            int qos);
+
+  void loop();
+  void cancel();
+
+  int pending() { return this->_pending; }
+  uint32_t completed() { return this->_completed; }
+  uint32_t timeouts() { return this->_timeouts; }
+  uint32_t late() { return this->_late; }
+
+ private:
+  static bool intercept(MQTTClient *client, void *ref, char topic[], char bytes[], int length);
+  bool handle(char topic[], char bytes[], int length);
+  void finish(MQTTRPCCall *call, bool ok, char payload[], int length);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "MQTTReporter.h"
+
+static uint32_t MQTTReporterHash(const uint8_t *buf, size_t len) {
+  // calculate fnv-1a hash
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= buf[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+MQTTReporter::MQTTReporter(MQTTClient &_client, int _slots) {
+  // set client
+  this->client = &_client;
+
+  // allocate records
+  if (_slots > 0) {
+    this->records = (MQTTReporterRecord *)calloc((size_t)_slots, sizeof(MQTTReporterRecord));
+    if (this->records != nullptr) {
+      this->slots = _slots;
+    }
+  }
+}
+
+MQTTReporter::~MQTTReporter() {
+  // free records
+  free(this->records);
+}
+
+void MQTTReporter::setDeadband(double absolute, double percent) {
+  // set deadband
+  this->absoluteDeadband = absolute;
+  this->percentDeadband = percent;
+}
+
+void MQTTReporter::setIntervals(uint32_t _minInterval, uint32_t _maxInterval) {
+  // set intervals
+  this->minInterval = _minInterval;
+  this->maxInterval = _maxInterval;
+}
+
+bool MQTTReporter::report(const char topic[], const char payload[], int length, bool retained, int qos) {
+  // get record
+  uint32_t now = this->client->now();
+  MQTTReporterRecord *record = this->lookup(topic, now);
+
+  // suppress unchanged payloads unless a heartbeat is due
+  uint32_t hash = MQTTReporterHash((const uint8_t *)payload, (size_t)length);
+  if (record != nullptr && record->used && !this->due(record, now) &&
+      (hash == record->payload || now - record->sent < this->minInterval)) {
+    this->_suppressed++;
+    return true;
+  }
+
+  // publish payload
+  if (!this->client->publish(topic, payload, length, retained, qos)) {
+    return false;
+  }
+
+  // update record
+  if (record != nullptr) {
+    record->payload = hash;
+    record->sent = now;
+    record->used = true;
+  }
+
+  return true;
+}
+
+bool MQTTReporter::report(const char topic[], double value, unsigned int decimals, bool retained, int qos) {
+  // get record
+  uint32_t now = this->client->now();
+  MQTTReporterRecord *record = this->lookup(topic, now);
+
+  // suppress values within the deadband unless a heartbeat is due
+  if (this->suppress(record, value, now)) {
+    return true;
+  }
+
+  // publish formatted value
+  String payload(value, (unsigned char)decimals);
+  if (!this->client->publish(topic, payload.c_str(), (int)payload.length(), retained, qos)) {
+    return false;
+  }
+
+  // update record
+  if (record != nullptr) {
+    record->value = value;
+    record->sent = now;
+    record->used = true;
+  }
+
+  return true;
+}
+
+bool MQTTReporter::report(const char topic[], long value, bool retained, int qos) {
+  // get record
+  uint32_t now = this->client->now();
+  MQTTReporterRecord *record = this->lookup(topic, now);
+
+  // suppress values within the deadband unless a heartbeat is due
+  if (this->suppress(record, (double)value, now)) {
+    return true;
+  }
+
+  // publish formatted value without decimals
+  String payload(value);
+  if (!this->client->publish(topic, payload.c_str(), (int)payload.length(), retained, qos)) {
+    return false;
+  }
+
+  // update record
+  if (record != nullptr) {
+    record->value = (double)value;
+    record->sent = now;
+    record->used = true;
+  }
+
+  return true;
+}
+
+void MQTTReporter::reset() {
+  // forget all records, the next report of every topic is published
+  for (int i = 0; i < this->slots; i++) {
+    this->records[i].used = false;
+  }
+}
+
+MQTTReporterRecord *MQTTReporter::lookup(const char topic[], uint32_t now) {
+  // return if no records are available
+  if (this->slots == 0) {
+    return nullptr;
+  }
+
+  // find record by topic hash, or the least recently sent record
+  uint32_t hash = MQTTReporterHash((const uint8_t *)topic, strlen(topic));
+  MQTTReporterRecord *oldest = &this->records[0];
+  for (int i = 0; i < this->slots; i++) {
+    MQTTReporterRecord *record = &this->records[i];
+    if (record->used && record->topic == hash) {
+      return record;
+    }
+    if (!record->used) {
+      oldest = record;
+    } else if (oldest->used && now - record->sent > now - oldest->sent) {
+      oldest = record;
+    }
+  }
+
+  // reuse record
+  oldest->topic = hash;
+  oldest->used = false;
+
+  return oldest;
+}
+
+bool MQTTReporter::suppress(MQTTReporterRecord *record, double value, uint32_t now) {
+  // never suppress the first value or a heartbeat
+  if (record == nullptr || !record->used || this->due(record, now)) {
+    return false;
+  }
+
+  // get deadband
+  double delta = fabs(value - record->value);
+  double band = this->absoluteDeadband;
+  double percent = fabs(record->value) * this->percentDeadband / 100;
+  if (percent > band) {
+    band = percent;
+  }
+
+  // suppress values within the deadband or before the minimum interval
+  if (delta <= band || now - record->sent < this->minInterval) {
+    this->_suppressed++;
+    return true;
+  }
+
+  return false;
+}
+
+bool MQTTReporter::due(MQTTReporterRecord *record, uint32_t now) {
+  // check if a heartbeat is due
+  return this->maxInterval > 0 && now - record->sent >= this->maxInterval;
+}
@@ -0,0 +1,57 @@
+#ifndef MQTT_REPORTER_H
+#define MQTT_REPORTER_H
+
+#include "MQTTClient.h"
+
+typedef struct {
+  uint32_t topic;
+  uint32_t payload;
+  double value;
+  uint32_t sent;
+  bool used;
+} MQTTReporterRecord;
+
+class MQTTReporter {
+ private:
+  MQTTClient *client;
+  MQTTReporterRecord *records = nullptr;
+  int slots = 0;
+
+  double absoluteDeadband = 0;
+  double percentDeadband = 0;
+  uint32_t minInterval = 0;
+  uint32_t maxInterval = 0;
+
+  uint32_t _suppressed = 0;
+
+ public:
+  explicit MQTTReporter(MQTTClient &client, int slots = 8);
+
+  ~MQTTReporter();
+
+  void setDeadband(double absolute, double percent = 0);
+  void setIntervals(uint32_t minInterval, uint32_t maxInterval = 0);
+
+  bool report(const char topic[], const char payload[], bool retained = false, int qos = 0) {
+    return this->report(topic, payload, (int)strlen(payload), retained, qos);
+  }
+  bool report(const char topic[], const char payload[], int length, bool retained, int qos);
+  bool report(const char topic[], const String &payload, bool retained = false, int qos = 0) {
+    return this->report(topic, payload.c_str(), (int)payload.length(), retained, qos);
+  }
+  bool report(const char topic[], double value, unsigned int decimals = 2, bool retained = false, int qos = 0);
+  bool report(const char topic[], int value, bool retained = false, int qos = 0) {
+    return this->report(topic, (long)value, retained, qos);
+  }
+  bool report(const char topic[], long value, bool retained = false, int qos = 0);
+
+  void reset();
+  uint32_t suppressed() { return this->_suppressed; }
+
+ private:
+  MQTTReporterRecord *lookup(const char topic[], uint32_t now);
+  bool suppress(MQTTReporterRecord *record, double value, uint32_t now);
+  bool due(MQTTReporterRecord *record, uint32_t now);
+};
+
+#endif
@@ -1,10 +1,16 @@
+#include <string.h>
+
 #include "packet.h"
 
 void lwmqtt_init(lwmqtt_client_t *client, uint8_t *write_buf, size_t write_buf_size, uint8_t *read_buf,
                  size_t read_buf_size) {
   client->last_packet_id = 0;
+#if LWMQTT_PACKET_ID_WINDOW > 0
+  memset(client->packet_ids, 0, sizeof(client->packet_ids));
+#endif
   client->keep_alive_interval = 0;
   client->pong_pending = false;
+  client->connack_pending = false;
 
   client->write_buf = write_buf;
   client->write_buf_size = write_buf_size;
@@ -25,6 +31,31 @@ void lwmqtt_init(lwmqtt_client_t *client, uint8_t *write_buf, size_t write_buf_s
 
   client->drop_overflow = false;
   client->overflow_counter = NULL;
+
+  client->ack_before_dispatch = false;
+  client->dispatching = false;
+
+  client->read_hook = NULL;
+  client->read_hook_ref = NULL;
+#if LWMQTT_ENABLE_PEAKS
+  client->read_peak = 0;
+  client->write_peak = 0;
+#endif
+
+#if LWMQTT_ENABLE_RTT
+  client->rtt_smoothed = 0;
+  client->rtt_variance = 0;
+  client->rtt_backoff = 0;
+  client->rtt_ping = false;
+  client->rtt_dispatched = false;
+#endif
+
+#if LWMQTT_ENABLE_TRACE
+  client->trace_events = NULL;
+  client->trace_size = 0;
+  client->trace_count = 0;
+  client->trace_clock = NULL;
+#endif
 }
 
 void lwmqtt_set_network(lwmqtt_client_t *client, void *ref, lwmqtt_network_read_t read, lwmqtt_network_write_t write) {
@@ -54,7 +85,143 @@ void lwmqtt_drop_overflow(lwmqtt_client_t *client, bool enabled, uint32_t *count
   client->overflow_counter = counter;
 }
 
+void lwmqtt_ack_before_dispatch(lwmqtt_client_t *client, bool enabled) { client->ack_before_dispatch = enabled; }
+
+void lwmqtt_set_read_hook(lwmqtt_client_t *client, void *ref, lwmqtt_read_hook_t hook) {
+  client->read_hook_ref = ref;
+  client->read_hook = hook;
+}
+
+#if LWMQTT_ENABLE_TRACE
+void lwmqtt_set_trace(lwmqtt_client_t *client, lwmqtt_trace_event_t *events, size_t size, lwmqtt_trace_clock_t clock) {
+  client->trace_events = size > 0 && clock != NULL ? events : NULL;
+  client->trace_size = size;
+  client->trace_count = 0;
+  client->trace_clock = clock;
+}
+#endif
+
+static uint32_t lwmqtt_trace_now(lwmqtt_client_t *client) {
+#if LWMQTT_ENABLE_TRACE
+  // get time if tracing
+  return client->trace_events != NULL ? client->trace_clock() : 0;
+#else
+  (void)client;
+  return 0;
+#endif
+}
+
+static void lwmqtt_trace(lwmqtt_client_t *client, lwmqtt_trace_type_t type, uint8_t packet, uint16_t packet_id,
+                         int32_t value, uint32_t start) {
+#if LWMQTT_ENABLE_TRACE
+  // return if not tracing
+  if (client->trace_events == NULL) {
+    return;
+  }
+
+  // get time and duration (saturated)
+  uint32_t now = client->trace_clock();
+  uint32_t duration = start > 0 ? now - start : 0;
+
+  // overwrite oldest event
+  lwmqtt_trace_event_t *event = &client->trace_events[client->trace_count % client->trace_size];
+  event->time = now;
+  event->value = value;
+  event->packet_id = packet_id;
+  event->duration = (uint16_t)(duration > 65535 ? 65535 : duration);
+  event->type = (uint8_t)type;
+  event->packet = packet;
+  client->trace_count++;
+#else
+  (void)client;
+  (void)type;
+  (void)packet;
+  (void)packet_id;
+  (void)value;
+  (void)start;
+#endif
+}
+
+static void lwmqtt_trace_packet(lwmqtt_client_t *client, lwmqtt_trace_type_t type, uint8_t *buf, size_t len) {
+#if LWMQTT_ENABLE_TRACE
+  // return if not tracing
+  if (client->trace_events == NULL) {
+    return;
+  }
+
+  // get packet type
+  uint8_t packet = (uint8_t)(buf[0] >> 4);
+
+  // get packet id of acks, (un)subscribes and publishes with qos
+  uint16_t packet_id = 0;
+  if (packet >= LWMQTT_PUBACK_PACKET && packet <= LWMQTT_UNSUBACK_PACKET) {
+    lwmqtt_decode_packet_id(buf, len, &packet_id);
+  } else if (packet == LWMQTT_PUBLISH_PACKET && (buf[0] & 0x06u) != 0) {
+    uint8_t *buf_ptr = buf + 1;
+    uint8_t *buf_end = buf + len;
+    uint32_t rem_len;
+    uint16_t topic_len;
+    if (lwmqtt_read_varnum(&buf_ptr, buf_end, &rem_len) == LWMQTT_SUCCESS &&
+        lwmqtt_read_num(&buf_ptr, buf_end, &topic_len) == LWMQTT_SUCCESS && (size_t)(buf_end - buf_ptr) > topic_len) {
+      buf_ptr += topic_len;
+      lwmqtt_read_num(&buf_ptr, buf_end, &packet_id);
+    }
+  }
+
+  // record event
+  lwmqtt_trace(client, type, packet, packet_id, (int32_t)len, 0);
+#else
+  (void)client;
+  (void)type;
+  (void)buf;
+  (void)len;
+#endif
+}
+
+static void lwmqtt_mark_packet_id(lwmqtt_client_t *client, uint16_t packet_id, bool used) {
+#if LWMQTT_PACKET_ID_WINDOW > 0
+  // get slot
+  uint16_t slot = (uint16_t)(packet_id % LWMQTT_PACKET_ID_WINDOW);
+  uint8_t mask = (uint8_t)(1u << (slot % 8));
+
+  // set or clear bit
+  if (used) {
+    client->packet_ids[slot / 8] |= mask;
+  } else {
+    client->packet_ids[slot / 8] &= (uint8_t)~mask;
+  }
+#else
+  (void)client;
+  (void)packet_id;
+  (void)used;
+#endif
+}
+
+static void lwmqtt_release_packet_id(lwmqtt_client_t *client, uint16_t packet_id) {
+  // release the packet id of a packet that never reached the network, no ack will ever arrive for it
+  if (packet_id > 0) {
+    lwmqtt_mark_packet_id(client, packet_id, false);
+  }
+}
+
 static uint16_t lwmqtt_get_next_packet_id(lwmqtt_client_t *client) {
+#if LWMQTT_PACKET_ID_WINDOW > 0
+  // advance to the next packet id whose slot is free, usually the first one as acks arrive in order
+  for (int i = 0; i < LWMQTT_PACKET_ID_WINDOW; i++) {
+    // increment packet id and handle overflow
+    client->last_packet_id = client->last_packet_id == 65535 ? 1 : client->last_packet_id + 1;
+
+    // check slot
+    uint16_t slot = (uint16_t)(client->last_packet_id % LWMQTT_PACKET_ID_WINDOW);
+    if ((client->packet_ids[slot / 8] & (1u << (slot % 8))) == 0) {
+      lwmqtt_mark_packet_id(client, client->last_packet_id, true);
+      return client->last_packet_id;
+    }
+  }
+
+  // all slots are in use
+  return 0;
+#else
   // check overflow
   if (client->last_packet_id == 65535) {
     client->last_packet_id = 1;
@@ -65,6 +232,84 @@ static uint16_t lwmqtt_get_next_packet_id(lwmqtt_client_t *client) {
   client->last_packet_id++;
 
   return client->last_packet_id;
+#endif
+}
+
+static void lwmqtt_start_rtt(lwmqtt_client_t *client) {
+#if LWMQTT_ENABLE_RTT
+  // forget messages that have been dispatched before the command
+  client->rtt_dispatched = false;
+#else
+  (void)client;
+#endif
+}
+
+static void lwmqtt_sample_rtt(lwmqtt_client_t *client, void *timer, uint32_t timeout) {
+#if LWMQTT_ENABLE_RTT
+  // reset backoff
+  client->rtt_backoff = 0;
+
+  // skip the sample if a message has been dispatched while waiting, as the callback delayed reading the ack
+  if (client->rtt_dispatched) {
+    return;
+  }
+
+  // get remaining time
+  int32_t remaining_time = client->timer_get(timer);
+
+  // calculate round-trip time
+  uint32_t rtt = timeout;
+  if (remaining_time > 0 && (uint32_t)remaining_time < timeout) {
+    rtt -= (uint32_t)remaining_time;
+  }
+  if (rtt == 0) {
+    rtt = 1;
+  }
+
+  // initialize with first sample (smoothed is scaled by 8 and variance by 4)
+  if (client->rtt_smoothed == 0) {
+    client->rtt_smoothed = rtt << 3;
+    client->rtt_variance = rtt << 1;
+    return;
+  }
+
+  // update smoothed round-trip time (gain 1/8)
+  uint32_t smoothed = client->rtt_smoothed >> 3;
+  uint32_t delta = rtt > smoothed ? rtt - smoothed : smoothed - rtt;
+  if (rtt > smoothed) {
+    client->rtt_smoothed += delta;
+  } else {
+    client->rtt_smoothed -= delta;
+  }
+
+  // update variance (gain 1/4)
+  client->rtt_variance = client->rtt_variance - (client->rtt_variance >> 2) + delta;
+#else
+  (void)client;
+  (void)timer;
+  (void)timeout;
+#endif
+}
+
+static void lwmqtt_backoff_rtt(lwmqtt_client_t *client) {
+#if LWMQTT_ENABLE_RTT
+  // double adaptive timeout up to 64 times
+  if (client->rtt_backoff < 6) {
+    client->rtt_backoff++;
+  }
+#else
+  (void)client;
+#endif
+}
+
+static void lwmqtt_reset_keep_alive(lwmqtt_client_t *client) {
+  // reset keep alive timer
+  client->timer_set(client->keep_alive_timer, client->keep_alive_interval);
+
+#if LWMQTT_ENABLE_RTT
+  // invalidate a pending ping measurement
+  client->rtt_ping = false;
+#endif
 }
 
 static lwmqtt_err_t lwmqtt_read_from_network(lwmqtt_client_t *client, size_t offset, size_t len) {
@@ -75,12 +320,14 @@ static lwmqtt_err_t lwmqtt_read_from_network(lwmqtt_client_t *client, size_t off
 
   // prepare counter
   size_t read = 0;
+  uint32_t start = lwmqtt_trace_now(client);
 
   // read while data is missing
   while (read < len) {
     // check remaining time
     int32_t remaining_time = client->timer_get(client->command_timer);
     if (remaining_time <= 0) {
+      lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, 0, 0, (int32_t)read, start);
       return LWMQTT_NETWORK_TIMEOUT;
     }
 
@@ -88,7 +335,11 @@ static lwmqtt_err_t lwmqtt_read_from_network(lwmqtt_client_t *client, size_t off
     size_t partial_read = 0;
     lwmqtt_err_t err = client->network_read(client->network, client->read_buf + offset + read, len - read,
                                             &partial_read, (uint32_t)remaining_time);
-    if (err != LWMQTT_SUCCESS) {
+    if (err == LWMQTT_NETWORK_TIMEOUT) {
+      lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, 0, 0, (int32_t)read, start);
+      return err;
+    } else if (err != LWMQTT_SUCCESS) {
+      lwmqtt_trace(client, LWMQTT_TRACE_ERROR, 0, 0, err, start);
       return err;
     }
 
@@ -96,6 +347,11 @@ static lwmqtt_err_t lwmqtt_read_from_network(lwmqtt_client_t *client, size_t off
     read += partial_read;
   }
 
+  // record slow reads
+  if (lwmqtt_trace_now(client) != start) {
+    lwmqtt_trace(client, LWMQTT_TRACE_NETWORK_READ, 0, 0, (int32_t)len, start);
+  }
+
   return LWMQTT_SUCCESS;
 }
 
@@ -132,12 +388,14 @@ static lwmqtt_err_t lwmqtt_drain_network(lwmqtt_client_t *client, size_t amount)
 static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, uint8_t *buf, size_t len) {
   // prepare counter
   size_t written = 0;
+  uint32_t start = lwmqtt_trace_now(client);
 
   // write while data is left
   while (written < len) {
     // check remaining time
     int32_t remaining_time = client->timer_get(client->command_timer);
     if (remaining_time <= 0) {
+      lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, 0, 0, (int32_t)written, start);
       return LWMQTT_NETWORK_TIMEOUT;
     }
 
@@ -146,6 +404,7 @@ static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, uint8_t *bu
     lwmqtt_err_t err =
         client->network_write(client->network, buf + written, len - written, &partial_write, (uint32_t)remaining_time);
     if (err != LWMQTT_SUCCESS) {
+      lwmqtt_trace(client, err == LWMQTT_NETWORK_TIMEOUT ? LWMQTT_TRACE_TIMEOUT : LWMQTT_TRACE_ERROR, 0, 0, err, start);
       return err;
     }
 
@@ -153,6 +412,11 @@ static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, uint8_t *bu
     written += partial_write;
   }
 
+  // record slow writes
+  if (lwmqtt_trace_now(client) != start) {
+    lwmqtt_trace(client, LWMQTT_TRACE_NETWORK_WRITE, 0, 0, (int32_t)len, start);
+  }
+
   return LWMQTT_SUCCESS;
 }
 
@@ -199,8 +463,22 @@ static lwmqtt_err_t lwmqtt_read_packet_in_buffer(lwmqtt_client_t *client, size_t
     return err;
   }
 
+  // record the largest incoming packet
+  size_t total = 1 + len + rem_len;
+#if LWMQTT_ENABLE_PEAKS
+  if (total > client->read_peak) {
+    client->read_peak = total;
+  }
+#endif
+
+  // let the hook size the read buffer
+  bool fits = total <= client->read_buf_size;
+  if (client->read_hook != NULL) {
+    fits = client->read_hook(client, client->read_hook_ref, total) && total <= client->read_buf_size;
+  }
+
   // handle overflow
-  if (client->drop_overflow && 1 + len + rem_len > client->read_buf_size) {
+  if (client->drop_overflow && !fits) {
     // drain network
     err = lwmqtt_drain_network(client, rem_len);
     if (err != LWMQTT_SUCCESS) {
@@ -228,26 +506,120 @@ static lwmqtt_err_t lwmqtt_read_packet_in_buffer(lwmqtt_client_t *client, size_t
   }
 
   // adjust counter
-  *read += 1 + len + rem_len;
+  *read += total;
 
   return LWMQTT_SUCCESS;
 }
 
-static lwmqtt_err_t lwmqtt_send_packet_in_buffer(lwmqtt_client_t *client, size_t length) {
+static void lwmqtt_track_write(lwmqtt_client_t *client, size_t length) {
+#if LWMQTT_ENABLE_PEAKS
+  // record the largest outgoing packet
+  if (length > client->write_peak) {
+    client->write_peak = length;
+  }
+#else
+  (void)client;
+  (void)length;
+#endif
+}
+
+static void lwmqtt_record_sent(lwmqtt_client_t *client, uint8_t *buf, size_t length) {
+  // record packet that has been written to the network
+  lwmqtt_track_write(client, length);
+  lwmqtt_trace_packet(client, LWMQTT_TRACE_PACKET_SENT, buf, length);
+}
+
+static lwmqtt_err_t lwmqtt_send_packet(lwmqtt_client_t *client, uint8_t *buf, size_t length) {
   // write to network
-  lwmqtt_err_t err = lwmqtt_write_to_network(client, client->write_buf, length);
+  lwmqtt_err_t err = lwmqtt_write_to_network(client, buf, length);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
+  // record packet
+  lwmqtt_record_sent(client, buf, length);
+
   // reset keep alive timer
-  client->timer_set(client->keep_alive_timer, client->keep_alive_interval);
+  lwmqtt_reset_keep_alive(client);
+
+  return LWMQTT_SUCCESS;
+}
+
+static bool lwmqtt_payload_in_flash(lwmqtt_message_t msg) {
+#if LWMQTT_ENABLE_PROGMEM
+  return msg.flash;
+#else
+  (void)msg;
+  return false;
+#endif
+}
+
+static lwmqtt_err_t lwmqtt_write_payload(lwmqtt_client_t *client, lwmqtt_message_t msg) {
+  // write payload directly unless it is stored in program memory
+  if (!lwmqtt_payload_in_flash(msg)) {
+    return lwmqtt_write_to_network(client, msg.payload, msg.payload_len);
+  }
+
+#if LWMQTT_ENABLE_PROGMEM
+  // copy payload through the write buffer in chunks, the header has already been written
+  size_t written = 0;
+  while (written < msg.payload_len) {
+    size_t chunk = msg.payload_len - written;
+    if (chunk > client->write_buf_size) {
+      chunk = client->write_buf_size;
+    }
+    memcpy_P(client->write_buf, msg.payload + written, chunk);
+    lwmqtt_err_t err = lwmqtt_write_to_network(client, client->write_buf, chunk);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+    written += chunk;
+  }
+#endif
 
   return LWMQTT_SUCCESS;
 }
 
+static lwmqtt_err_t lwmqtt_send_packet_in_buffer(lwmqtt_client_t *client, size_t length) {
+  // send packet from write buffer
+  return lwmqtt_send_packet(client, client->write_buf, length);
+}
+
+static bool lwmqtt_write_buffer_busy(lwmqtt_client_t *client) {
+  // a write buffer that is shared with the read buffer may not be used while a packet is dispatched
+  return client->dispatching && client->write_buf == client->read_buf;
+}
+
+static lwmqtt_err_t lwmqtt_send_ack(lwmqtt_client_t *client, lwmqtt_packet_type_t ack_type, uint16_t packet_id) {
+  // encode ack packet into the scratch buffer to leave the write buffer (which may be shared) alone
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_ack(client->ack_buf, sizeof(client->ack_buf), &len, ack_type, packet_id);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // send ack packet
+  return lwmqtt_send_packet(client, client->ack_buf, len);
+}
+
+static lwmqtt_err_t lwmqtt_send_publish_ack(lwmqtt_client_t *client, lwmqtt_qos_t qos, uint16_t packet_id) {
+  // define ack packet
+  lwmqtt_packet_type_t ack_type = LWMQTT_PUBACK_PACKET;
+#if LWMQTT_ENABLE_QOS2
+  if (qos == LWMQTT_QOS2) {
+    ack_type = LWMQTT_PUBREC_PACKET;
+  }
+#else
+  (void)qos;
+#endif
+
+  // send ack packet
+  return lwmqtt_send_ack(client, ack_type, packet_id);
+}
+
 static lwmqtt_err_t lwmqtt_cycle_once(lwmqtt_client_t *client, size_t *read, lwmqtt_packet_type_t *packet_type) {
   // read next packet from the network
+  size_t before = *read;
   lwmqtt_err_t err = lwmqtt_read_packet_in_buffer(client, read, packet_type);
   if (err != LWMQTT_SUCCESS) {
     return err;
@@ -255,6 +627,9 @@ static lwmqtt_err_t lwmqtt_cycle_once(lwmqtt_client_t *client, size_t *read, lwm
     return LWMQTT_SUCCESS;
   }
 
+  // record packet
+  lwmqtt_trace_packet(client, LWMQTT_TRACE_PACKET_RECEIVED, client->read_buf, *read - before);
+
   switch (*packet_type) {
     // handle publish packets
     case LWMQTT_PUBLISH_PACKET: {
@@ -268,33 +643,35 @@ static lwmqtt_err_t lwmqtt_cycle_once(lwmqtt_client_t *client, size_t *read, lwm
         return err;
       }
 
+      // acknowledge qos 1 messages before the callback if configured
+      bool acked = false;
+      if (client->ack_before_dispatch && msg.qos == LWMQTT_QOS1) {
+        err = lwmqtt_send_publish_ack(client, msg.qos, packet_id);
+        if (err != LWMQTT_SUCCESS) {
+          return err;
+        }
+        acked = true;
+      }
+
       // call callback if set
       if (client->callback != NULL) {
+        // keep the flag of an outer dispatch if a command of the callback dispatches another message
+        bool dispatching = client->dispatching;
+        client->dispatching = true;
         client->callback(client, client->callback_ref, topic, msg);
+        client->dispatching = dispatching;
+#if LWMQTT_ENABLE_RTT
+        client->rtt_dispatched = true;
+#endif
       }
 
-      // break early on qos zero
-      if (msg.qos == LWMQTT_QOS0) {
+      // break early on qos zero or if already acknowledged
+      if (msg.qos == LWMQTT_QOS0 || acked) {
         break;
       }
 
-      // define ack packet
-      lwmqtt_packet_type_t ack_type = LWMQTT_NO_PACKET;
-      if (msg.qos == LWMQTT_QOS1) {
-        ack_type = LWMQTT_PUBACK_PACKET;
-      } else if (msg.qos == LWMQTT_QOS2) {
-        ack_type = LWMQTT_PUBREC_PACKET;
-      }
-
-      // encode ack packet
-      size_t len;
-      err = lwmqtt_encode_ack(client->write_buf, client->write_buf_size, &len, ack_type, packet_id);
-      if (err != LWMQTT_SUCCESS) {
-        return err;
-      }
-
-      // send ack packet
-      err = lwmqtt_send_packet_in_buffer(client, len);
+      // acknowledge message
+      err = lwmqtt_send_publish_ack(client, msg.qos, packet_id);
       if (err != LWMQTT_SUCCESS) {
         return err;
       }
@@ -302,6 +679,7 @@ static lwmqtt_err_t lwmqtt_cycle_once(lwmqtt_client_t *client, size_t *read, lwm
       break;
     }
 
+#if LWMQTT_ENABLE_QOS2
     // handle pubrec packets
     case LWMQTT_PUBREC_PACKET: {
       // decode pubrec packet
@@ -311,15 +689,8 @@ static lwmqtt_err_t lwmqtt_cycle_once(lwmqtt_client_t *client, size_t *read, lwm
         return err;
       }
 
-      // encode pubrel packet
-      size_t len;
-      err = lwmqtt_encode_ack(client->write_buf, client->write_buf_size, &len, LWMQTT_PUBREL_PACKET, packet_id);
-      if (err != LWMQTT_SUCCESS) {
-        return err;
-      }
-
       // send pubrel packet
-      err = lwmqtt_send_packet_in_buffer(client, len);
+      err = lwmqtt_send_ack(client, LWMQTT_PUBREL_PACKET, packet_id);
       if (err != LWMQTT_SUCCESS) {
         return err;
       }
@@ -336,30 +707,70 @@ static lwmqtt_err_t lwmqtt_cycle_once(lwmqtt_client_t *client, size_t *read, lwm
         return err;
       }
 
-      // encode pubcomp packet
-      size_t len;
-      err = lwmqtt_encode_ack(client->write_buf, client->write_buf_size, &len, LWMQTT_PUBCOMP_PACKET, packet_id);
-      if (err != LWMQTT_SUCCESS) {
-        return err;
-      }
-
       // send pubcomp packet
-      err = lwmqtt_send_packet_in_buffer(client, len);
+      err = lwmqtt_send_ack(client, LWMQTT_PUBCOMP_PACKET, packet_id);
       if (err != LWMQTT_SUCCESS) {
         return err;
       }
 
       break;
     }
+#endif
 
     // handle pingresp packets
     case LWMQTT_PINGRESP_PACKET: {
+      // sample round-trip time if no other packet has been sent since the ping (and no message has been dispatched)
+#if LWMQTT_ENABLE_RTT
+      if (client->pong_pending && client->rtt_ping) {
+        lwmqtt_sample_rtt(client, client->keep_alive_timer, client->keep_alive_interval);
+      }
+#endif
+
       // set flag
       client->pong_pending = false;
 
       break;
     }
 
+    // handle connack packets of connects sent with skip_ack that are read before lwmqtt_finish_connect() is called
+    case LWMQTT_CONNACK_PACKET: {
+      // ignore connacks that are not awaited separately
+      if (!client->connack_pending) {
+        break;
+      }
+
+      // clear flag
+      client->connack_pending = false;
+
+      // decode connack packet
+      bool session_present;
+      lwmqtt_return_code_t return_code;
+      err = lwmqtt_decode_connack(client->read_buf, client->read_buf_size, &session_present, &return_code);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+
+      // return error if connection was not accepted
+      if (return_code != LWMQTT_CONNECTION_ACCEPTED) {
+        return LWMQTT_CONNECTION_DENIED;
+      }
+
+      break;
+    }
+
+    // release the packet id of acknowledged packets (including acks that arrive after their command timed out)
+    case LWMQTT_PUBACK_PACKET:
+    case LWMQTT_PUBCOMP_PACKET:
+    case LWMQTT_SUBACK_PACKET:
+    case LWMQTT_UNSUBACK_PACKET: {
+      uint16_t packet_id;
+      if (lwmqtt_decode_packet_id(client->read_buf, client->read_buf_size, &packet_id) == LWMQTT_SUCCESS) {
+        lwmqtt_mark_packet_id(client, packet_id, false);
+      }
+
+      break;
+    }
+
     // handle all other packets
     default: {
       break;
@@ -378,7 +789,14 @@ static lwmqtt_err_t lwmqtt_cycle_until(lwmqtt_client_t *client, lwmqtt_packet_ty
   do {
     // do one cycle
     lwmqtt_err_t err = lwmqtt_cycle_once(client, &read, packet_type);
-    if (err != LWMQTT_SUCCESS) {
+    if (err == LWMQTT_NETWORK_TIMEOUT && needle != LWMQTT_NO_PACKET) {
+      lwmqtt_backoff_rtt(client);
+      return err;
+    } else if (err != LWMQTT_SUCCESS) {
+      // record protocol errors (network errors have been recorded already)
+      if (err != LWMQTT_NETWORK_TIMEOUT && err != LWMQTT_NETWORK_FAILED_READ && err != LWMQTT_NETWORK_FAILED_WRITE) {
+        lwmqtt_trace(client, LWMQTT_TRACE_ERROR, (uint8_t)*packet_type, 0, err, 0);
+      }
       return err;
     }
 
@@ -393,51 +811,45 @@ static lwmqtt_err_t lwmqtt_cycle_until(lwmqtt_client_t *client, lwmqtt_packet_ty
     }
   } while (client->timer_get(client->command_timer) > 0 && (available == 0 || read < available));
 
-  return LWMQTT_SUCCESS;
-}
-
-lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, lwmqtt_will_t *will,
-                            uint32_t timeout) {
-  // ensure default options
-  static lwmqtt_connect_options_t def_options = lwmqtt_default_connect_options;
-  if (options == NULL) {
-    options = &def_options;
+  // back off adaptive timeout and record the expiry if the awaited packet did not arrive in time
+  if (needle != LWMQTT_NO_PACKET) {
+    lwmqtt_backoff_rtt(client);
+    lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, (uint8_t)needle, 0, 0, 0);
   }
 
-  // TODO: Reject password-only credentials (MQTT 3.1.1 compliance).
+  return LWMQTT_SUCCESS;
+}
 
-  // set command timer
+static void lwmqtt_prepare_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, uint32_t timeout) {
+  // set command timer and start the round-trip time measurement
   client->timer_set(client->command_timer, timeout);
+  lwmqtt_start_rtt(client);
 
   // save keep alive interval
   client->keep_alive_interval = (uint32_t)(options->keep_alive) * 1000;
 
   // set keep alive timer
-  client->timer_set(client->keep_alive_timer, client->keep_alive_interval);
+  lwmqtt_reset_keep_alive(client);
 
-  // reset pong pending flag
+  // reset pending flags
   client->pong_pending = false;
+  client->connack_pending = false;
 
   // reset return code and session present
   options->return_code = LWMQTT_UNKNOWN_RETURN_CODE;
   options->session_present = false;
 
-  // encode connect packet
-  size_t len;
-  lwmqtt_err_t err = lwmqtt_encode_connect(client->write_buf, client->write_buf_size, &len, options, will);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
-  }
-
-  // send packet
-  err = lwmqtt_send_packet_in_buffer(client, len);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
-  }
+#if LWMQTT_PACKET_ID_WINDOW > 0
+  // release all packet ids, the client does not retransmit unacknowledged packets on a new connection so no ack will
+  // arrive for them even if the broker kept the session (duplicates mark their packet id again when published)
+  memset(client->packet_ids, 0, sizeof(client->packet_ids));
+#endif
+}
 
+static lwmqtt_err_t lwmqtt_await_connack(lwmqtt_client_t *client, lwmqtt_connect_options_t *options) {
   // wait for connack packet
   lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
-  err = lwmqtt_cycle_until(client, &packet_type, 0, LWMQTT_CONNACK_PACKET);
+  lwmqtt_err_t err = lwmqtt_cycle_until(client, &packet_type, 0, LWMQTT_CONNACK_PACKET);
   if (err != LWMQTT_SUCCESS) {
     return err;
   } else if (packet_type != LWMQTT_CONNACK_PACKET) {
@@ -459,86 +871,168 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *o
   return LWMQTT_SUCCESS;
 }
 
-lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_publish_options_t *options, lwmqtt_string_t topic,
-                            lwmqtt_message_t msg, uint32_t timeout) {
+static lwmqtt_err_t lwmqtt_await_suback(lwmqtt_client_t *client, int count, uint16_t expected_packet_id) {
+  // wait for suback packet
+  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
+  lwmqtt_err_t err = lwmqtt_cycle_until(client, &packet_type, 0, LWMQTT_SUBACK_PACKET);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  } else if (packet_type != LWMQTT_SUBACK_PACKET) {
+    return LWMQTT_MISSING_OR_WRONG_PACKET;
+  }
+
+  // decode packet
+  int suback_count = 0;
+  lwmqtt_qos_t granted_qos[count];
+  uint16_t packet_id;
+  err = lwmqtt_decode_suback(client->read_buf, client->read_buf_size, &packet_id, count, &suback_count, granted_qos);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+  if (packet_id != expected_packet_id) {
+    return LWMQTT_MISSING_OR_WRONG_PACKET;
+  }
+
+  // check suback codes
+  for (int i = 0; i < suback_count; i++) {
+    if (granted_qos[i] == LWMQTT_QOS_FAILURE) {
+      return LWMQTT_FAILED_SUBSCRIPTION;
+    }
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, lwmqtt_will_t *will,
+                            uint32_t timeout) {
   // ensure default options
-  static lwmqtt_publish_options_t def_options = lwmqtt_default_publish_options;
+  static lwmqtt_connect_options_t def_options = lwmqtt_default_connect_options;
   if (options == NULL) {
     options = &def_options;
   }
 
-  // set command timer
-  client->timer_set(client->command_timer, timeout);
+  // TODO: Reject password-only credentials (MQTT 3.1.1 compliance).
 
-  // add packet id if at least qos 1
-  bool dup = false;
-  uint16_t packet_id = 0;
-  if (msg.qos == LWMQTT_QOS1 || msg.qos == LWMQTT_QOS2) {
-    if (options->dup_id != NULL && *options->dup_id > 0) {
-      dup = true;
-      packet_id = *options->dup_id;
-    } else {
-      packet_id = lwmqtt_get_next_packet_id(client);
-      if (options->dup_id != NULL) {
-        *options->dup_id = packet_id;
-      }
-    }
+  // return immediately if the shared buffer still holds the packet that is being dispatched
+  if (lwmqtt_write_buffer_busy(client)) {
+    return LWMQTT_SHARED_BUFFER_BUSY;
   }
 
-  uint16_t expected_packet_id = packet_id;
+  // prepare connection
+  lwmqtt_prepare_connect(client, options, timeout);
 
-  // encode publish packet
-  size_t len = 0;
-  lwmqtt_err_t err = lwmqtt_encode_publish(client->write_buf, client->write_buf_size, &len, dup, packet_id, topic, msg);
+  // encode connect packet
+  size_t len;
+  lwmqtt_err_t err = lwmqtt_encode_connect(client->write_buf, client->write_buf_size, &len, options, will);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
-  // send packet (without payload)
+  // send packet
   err = lwmqtt_send_packet_in_buffer(client, len);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
-  // send payload if available
-  if (msg.payload_len > 0) {
-    err = lwmqtt_write_to_network(client, msg.payload, msg.payload_len);
-    if (err != LWMQTT_SUCCESS) {
-      return err;
-    }
+  // return immediately if the connack is awaited separately
+  if (options->skip_ack) {
+    client->connack_pending = true;
+    return LWMQTT_SUCCESS;
+  }
 
-    // Refresh keep-alive after the payload has been fully transmitted.
-    client->timer_set(client->keep_alive_timer, client->keep_alive_interval);
+  // wait for connack packet
+  err = lwmqtt_await_connack(client, options);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
   }
 
-  // immediately return on qos zero
-  if (msg.qos == LWMQTT_QOS0) {
-    return LWMQTT_SUCCESS;
+  // sample round-trip time
+  lwmqtt_sample_rtt(client, client->command_timer, timeout);
+
+  return LWMQTT_SUCCESS;
+}
+
+static uint16_t lwmqtt_get_publish_packet_id(lwmqtt_client_t *client, lwmqtt_publish_options_t *options,
+                                             lwmqtt_qos_t qos, bool *dup) {
+  // no packet id on qos zero
+  *dup = false;
+  if (qos != LWMQTT_QOS1 && qos != LWMQTT_QOS2) {
+    return 0;
   }
 
-  // skip if requested
-  if (options->skip_ack) {
-    return LWMQTT_SUCCESS;
+  // reuse duplicate packet id if available
+  if (options->dup_id != NULL && *options->dup_id > 0) {
+    *dup = true;
+    lwmqtt_mark_packet_id(client, *options->dup_id, true);
+    return *options->dup_id;
+  }
+
+  // get next packet id
+  uint16_t packet_id = lwmqtt_get_next_packet_id(client);
+  if (options->dup_id != NULL) {
+    *options->dup_id = packet_id;
+  }
+
+  return packet_id;
+}
+
+static void lwmqtt_release_publish_packet_id(lwmqtt_client_t *client, lwmqtt_publish_options_t *options,
+                                             uint16_t packet_id, bool dup) {
+  // keep the packet id of a duplicate, the broker may still hold the original packet
+  if (dup) {
+    return;
+  }
+
+  // release packet id and forget the stored one as nothing has been sent that could be duplicated
+  lwmqtt_release_packet_id(client, packet_id);
+  if (options->dup_id != NULL && packet_id > 0) {
+    *options->dup_id = 0;
   }
+}
 
+static lwmqtt_packet_type_t lwmqtt_publish_ack_type(lwmqtt_qos_t qos) {
   // define ack packet
+#if LWMQTT_ENABLE_QOS2
   lwmqtt_packet_type_t ack_type = LWMQTT_NO_PACKET;
-  if (msg.qos == LWMQTT_QOS1) {
+  if (qos == LWMQTT_QOS1) {
     ack_type = LWMQTT_PUBACK_PACKET;
-  } else if (msg.qos == LWMQTT_QOS2) {
+  } else if (qos == LWMQTT_QOS2) {
     ack_type = LWMQTT_PUBCOMP_PACKET;
   }
+#else
+  // qos 2 has been downgraded to qos 1 by the encoder
+  lwmqtt_packet_type_t ack_type = qos != LWMQTT_QOS0 ? LWMQTT_PUBACK_PACKET : LWMQTT_NO_PACKET;
+#endif
 
-  // wait for ack packet
-  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
-  err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
+  return ack_type;
+}
+
+static lwmqtt_err_t lwmqtt_await_publish_ack(lwmqtt_client_t *client, lwmqtt_publish_options_t *options,
+                                             lwmqtt_qos_t qos, uint16_t expected_packet_id) {
+  // immediately return on qos zero
+  if (qos == LWMQTT_QOS0) {
+    return LWMQTT_SUCCESS;
+  }
+
+  // skip if requested
+  if (options->skip_ack) {
+    return LWMQTT_SUCCESS;
+  }
+
+  // define ack packet
+  lwmqtt_packet_type_t ack_type = lwmqtt_publish_ack_type(qos);
+
+  // wait for ack packet
+  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
+  lwmqtt_err_t err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
   } else if (packet_type != ack_type) {
     return LWMQTT_MISSING_OR_WRONG_PACKET;
   }
 
   // decode ack packet
+  uint16_t packet_id;
   err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, ack_type, &packet_id);
   if (err != LWMQTT_SUCCESS) {
     return err;
@@ -550,18 +1044,481 @@ lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_publish_options_t *o
   return LWMQTT_SUCCESS;
 }
 
-lwmqtt_err_t lwmqtt_subscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, lwmqtt_qos_t *qos,
-                              uint32_t timeout) {
+lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_publish_options_t *options, lwmqtt_string_t topic,
+                            lwmqtt_message_t msg, uint32_t timeout) {
+  // ensure default options
+  static lwmqtt_publish_options_t def_options = lwmqtt_default_publish_options;
+  if (options == NULL) {
+    options = &def_options;
+  }
+
+  // return immediately if the shared buffer still holds the packet that is being dispatched
+  if (lwmqtt_write_buffer_busy(client)) {
+    return LWMQTT_SHARED_BUFFER_BUSY;
+  }
+
+  // set command timer and start the round-trip time measurement
+  client->timer_set(client->command_timer, timeout);
+  lwmqtt_start_rtt(client);
+
+  // add packet id if at least qos 1
+  bool dup;
+  uint16_t packet_id = lwmqtt_get_publish_packet_id(client, options, msg.qos, &dup);
+  if (msg.qos != LWMQTT_QOS0 && packet_id == 0) {
+    return LWMQTT_PACKET_IDS_EXHAUSTED;
+  }
+
+  // encode publish packet
+  size_t len = 0;
+  lwmqtt_err_t err = lwmqtt_encode_publish(client->write_buf, client->write_buf_size, &len, dup, packet_id, topic, msg);
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_publish_packet_id(client, options, packet_id, dup);
+    return err;
+  }
+
+  // send packet (without payload)
+  err = lwmqtt_send_packet_in_buffer(client, len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // send payload if available
+  if (msg.payload_len > 0) {
+    err = lwmqtt_write_payload(client, msg);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+
+    // Refresh keep-alive after the payload has been fully transmitted.
+    lwmqtt_reset_keep_alive(client);
+
+    // record size including payload
+    lwmqtt_track_write(client, len + msg.payload_len);
+  }
+
+  // wait for ack if required
+  err = lwmqtt_await_publish_ack(client, options, msg.qos, packet_id);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // sample round-trip time if the puback unambiguously belongs to this packet
+  if (msg.qos == LWMQTT_QOS1 && !dup && !options->skip_ack) {
+    lwmqtt_sample_rtt(client, client->command_timer, timeout);
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_publish_in_place(lwmqtt_client_t *client, lwmqtt_publish_options_t *options, lwmqtt_string_t topic,
+                                     lwmqtt_message_t msg, lwmqtt_payload_writer_t writer, void *ref,
+                                     uint32_t timeout) {
+  // ensure default options
+  static lwmqtt_publish_options_t def_options = lwmqtt_default_publish_options;
+  if (options == NULL) {
+    options = &def_options;
+  }
+
+  // return immediately if the shared buffer still holds the packet that is being dispatched
+  if (lwmqtt_write_buffer_busy(client)) {
+    return LWMQTT_SHARED_BUFFER_BUSY;
+  }
+
+  // set command timer and start the round-trip time measurement
+  client->timer_set(client->command_timer, timeout);
+  lwmqtt_start_rtt(client);
+
+  // add packet id if at least qos 1
+  bool dup;
+  uint16_t packet_id = lwmqtt_get_publish_packet_id(client, options, msg.qos, &dup);
+  if (msg.qos != LWMQTT_QOS0 && packet_id == 0) {
+    return LWMQTT_PACKET_IDS_EXHAUSTED;
+  }
+
+  // reserve the longest remaining length the write buffer could ever require
+  int max_rem_len_len;
+  if (lwmqtt_varnum_length((uint32_t)client->write_buf_size, &max_rem_len_len) != LWMQTT_SUCCESS) {
+    max_rem_len_len = 4;
+  }
+
+  // calculate variable header length
+  size_t var_len = 2 + topic.len;
+  if (msg.qos > 0) {
+    var_len += 2;
+  }
+
+  // calculate payload offset
+  size_t offset = 1 + (size_t)max_rem_len_len + var_len;
+  if (offset > client->write_buf_size) {
+    lwmqtt_release_publish_packet_id(client, options, packet_id, dup);
+    return LWMQTT_BUFFER_TOO_SHORT;
+  }
+
+  // serialize payload after the reserved header
+  size_t payload_len = 0;
+  lwmqtt_err_t err = writer(ref, client->write_buf + offset, client->write_buf_size - offset, &payload_len);
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_publish_packet_id(client, options, packet_id, dup);
+    return err;
+  } else if (payload_len > client->write_buf_size - offset) {
+    lwmqtt_release_publish_packet_id(client, options, packet_id, dup);
+    return LWMQTT_BUFFER_TOO_SHORT;
+  }
+
+  // set payload
+  msg.payload = client->write_buf + offset;
+  msg.payload_len = payload_len;
+#if LWMQTT_ENABLE_PROGMEM
+  msg.flash = false;
+#endif
+
+  // get actual remaining length length
+  int rem_len_len;
+  err = lwmqtt_varnum_length((uint32_t)(var_len + payload_len), &rem_len_len);
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_publish_packet_id(client, options, packet_id, dup);
+    return LWMQTT_REMAINING_LENGTH_OVERFLOW;
+  }
+
+  // backfill header so that it ends right before the payload
+  size_t start = (size_t)(max_rem_len_len - rem_len_len);
+  size_t len = 0;
+  err = lwmqtt_encode_publish(client->write_buf + start, offset - start, &len, dup, packet_id, topic, msg);
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_publish_packet_id(client, options, packet_id, dup);
+    return err;
+  }
+
+  // send packet (with payload)
+  err = lwmqtt_send_packet(client, client->write_buf + start, len + payload_len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // wait for ack if required
+  err = lwmqtt_await_publish_ack(client, options, msg.qos, packet_id);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // sample round-trip time if the puback unambiguously belongs to this packet
+  if (msg.qos == LWMQTT_QOS1 && !dup && !options->skip_ack) {
+    lwmqtt_sample_rtt(client, client->command_timer, timeout);
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+#if LWMQTT_ENABLE_PIPELINE
+static lwmqtt_err_t lwmqtt_flush_pipeline(lwmqtt_client_t *client, size_t *pos) {
+  // write buffered packets
+  if (*pos > 0) {
+    lwmqtt_err_t err = lwmqtt_write_to_network(client, client->write_buf, *pos);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+  }
+
+  // record every buffered packet, a publish whose payload is written separately ends with its header
+  size_t offset = 0;
+  while (offset < *pos) {
+    uint8_t *buf_ptr = client->write_buf + offset + 1;
+    uint32_t rem_len;
+    if (lwmqtt_read_varnum(&buf_ptr, client->write_buf + *pos, &rem_len) != LWMQTT_SUCCESS) {
+      break;
+    }
+    size_t length = (size_t)(buf_ptr - (client->write_buf + offset)) + rem_len;
+    if (length > *pos - offset) {
+      length = *pos - offset;
+    }
+    lwmqtt_record_sent(client, client->write_buf + offset, length);
+    offset += length;
+  }
+
+  // reset position
+  *pos = 0;
+
+  return LWMQTT_SUCCESS;
+}
+
+static lwmqtt_err_t lwmqtt_send_pipeline(lwmqtt_client_t *client, lwmqtt_connect_options_t *options,
+                                         lwmqtt_will_t *will, int sub_count, lwmqtt_string_t *topic_filters,
+                                         lwmqtt_qos_t *qos_levels, uint16_t sub_packet_id, int pub_count,
+                                         lwmqtt_string_t *topics, lwmqtt_message_t *msgs, uint16_t *pub_packet_ids) {
+  // encode connect packet
+  size_t pos = 0;
+  lwmqtt_err_t err = lwmqtt_encode_connect(client->write_buf, client->write_buf_size, &pos, options, will);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // encode subscribe packet, flush buffered packets if it does not fit
+  if (sub_count > 0) {
+    size_t len;
+    err = lwmqtt_encode_subscribe(client->write_buf + pos, client->write_buf_size - pos, &len, sub_packet_id,
+                                  sub_count, topic_filters, qos_levels);
+    if (err == LWMQTT_BUFFER_TOO_SHORT && pos > 0) {
+      err = lwmqtt_flush_pipeline(client, &pos);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+      err = lwmqtt_encode_subscribe(client->write_buf, client->write_buf_size, &len, sub_packet_id, sub_count,
+                                    topic_filters, qos_levels);
+    }
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+    pos += len;
+  }
+
+  // encode publish packets
+  for (int i = 0; i < pub_count; i++) {
+    // encode publish packet, flush buffered packets if it does not fit
+    size_t len;
+    err = lwmqtt_encode_publish(client->write_buf + pos, client->write_buf_size - pos, &len, false, pub_packet_ids[i],
+                                topics[i], msgs[i]);
+    if (err == LWMQTT_BUFFER_TOO_SHORT && pos > 0) {
+      err = lwmqtt_flush_pipeline(client, &pos);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+      err = lwmqtt_encode_publish(client->write_buf, client->write_buf_size, &len, false, pub_packet_ids[i],
+                                  topics[i], msgs[i]);
+    }
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+    pos += len;
+
+    // skip empty payloads
+    if (msgs[i].payload_len == 0) {
+      continue;
+    }
+
+    // append payload if it fits, otherwise write it directly after the buffered packets
+    if (msgs[i].payload_len <= client->write_buf_size - pos && !lwmqtt_payload_in_flash(msgs[i])) {
+      memcpy(client->write_buf + pos, msgs[i].payload, msgs[i].payload_len);
+      pos += msgs[i].payload_len;
+    } else {
+      err = lwmqtt_flush_pipeline(client, &pos);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+      err = lwmqtt_write_payload(client, msgs[i]);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+
+      // record size including payload
+      lwmqtt_track_write(client, len + msgs[i].payload_len);
+    }
+  }
+
+  // write remaining packets
+  err = lwmqtt_flush_pipeline(client, &pos);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // reset keep alive timer
+  lwmqtt_reset_keep_alive(client);
+
+  return LWMQTT_SUCCESS;
+}
+
+static lwmqtt_err_t lwmqtt_await_pipeline_acks(lwmqtt_client_t *client, int sub_count, uint16_t sub_packet_id,
+                                               int pub_count, lwmqtt_message_t *msgs, uint16_t *pub_packet_ids) {
+  // count awaited acks
+  int pending = sub_packet_id > 0 ? 1 : 0;
+  for (int i = 0; i < pub_count; i++) {
+    if (pub_packet_ids[i] > 0) {
+      pending++;
+    }
+  }
+
+  // wait for acks in any order, the broker may acknowledge subscriptions and publishes out of order
+  while (pending > 0) {
+    // read next packet
+    lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
+    lwmqtt_err_t err = lwmqtt_cycle_until(client, &packet_type, 0, LWMQTT_NO_PACKET);
+    if (err == LWMQTT_NETWORK_TIMEOUT) {
+      lwmqtt_backoff_rtt(client);
+      return err;
+    } else if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+
+    // match suback against the subscribe packet
+    if (packet_type == LWMQTT_SUBACK_PACKET && sub_packet_id > 0) {
+      int suback_count = 0;
+      lwmqtt_qos_t granted_qos[sub_count];
+      uint16_t packet_id;
+      err = lwmqtt_decode_suback(client->read_buf, client->read_buf_size, &packet_id, sub_count, &suback_count,
+                                 granted_qos);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+      if (packet_id == sub_packet_id) {
+        // check suback codes
+        for (int i = 0; i < suback_count; i++) {
+          if (granted_qos[i] == LWMQTT_QOS_FAILURE) {
+            return LWMQTT_FAILED_SUBSCRIPTION;
+          }
+        }
+
+        sub_packet_id = 0;
+        pending--;
+        continue;
+      }
+    }
+
+    // match publish acks against the publish packets still awaiting them
+    if (packet_type == LWMQTT_PUBACK_PACKET || packet_type == LWMQTT_PUBCOMP_PACKET) {
+      uint16_t packet_id;
+      err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, packet_type, &packet_id);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+      bool matched = false;
+      for (int i = 0; i < pub_count && !matched; i++) {
+        if (pub_packet_ids[i] == packet_id && lwmqtt_publish_ack_type(msgs[i].qos) == packet_type) {
+          pub_packet_ids[i] = 0;
+          pending--;
+          matched = true;
+        }
+      }
+      if (matched) {
+        continue;
+      }
+    }
+
+    // back off adaptive timeout and record the expiry of the first missing ack if the acks did not arrive in time
+    if (client->timer_get(client->command_timer) <= 0) {
+      lwmqtt_packet_type_t needle = LWMQTT_SUBACK_PACKET;
+      for (int i = pub_count - 1; i >= 0 && sub_packet_id == 0; i--) {
+        if (pub_packet_ids[i] > 0) {
+          needle = lwmqtt_publish_ack_type(msgs[i].qos);
+        }
+      }
+      lwmqtt_backoff_rtt(client);
+      lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, (uint8_t)needle, 0, 0, 0);
+      return LWMQTT_MISSING_OR_WRONG_PACKET;
+    }
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_connect_pipelined(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, lwmqtt_will_t *will,
+                                      int sub_count, lwmqtt_string_t *topic_filters, lwmqtt_qos_t *qos_levels,
+                                      int pub_count, lwmqtt_string_t *topics, lwmqtt_message_t *msgs,
+                                      uint32_t timeout) {
+  // ensure default options
+  static lwmqtt_connect_options_t def_options = lwmqtt_default_connect_options;
+  if (options == NULL) {
+    options = &def_options;
+  }
+
+  // return immediately if the shared buffer still holds the packet that is being dispatched
+  if (lwmqtt_write_buffer_busy(client)) {
+    return LWMQTT_SHARED_BUFFER_BUSY;
+  }
+
+  // prepare connection
+  lwmqtt_prepare_connect(client, options, timeout);
+
+  // save last packet id to roll back if the connection is not accepted
+  uint16_t last_packet_id = client->last_packet_id;
+
+  // allocate packet ids
+  bool exhausted = false;
+  uint16_t sub_packet_id = 0;
+  if (sub_count > 0) {
+    sub_packet_id = lwmqtt_get_next_packet_id(client);
+    exhausted = sub_packet_id == 0;
+  }
+  uint16_t pub_packet_ids[pub_count > 0 ? pub_count : 1];
+  for (int i = 0; i < pub_count; i++) {
+    pub_packet_ids[i] = 0;
+    if (msgs[i].qos != LWMQTT_QOS0) {
+      pub_packet_ids[i] = lwmqtt_get_next_packet_id(client);
+      exhausted = exhausted || pub_packet_ids[i] == 0;
+    }
+  }
+
+  // send all packets without waiting for the connack
+  lwmqtt_err_t err = LWMQTT_PACKET_IDS_EXHAUSTED;
+  if (!exhausted) {
+    err = lwmqtt_send_pipeline(client, options, will, sub_count, topic_filters, qos_levels, sub_packet_id, pub_count,
+                               topics, msgs, pub_packet_ids);
+  }
+
+  // wait for connack packet unless it is awaited separately
+  if (err == LWMQTT_SUCCESS && !options->skip_ack) {
+    err = lwmqtt_await_connack(client, options);
+  }
+
+  // release allocated packet ids and roll back last packet id on failure
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_packet_id(client, sub_packet_id);
+    for (int i = 0; i < pub_count; i++) {
+      lwmqtt_release_packet_id(client, pub_packet_ids[i]);
+    }
+    client->last_packet_id = last_packet_id;
+    return err;
+  }
+
+  // return immediately if the acknowledgements are awaited separately
+  if (options->skip_ack) {
+    client->connack_pending = true;
+    return LWMQTT_SUCCESS;
+  }
+
+  // sample round-trip time (later acks are delayed by the preceding packets)
+  lwmqtt_sample_rtt(client, client->command_timer, timeout);
+
+  // wait for suback packet and publish acks
+  return lwmqtt_await_pipeline_acks(client, sub_count, sub_packet_id, pub_count, msgs, pub_packet_ids);
+}
+#endif
+
+lwmqtt_err_t lwmqtt_finish_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, uint32_t timeout) {
+  // ensure default options
+  static lwmqtt_connect_options_t def_options = lwmqtt_default_connect_options;
+  if (options == NULL) {
+    options = &def_options;
+  }
+
   // set command timer
   client->timer_set(client->command_timer, timeout);
 
+  // wait for connack packet
+  client->connack_pending = false;
+  return lwmqtt_await_connack(client, options);
+}
+
+static lwmqtt_err_t lwmqtt_send_subscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter,
+                                          lwmqtt_qos_t *qos, uint32_t timeout) {
+  // return immediately if the shared buffer still holds the packet that is being dispatched
+  if (lwmqtt_write_buffer_busy(client)) {
+    return LWMQTT_SHARED_BUFFER_BUSY;
+  }
+
+  // set command timer and start the round-trip time measurement
+  client->timer_set(client->command_timer, timeout);
+  lwmqtt_start_rtt(client);
+
   // encode subscribe packet
   uint16_t expected_packet_id = lwmqtt_get_next_packet_id(client);
+  if (expected_packet_id == 0) {
+    return LWMQTT_PACKET_IDS_EXHAUSTED;
+  }
 
   size_t len;
   lwmqtt_err_t err = lwmqtt_encode_subscribe(client->write_buf, client->write_buf_size, &len, expected_packet_id, count,
                                              topic_filter, qos);
   if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_packet_id(client, expected_packet_id);
     return err;
   }
 
@@ -572,52 +1529,51 @@ lwmqtt_err_t lwmqtt_subscribe(lwmqtt_client_t *client, int count, lwmqtt_string_
   }
 
   // wait for suback packet
-  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
-  err = lwmqtt_cycle_until(client, &packet_type, 0, LWMQTT_SUBACK_PACKET);
+  err = lwmqtt_await_suback(client, count, expected_packet_id);
   if (err != LWMQTT_SUCCESS) {
     return err;
-  } else if (packet_type != LWMQTT_SUBACK_PACKET) {
-    return LWMQTT_MISSING_OR_WRONG_PACKET;
   }
 
-  // decode packet
-  int suback_count = 0;
-  lwmqtt_qos_t granted_qos[count];
-  uint16_t packet_id;
-  err = lwmqtt_decode_suback(client->read_buf, client->read_buf_size, &packet_id, count, &suback_count, granted_qos);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
-  }
-  if (packet_id != expected_packet_id) {
-    return LWMQTT_MISSING_OR_WRONG_PACKET;
-  }
-
-  // check suback codes
-  for (int i = 0; i < suback_count; i++) {
-    if (granted_qos[i] == LWMQTT_QOS_FAILURE) {
-      return LWMQTT_FAILED_SUBSCRIPTION;
-    }
-  }
+  // sample round-trip time
+  lwmqtt_sample_rtt(client, client->command_timer, timeout);
 
   return LWMQTT_SUCCESS;
 }
 
+#if LWMQTT_ENABLE_MULTI
+lwmqtt_err_t lwmqtt_subscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, lwmqtt_qos_t *qos,
+                              uint32_t timeout) {
+  return lwmqtt_send_subscribe(client, count, topic_filter, qos, timeout);
+}
+#endif
+
 lwmqtt_err_t lwmqtt_subscribe_one(lwmqtt_client_t *client, lwmqtt_string_t topic_filter, lwmqtt_qos_t qos,
                                   uint32_t timeout) {
-  return lwmqtt_subscribe(client, 1, &topic_filter, &qos, timeout);
+  return lwmqtt_send_subscribe(client, 1, &topic_filter, &qos, timeout);
 }
 
-lwmqtt_err_t lwmqtt_unsubscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, uint32_t timeout) {
-  // set command timer
+static lwmqtt_err_t lwmqtt_send_unsubscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter,
+                                            uint32_t timeout) {
+  // return immediately if the shared buffer still holds the packet that is being dispatched
+  if (lwmqtt_write_buffer_busy(client)) {
+    return LWMQTT_SHARED_BUFFER_BUSY;
+  }
+
+  // set command timer and start the round-trip time measurement
   client->timer_set(client->command_timer, timeout);
+  lwmqtt_start_rtt(client);
 
   // encode unsubscribe packet
   uint16_t expected_packet_id = lwmqtt_get_next_packet_id(client);
+  if (expected_packet_id == 0) {
+    return LWMQTT_PACKET_IDS_EXHAUSTED;
+  }
 
   size_t len;
   lwmqtt_err_t err = lwmqtt_encode_unsubscribe(client->write_buf, client->write_buf_size, &len, expected_packet_id,
                                                count, topic_filter);
   if (err != LWMQTT_SUCCESS) {
+    lwmqtt_release_packet_id(client, expected_packet_id);
     return err;
   }
 
@@ -646,26 +1602,35 @@ lwmqtt_err_t lwmqtt_unsubscribe(lwmqtt_client_t *client, int count, lwmqtt_strin
     return LWMQTT_MISSING_OR_WRONG_PACKET;
   }
 
+  // sample round-trip time
+  lwmqtt_sample_rtt(client, client->command_timer, timeout);
+
   return LWMQTT_SUCCESS;
 }
 
+#if LWMQTT_ENABLE_MULTI
+lwmqtt_err_t lwmqtt_unsubscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, uint32_t timeout) {
+  return lwmqtt_send_unsubscribe(client, count, topic_filter, timeout);
+}
+#endif
+
 lwmqtt_err_t lwmqtt_unsubscribe_one(lwmqtt_client_t *client, lwmqtt_string_t topic_filter, uint32_t timeout) {
-  return lwmqtt_unsubscribe(client, 1, &topic_filter, timeout);
+  return lwmqtt_send_unsubscribe(client, 1, &topic_filter, timeout);
 }
 
 lwmqtt_err_t lwmqtt_disconnect(lwmqtt_client_t *client, uint32_t timeout) {
   // set command timer
   client->timer_set(client->command_timer, timeout);
 
-  // encode disconnect packet
+  // encode disconnect packet into the scratch buffer
   size_t len;
-  lwmqtt_err_t err = lwmqtt_encode_zero(client->write_buf, client->write_buf_size, &len, LWMQTT_DISCONNECT_PACKET);
+  lwmqtt_err_t err = lwmqtt_encode_zero(client->ack_buf, sizeof(client->ack_buf), &len, LWMQTT_DISCONNECT_PACKET);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
   // send disconnected packet
-  err = lwmqtt_send_packet_in_buffer(client, len);
+  err = lwmqtt_send_packet(client, client->ack_buf, len);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
@@ -688,6 +1653,15 @@ lwmqtt_err_t lwmqtt_yield(lwmqtt_client_t *client, size_t available, uint32_t ti
 }
 
 lwmqtt_err_t lwmqtt_keep_alive(lwmqtt_client_t *client, uint32_t timeout) {
+  // wait for a connack that is awaited separately until the command timer of the connect expires
+  if (client->connack_pending) {
+    if (client->timer_get(client->command_timer) > 0) {
+      return LWMQTT_SUCCESS;
+    }
+    lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, LWMQTT_CONNACK_PACKET, 0, LWMQTT_NETWORK_TIMEOUT, 0);
+    return LWMQTT_NETWORK_TIMEOUT;
+  }
+
   // set command timer
   client->timer_set(client->command_timer, timeout);
 
@@ -705,24 +1679,65 @@ lwmqtt_err_t lwmqtt_keep_alive(lwmqtt_client_t *client, uint32_t timeout) {
 
   // fail immediately if a pong is already pending
   if (client->pong_pending) {
+    lwmqtt_trace(client, LWMQTT_TRACE_TIMEOUT, LWMQTT_PINGRESP_PACKET, 0, LWMQTT_PONG_TIMEOUT, 0);
     return LWMQTT_PONG_TIMEOUT;
   }
 
-  // encode pingreq packet
+  // encode pingreq packet into the scratch buffer
   size_t len;
-  lwmqtt_err_t err = lwmqtt_encode_zero(client->write_buf, client->write_buf_size, &len, LWMQTT_PINGREQ_PACKET);
+  lwmqtt_err_t err = lwmqtt_encode_zero(client->ack_buf, sizeof(client->ack_buf), &len, LWMQTT_PINGREQ_PACKET);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
   // send packet
-  err = lwmqtt_send_packet_in_buffer(client, len);
+  err = lwmqtt_send_packet(client, client->ack_buf, len);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
-  // set flag
+  // set flags and start the round-trip time measurement
   client->pong_pending = true;
+#if LWMQTT_ENABLE_RTT
+  client->rtt_ping = true;
+#endif
+  lwmqtt_start_rtt(client);
 
   return LWMQTT_SUCCESS;
 }
+
+uint32_t lwmqtt_next_deadline(lwmqtt_client_t *client) {
+  // a connack that is awaited separately is due when the command timer of the connect expires
+  uint32_t deadline = UINT32_MAX;
+  if (client->connack_pending) {
+    int32_t remaining_time = client->timer_get(client->command_timer);
+    deadline = remaining_time > 0 ? (uint32_t)remaining_time : 0;
+  }
+
+  // return if keep alive interval is zero
+  if (client->keep_alive_interval == 0) {
+    return deadline;
+  }
+
+  // the next ping or the pending pong is due when the keep alive timer expires
+  int32_t remaining_time = client->timer_get(client->keep_alive_timer);
+  if (remaining_time <= 0) {
+    return 0;
+  }
+
+  return (uint32_t)remaining_time < deadline ? (uint32_t)remaining_time : deadline;
+}
+
+#if LWMQTT_ENABLE_RTT
+uint32_t lwmqtt_adaptive_timeout(lwmqtt_client_t *client) {
+  // return zero if no round-trip time has been measured
+  if (client->rtt_smoothed == 0) {
+    return 0;
+  }
+
+  // calculate timeout from smoothed round-trip time and four times the variance
+  uint32_t timeout = (client->rtt_smoothed >> 3) + client->rtt_variance;
+
+  return timeout << client->rtt_backoff;
+}
+#endif
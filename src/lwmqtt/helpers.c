@@ -100,6 +100,11 @@ lwmqtt_err_t lwmqtt_read_string(uint8_t **buf, const uint8_t *buf_end, lwmqtt_st
   // set length
   str->len = len;
 
+#if LWMQTT_ENABLE_PROGMEM
+  // data is always read from the buffer
+  str->flash = false;
+#endif
+
   return LWMQTT_SUCCESS;
 }
 
@@ -110,6 +115,24 @@ lwmqtt_err_t lwmqtt_write_string(uint8_t **buf, const uint8_t *buf_end, lwmqtt_s
     return err;
   }
 
+#if LWMQTT_ENABLE_PROGMEM
+  // copy data from program memory
+  if (str.flash) {
+    // check buffer size
+    if ((size_t)(buf_end - (*buf)) < str.len) {
+      return LWMQTT_BUFFER_TOO_SHORT;
+    }
+
+    // write data
+    memcpy_P(*buf, str.data, str.len);
+
+    // advance pointer
+    *buf += str.len;
+
+    return LWMQTT_SUCCESS;
+  }
+#endif
+
   // write data
   err = lwmqtt_write_data(buf, buf_end, (uint8_t *)str.data, str.len);
   if (err != LWMQTT_SUCCESS) {
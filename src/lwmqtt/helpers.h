@@ -3,6 +3,14 @@
 
 #include "lwmqtt.h"
 
+#if LWMQTT_ENABLE_PROGMEM
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#else
+#include <pgmspace.h>
+#endif
+#endif
+
 /**
  * Reads bits from a byte.
  *
@@ -0,0 +1,368 @@
+#if defined(__linux__) && !defined(ARDUINO) && !defined(ESP_PLATFORM)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "linux.h"
+
+// tags the epoll data of keep alive timers, connections are at least 4-byte aligned
+#define LWMQTT_LINUX_TIMER_TAG ((uintptr_t)1)
+
+// the maximum number of events handled per loop run
+#define LWMQTT_LINUX_MAX_EVENTS 64
+
+lwmqtt_err_t lwmqtt_linux_timer_init(lwmqtt_linux_timer_t *timer) {
+  // create timer
+  timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer->fd < 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+void lwmqtt_linux_timer_close(lwmqtt_linux_timer_t *timer) {
+  // close timer
+  if (timer->fd >= 0) {
+    close(timer->fd);
+    timer->fd = -1;
+  }
+}
+
+void lwmqtt_linux_timer_set(void *ref, uint32_t timeout) {
+  // cast timer reference
+  lwmqtt_linux_timer_t *t = (lwmqtt_linux_timer_t *)ref;
+
+  // arm or disarm one-shot timer
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = timeout / 1000;
+  spec.it_value.tv_nsec = (long)(timeout % 1000) * 1000000;
+  timerfd_settime(t->fd, 0, &spec, NULL);
+}
+
+int32_t lwmqtt_linux_timer_get(void *ref) {
+  // cast timer reference
+  lwmqtt_linux_timer_t *t = (lwmqtt_linux_timer_t *)ref;
+
+  // get remaining time, expired and disarmed timers report zero
+  struct itimerspec spec;
+  if (timerfd_gettime(t->fd, &spec) < 0) {
+    return 0;
+  }
+
+  // round up to not expire early
+  return (int32_t)(spec.it_value.tv_sec * 1000 + (spec.it_value.tv_nsec + 999999) / 1000000);
+}
+
+static lwmqtt_err_t lwmqtt_linux_wait(int fd, short events, uint32_t timeout) {
+  // wait for the event
+  struct pollfd pfd = {fd, events, 0};
+  int rc = poll(&pfd, 1, (int)timeout);
+  if (rc == 0) {
+    return LWMQTT_NETWORK_TIMEOUT;
+  } else if (rc < 0 && errno != EINTR) {
+    return events == POLLIN ? LWMQTT_NETWORK_FAILED_READ : LWMQTT_NETWORK_FAILED_WRITE;
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_linux_network_connect(lwmqtt_linux_network_t *network, const char *host, int port,
+                                          uint32_t timeout) {
+  // close any open socket
+  lwmqtt_linux_network_disconnect(network);
+
+  // resolve address
+  char service[8];
+  snprintf(service, sizeof(service), "%d", port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *res = NULL;
+  if (getaddrinfo(host, service, &hints, &res) != 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // create socket
+  network->fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (network->fd < 0) {
+    freeaddrinfo(res);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // start connection
+  int rc = connect(network->fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rc < 0 && errno != EINPROGRESS) {
+    lwmqtt_linux_network_disconnect(network);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // wait until the connection is established
+  lwmqtt_err_t err = lwmqtt_linux_wait(network->fd, POLLOUT, timeout);
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_linux_network_disconnect(network);
+    return err == LWMQTT_NETWORK_TIMEOUT ? err : LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // check connection result
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(network->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+    lwmqtt_linux_network_disconnect(network);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // disable nagle's algorithm as packets are written in one piece
+  int one = 1;
+  setsockopt(network->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  return LWMQTT_SUCCESS;
+}
+
+void lwmqtt_linux_network_disconnect(lwmqtt_linux_network_t *network) {
+  // close socket
+  if (network->fd >= 0) {
+    close(network->fd);
+    network->fd = -1;
+  }
+}
+
+lwmqtt_err_t lwmqtt_linux_network_peek(lwmqtt_linux_network_t *network, size_t *available) {
+  // get available bytes
+  int bytes = 0;
+  if (ioctl(network->fd, FIONREAD, &bytes) < 0) {
+    return LWMQTT_NETWORK_FAILED_READ;
+  }
+
+  // set counter
+  *available = (size_t)bytes;
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_linux_network_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout) {
+  // cast network reference
+  lwmqtt_linux_network_t *n = (lwmqtt_linux_network_t *)ref;
+
+  for (;;) {
+    // read available data
+    ssize_t rc = recv(n->fd, buf, len, 0);
+    if (rc > 0) {
+      *read = (size_t)rc;
+      return LWMQTT_SUCCESS;
+    } else if (rc == 0 || (errno != EAGAIN && errno != EINTR)) {
+      return LWMQTT_NETWORK_FAILED_READ;
+    }
+
+    // wait for data
+    lwmqtt_err_t err = lwmqtt_linux_wait(n->fd, POLLIN, timeout);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+  }
+}
+
+lwmqtt_err_t lwmqtt_linux_network_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout) {
+  // cast network reference
+  lwmqtt_linux_network_t *n = (lwmqtt_linux_network_t *)ref;
+
+  for (;;) {
+    // write as much as the send buffer accepts
+    ssize_t rc = send(n->fd, buf, len, MSG_NOSIGNAL);
+    if (rc >= 0) {
+      *sent = (size_t)rc;
+      return LWMQTT_SUCCESS;
+    } else if (errno != EAGAIN && errno != EINTR) {
+      return LWMQTT_NETWORK_FAILED_WRITE;
+    }
+
+    // wait for space
+    lwmqtt_err_t err = lwmqtt_linux_wait(n->fd, POLLOUT, timeout);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+  }
+}
+
+lwmqtt_err_t lwmqtt_linux_loop_init(lwmqtt_linux_loop_t *loop) {
+  // create epoll instance
+  loop->fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->fd < 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+void lwmqtt_linux_loop_close(lwmqtt_linux_loop_t *loop) {
+  // close epoll instance
+  if (loop->fd >= 0) {
+    close(loop->fd);
+    loop->fd = -1;
+  }
+}
+
+lwmqtt_err_t lwmqtt_linux_connection_init(lwmqtt_linux_connection_t *conn, lwmqtt_client_t *client,
+                                          uint32_t timeout) {
+  // prepare object
+  memset(conn, 0, sizeof(lwmqtt_linux_connection_t));
+  conn->client = client;
+  conn->network.fd = -1;
+  conn->keep_alive_timer.fd = -1;
+  conn->command_timer.fd = -1;
+  conn->timeout = timeout;
+
+  // create timers
+  lwmqtt_err_t err = lwmqtt_linux_timer_init(&conn->keep_alive_timer);
+  if (err == LWMQTT_SUCCESS) {
+    err = lwmqtt_linux_timer_init(&conn->command_timer);
+  }
+  if (err != LWMQTT_SUCCESS) {
+    lwmqtt_linux_connection_close(conn);
+    return err;
+  }
+
+  // configure client
+  lwmqtt_set_network(client, &conn->network, lwmqtt_linux_network_read, lwmqtt_linux_network_write);
+  lwmqtt_set_timers(client, &conn->keep_alive_timer, &conn->command_timer, lwmqtt_linux_timer_set,
+                    lwmqtt_linux_timer_get);
+
+  return LWMQTT_SUCCESS;
+}
+
+void lwmqtt_linux_connection_close(lwmqtt_linux_connection_t *conn) {
+  // detach and close descriptors
+  lwmqtt_linux_detach(conn);
+  lwmqtt_linux_network_disconnect(&conn->network);
+  lwmqtt_linux_timer_close(&conn->keep_alive_timer);
+  lwmqtt_linux_timer_close(&conn->command_timer);
+}
+
+lwmqtt_err_t lwmqtt_linux_attach(lwmqtt_linux_loop_t *loop, lwmqtt_linux_connection_t *conn,
+                                 lwmqtt_linux_error_t error, void *ref) {
+  // set callback
+  conn->error = error;
+  conn->ref = ref;
+
+  // register socket
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u64 = (uintptr_t)conn;
+  if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, conn->network.fd, &ev) < 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // register keep alive timer
+  ev.events = EPOLLIN;
+  ev.data.u64 = (uintptr_t)conn | LWMQTT_LINUX_TIMER_TAG;
+  if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, conn->keep_alive_timer.fd, &ev) < 0) {
+    epoll_ctl(loop->fd, EPOLL_CTL_DEL, conn->network.fd, NULL);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // set loop
+  conn->loop = loop;
+
+  return LWMQTT_SUCCESS;
+}
+
+void lwmqtt_linux_detach(lwmqtt_linux_connection_t *conn) {
+  // check loop
+  if (conn->loop == NULL) {
+    return;
+  }
+
+  // remove descriptors
+  epoll_ctl(conn->loop->fd, EPOLL_CTL_DEL, conn->network.fd, NULL);
+  epoll_ctl(conn->loop->fd, EPOLL_CTL_DEL, conn->keep_alive_timer.fd, NULL);
+  conn->loop = NULL;
+}
+
+static lwmqtt_err_t lwmqtt_linux_service(lwmqtt_linux_connection_t *conn, bool timer, uint32_t events) {
+  // send a ping if the keep alive timer fired
+  if (timer) {
+    // consume expiration, the timer is armed again when the ping has been sent
+    uint64_t expirations;
+    if (read(conn->keep_alive_timer.fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+      return LWMQTT_NETWORK_FAILED_READ;
+    }
+
+    return lwmqtt_keep_alive(conn->client, conn->timeout);
+  }
+
+  // get available bytes
+  size_t available = 0;
+  lwmqtt_err_t err = lwmqtt_linux_network_peek(&conn->network, &available);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // a readable socket without data has been closed by the peer
+  if (available == 0) {
+    return (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0 ? LWMQTT_NETWORK_FAILED_READ : LWMQTT_SUCCESS;
+  }
+
+  // process the packets that are already in flight
+  return lwmqtt_yield(conn->client, available, conn->timeout);
+}
+
+lwmqtt_err_t lwmqtt_linux_loop_run(lwmqtt_linux_loop_t *loop, int timeout, int *serviced) {
+  // wait for events
+  struct epoll_event events[LWMQTT_LINUX_MAX_EVENTS];
+  int n = epoll_wait(loop->fd, events, LWMQTT_LINUX_MAX_EVENTS, timeout);
+  if (n < 0) {
+    if (serviced != NULL) {
+      *serviced = 0;
+    }
+    return errno == EINTR ? LWMQTT_SUCCESS : LWMQTT_NETWORK_FAILED_READ;
+  }
+
+  // handle events
+  for (int i = 0; i < n; i++) {
+    // get connection and source
+    bool timer = (events[i].data.u64 & LWMQTT_LINUX_TIMER_TAG) != 0;
+    lwmqtt_linux_connection_t *conn =
+        (lwmqtt_linux_connection_t *)(uintptr_t)(events[i].data.u64 & ~(uint64_t)LWMQTT_LINUX_TIMER_TAG);
+
+    // skip connections that have been detached by an earlier event of this batch
+    if (conn->loop != loop) {
+      continue;
+    }
+
+    // service client and report failures
+    lwmqtt_err_t err = lwmqtt_linux_service(conn, timer, events[i].events);
+    if (err != LWMQTT_SUCCESS) {
+      lwmqtt_linux_detach(conn);
+      if (conn->error != NULL) {
+        conn->error(conn, err);
+      }
+    }
+  }
+
+  // set counter
+  if (serviced != NULL) {
+    *serviced = n;
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef LWMQTT_LINUX_H
+#define LWMQTT_LINUX_H
+
+#if defined(__linux__) && !defined(ARDUINO) && !defined(ESP_PLATFORM)
+
+#include "lwmqtt.h"
+
+/**
+ * The timer object backed by a timerfd.
+ */
+typedef struct {
+  int fd;
+} lwmqtt_linux_timer_t;
+
+/**
+ * The network object backed by a non-blocking socket.
+ */
+typedef struct {
+  int fd;
+} lwmqtt_linux_network_t;
+
+/**
+ * The event loop object backed by an epoll instance.
+ */
+typedef struct {
+  int fd;
+} lwmqtt_linux_loop_t;
+
+/**
+ * Forward declaration of the connection object.
+ */
+typedef struct lwmqtt_linux_connection_t lwmqtt_linux_connection_t;
+
+/**
+ * The callback used to report connections that failed while being serviced by the event loop. The connection has
+ * already been detached from the loop when the callback is called, but its memory must remain valid until
+ * lwmqtt_linux_loop_run() returns.
+ *
+ * @param conn The connection.
+ * @param err The error returned by the client or the network.
+ */
+typedef void (*lwmqtt_linux_error_t)(lwmqtt_linux_connection_t *conn, lwmqtt_err_t err);
+
+/**
+ * The connection object that binds a client to its network and timers.
+ */
+struct lwmqtt_linux_connection_t {
+  lwmqtt_client_t *client;
+  lwmqtt_linux_network_t network;
+  lwmqtt_linux_timer_t keep_alive_timer;
+  lwmqtt_linux_timer_t command_timer;
+  uint32_t timeout;
+  lwmqtt_linux_error_t error;
+  void *ref;
+  lwmqtt_linux_loop_t *loop;
+};
+
+/**
+ * Will create the timerfd of the specified timer.
+ *
+ * @param timer The timer object.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_timer_init(lwmqtt_linux_timer_t *timer);
+
+/**
+ * Will close the timerfd of the specified timer.
+ *
+ * @param timer The timer object.
+ */
+void lwmqtt_linux_timer_close(lwmqtt_linux_timer_t *timer);
+
+/**
+ * Callback to arm the timer object. A timeout of zero disarms the timer, which then counts as expired. Arming the timer
+ * also resets a pending expiration.
+ *
+ * @param ref A pointer to the timer object.
+ * @param timeout The timeout in milliseconds.
+ */
+void lwmqtt_linux_timer_set(void *ref, uint32_t timeout);
+
+/**
+ * Callback to read the timer object.
+ *
+ * @param ref A pointer to the timer object.
+ * @return The remaining milliseconds, rounded up, or zero if the timer expired.
+ */
+int32_t lwmqtt_linux_timer_get(void *ref);
+
+/**
+ * Will resolve the host and establish a non-blocking TCP connection with Nagle's algorithm disabled.
+ *
+ * @param network The network object.
+ * @param host The host name or address.
+ * @param port The port.
+ * @param timeout The timeout in milliseconds.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_network_connect(lwmqtt_linux_network_t *network, const char *host, int port,
+                                          uint32_t timeout);
+
+/**
+ * Will close the socket of the network object.
+ *
+ * @param network The network object.
+ */
+void lwmqtt_linux_network_disconnect(lwmqtt_linux_network_t *network);
+
+/**
+ * Will return the amount of bytes available to read without waiting.
+ *
+ * @param network The network object.
+ * @param available Variable that will be set with the amount of available bytes.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_network_peek(lwmqtt_linux_network_t *network, size_t *available);
+
+/**
+ * Callback to read from the network object. Waits on the socket only if no data is available, which happens while a
+ * command awaits its acknowledgement.
+ *
+ * @see lwmqtt_network_read_t.
+ */
+lwmqtt_err_t lwmqtt_linux_network_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout);
+
+/**
+ * Callback to write to the network object. Waits on the socket only if its send buffer is full.
+ *
+ * @see lwmqtt_network_write_t.
+ */
+lwmqtt_err_t lwmqtt_linux_network_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout);
+
+/**
+ * Will create the epoll instance of the specified loop.
+ *
+ * @param loop The loop object.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_loop_init(lwmqtt_linux_loop_t *loop);
+
+/**
+ * Will close the epoll instance of the specified loop.
+ *
+ * @param loop The loop object.
+ */
+void lwmqtt_linux_loop_close(lwmqtt_linux_loop_t *loop);
+
+/**
+ * Will prepare the connection object for the specified client. The timers are created and the network and timer
+ * functions of the client are configured. The client must already be initialized.
+ *
+ * @param conn The connection object.
+ * @param client The client object.
+ * @param timeout The command timeout used when servicing the client.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_connection_init(lwmqtt_linux_connection_t *conn, lwmqtt_client_t *client,
+                                          uint32_t timeout);
+
+/**
+ * Will detach the connection, close its socket and timers.
+ *
+ * @param conn The connection object.
+ */
+void lwmqtt_linux_connection_close(lwmqtt_linux_connection_t *conn);
+
+/**
+ * Will register the socket and the keep alive timer of a connected client with the loop. Afterwards, the loop calls
+ * lwmqtt_yield() with the available bytes once the socket becomes readable and lwmqtt_keep_alive() once the keep
+ * alive timer fires. Commands like lwmqtt_publish() may still be issued directly on the client from the loop thread.
+ *
+ * @param loop The loop object.
+ * @param conn The connection object.
+ * @param error The optional callback called if servicing the client fails.
+ * @param ref A custom reference for the callback.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_attach(lwmqtt_linux_loop_t *loop, lwmqtt_linux_connection_t *conn,
+                                 lwmqtt_linux_error_t error, void *ref);
+
+/**
+ * Will remove the socket and the keep alive timer of a connection from its loop.
+ *
+ * @param conn The connection object.
+ */
+void lwmqtt_linux_detach(lwmqtt_linux_connection_t *conn);
+
+/**
+ * Will wait for readable sockets and fired timers and service the affected clients. The call does not return before
+ * an event occurred or the timeout has been reached, so idle connections do not consume any CPU.
+ *
+ * @param loop The loop object.
+ * @param timeout The timeout in milliseconds or -1 to wait indefinitely.
+ * @param serviced Variable that will be set with the amount of handled events, may be NULL.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_linux_loop_run(lwmqtt_linux_loop_t *loop, int timeout, int *serviced);
+
+#endif
+
+#endif  // LWMQTT_LINUX_H
@@ -5,12 +5,17 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "lwmqtt_config.h"
+
 /**
  * The error type used by all exposed APIs.
  *
  * If a function returns an error that operates on a connected client (e.g publish, keep_alive, etc.) the caller should
  * switch into a disconnected state, close and cleanup the current connection and start over by creating a new
- * connection.
+ * connection. Exceptions are LWMQTT_OUTBOUND_QUEUE_FULL and LWMQTT_RATE_LIMITED, which are returned by wrappers that
+ * queue or limit outgoing data before anything has been written, LWMQTT_SHARED_BUFFER_BUSY, which is returned by
+ * commands issued from the message callback of a client with a shared buffer, and LWMQTT_BUFFER_POOL_EXHAUSTED, which
+ * is returned by wrappers that could not borrow a buffer from a shared pool. These may be retried later.
  */
 typedef enum {
   LWMQTT_SUCCESS = 0,
@@ -27,6 +32,11 @@ typedef enum {
   LWMQTT_FAILED_SUBSCRIPTION = -11,
   LWMQTT_SUBACK_ARRAY_OVERFLOW = -12,
   LWMQTT_PONG_TIMEOUT = -13,
+  LWMQTT_OUTBOUND_QUEUE_FULL = -14,
+  LWMQTT_RATE_LIMITED = -15,
+  LWMQTT_PACKET_IDS_EXHAUSTED = -16,
+  LWMQTT_SHARED_BUFFER_BUSY = -17,
+  LWMQTT_BUFFER_POOL_EXHAUSTED = -18,
 } lwmqtt_err_t;
 
 /**
@@ -35,13 +45,21 @@ typedef enum {
 typedef struct {
   uint16_t len;
   char *data;
+#if LWMQTT_ENABLE_PROGMEM
+  bool flash;
+#endif
 } lwmqtt_string_t;
 
 /**
  * The default initializer for string objects.
  */
+#if LWMQTT_ENABLE_PROGMEM
+#define lwmqtt_default_string \
+  { 0, NULL, false }
+#else
 #define lwmqtt_default_string \
   { 0, NULL }
+#endif
 
 /**
  * Returns a string object for the passed C string.
@@ -51,6 +69,15 @@ typedef struct {
  */
 lwmqtt_string_t lwmqtt_string(const char *str);
 
+/**
+ * Returns a string object for the passed C string stored in program memory (PROGMEM). The data is read from program
+ * memory whenever the string is encoded. Equals lwmqtt_string() if LWMQTT_ENABLE_PROGMEM is disabled.
+ *
+ * @param str The C string in program memory.
+ * @return A string object.
+ */
+lwmqtt_string_t lwmqtt_flash_string(const char *str);
+
 /**
  * Compares a string object to a C string.
  *
@@ -60,6 +87,16 @@ lwmqtt_string_t lwmqtt_string(const char *str);
  */
 int lwmqtt_strcmp(lwmqtt_string_t a, const char *b);
 
+/**
+ * Checks whether a topic matches a topic filter that may contain single level (+) and multi level (#) wildcards.
+ * Topics starting with a "$" are not matched by a wildcard at the first level.
+ *
+ * @param filter The topic filter.
+ * @param topic The topic.
+ * @return Whether the topic matches the filter.
+ */
+bool lwmqtt_topic_match(lwmqtt_string_t filter, lwmqtt_string_t topic);
+
 /**
  * The available QOS levels.
  */
@@ -71,20 +108,29 @@ typedef enum {
 } lwmqtt_qos_t;
 
 /**
- * The common message object.
+ * The common message object. If LWMQTT_ENABLE_PROGMEM is enabled, the payload of a published message may be stored in
+ * program memory, which is indicated by the flash flag.
  */
 typedef struct {
   lwmqtt_qos_t qos;
   bool retained;
   uint8_t *payload;
   size_t payload_len;
+#if LWMQTT_ENABLE_PROGMEM
+  bool flash;
+#endif
 } lwmqtt_message_t;
 
 /**
  * The default initializer for message objects.
  */
+#if LWMQTT_ENABLE_PROGMEM
+#define lwmqtt_default_message \
+  { LWMQTT_QOS0, false, NULL, 0, false }
+#else
 #define lwmqtt_default_message \
   { LWMQTT_QOS0, false, NULL, 0 }
+#endif
 
 /**
  * The object defining the last will of a client.
@@ -126,13 +172,17 @@ typedef struct {
   lwmqtt_string_t password;
   lwmqtt_return_code_t return_code;
   bool session_present;
+  bool skip_ack;
 } lwmqtt_connect_options_t;
 
 /**
  * The default initializer for the connect options objects.
  */
-#define lwmqtt_default_connect_options \
-  { lwmqtt_default_string, 60, true, lwmqtt_default_string, lwmqtt_default_string, LWMQTT_UNKNOWN_RETURN_CODE, false }
+#define lwmqtt_default_connect_options                                                                         \
+  {                                                                                                            \
+    lwmqtt_default_string, 60, true, lwmqtt_default_string, lwmqtt_default_string, LWMQTT_UNKNOWN_RETURN_CODE, \
+        false, false                                                                                           \
+  }
 
 /**
  * The object containing the publish options.
@@ -181,6 +231,20 @@ typedef lwmqtt_err_t (*lwmqtt_network_read_t)(void *ref, uint8_t *buf, size_t le
  */
 typedef lwmqtt_err_t (*lwmqtt_network_write_t)(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout);
 
+/**
+ * The callback used to serialize a payload directly into the write buffer.
+ *
+ * The callback is expected to write up to the amount of bytes into the passed buffer. It may return an error to abort
+ * the publish, e.g. LWMQTT_BUFFER_TOO_SHORT if the payload does not fit.
+ *
+ * @param ref A custom reference.
+ * @param buf The buffer.
+ * @param len The length of the buffer.
+ * @param written Variable that must be set with the amount of written bytes.
+ * @return An error value.
+ */
+typedef lwmqtt_err_t (*lwmqtt_payload_writer_t)(void *ref, uint8_t *buf, size_t len, size_t *written);
+
 /**
  * The callback used to set a timer.
  *
@@ -213,13 +277,64 @@ typedef int32_t (*lwmqtt_timer_get_t)(void *ref);
  */
 typedef void (*lwmqtt_callback_t)(lwmqtt_client_t *client, void *ref, lwmqtt_string_t str, lwmqtt_message_t msg);
 
+/**
+ * The callback used to size the read buffer for an incoming packet. It is called with the total size of every packet
+ * once its fixed header has been read and may replace the read buffer with a larger one (keeping the already read
+ * bytes) by updating the read_buf and read_buf_size fields of the client.
+ *
+ * @param client The client object.
+ * @param ref A custom reference.
+ * @param size The total size of the packet.
+ * @return Whether the packet fits into the read buffer.
+ */
+typedef bool (*lwmqtt_read_hook_t)(lwmqtt_client_t *client, void *ref, size_t size);
+
+/**
+ * The protocol event types recorded by the trace.
+ */
+typedef enum {
+  LWMQTT_TRACE_PACKET_SENT = 1,
+  LWMQTT_TRACE_PACKET_RECEIVED = 2,
+  LWMQTT_TRACE_NETWORK_READ = 3,
+  LWMQTT_TRACE_NETWORK_WRITE = 4,
+  LWMQTT_TRACE_TIMEOUT = 5,
+  LWMQTT_TRACE_ERROR = 6,
+} lwmqtt_trace_type_t;
+
+/**
+ * A recorded protocol event.
+ *
+ * - Packet events set the packet type, the packet id (if any) and the size of the packet in bytes as the value. The
+ *   size of a sent publish packet does not include a payload that is written separately from the header.
+ * - Network events set the number of bytes read or written as the value and the duration of the call.
+ * - Timeout events set the awaited packet type (if any).
+ * - Error events set the packet type that was handled (if any) and the error as the value.
+ */
+typedef struct {
+  uint32_t time;
+  int32_t value;
+  uint16_t packet_id;
+  uint16_t duration;
+  uint8_t type;
+  uint8_t packet;
+} lwmqtt_trace_event_t;
+
+/**
+ * The callback used to get the current time in milliseconds for trace events.
+ */
+typedef uint32_t (*lwmqtt_trace_clock_t)(void);
+
 /**
  * The client object.
  */
 struct lwmqtt_client_t {
   uint16_t last_packet_id;
+#if LWMQTT_PACKET_ID_WINDOW > 0
+  uint8_t packet_ids[LWMQTT_PACKET_ID_WINDOW / 8];
+#endif
   uint32_t keep_alive_interval;
   bool pong_pending;
+  bool connack_pending;
 
   size_t write_buf_size, read_buf_size;
   uint8_t *write_buf, *read_buf;
@@ -238,11 +353,39 @@ struct lwmqtt_client_t {
 
   bool drop_overflow;
   uint32_t *overflow_counter;
+
+  bool ack_before_dispatch;
+  bool dispatching;
+  uint8_t ack_buf[4];
+
+  lwmqtt_read_hook_t read_hook;
+  void *read_hook_ref;
+#if LWMQTT_ENABLE_PEAKS
+  size_t read_peak, write_peak;
+#endif
+
+#if LWMQTT_ENABLE_RTT
+  uint32_t rtt_smoothed, rtt_variance;
+  uint8_t rtt_backoff;
+  bool rtt_ping;
+  bool rtt_dispatched;
+#endif
+
+#if LWMQTT_ENABLE_TRACE
+  lwmqtt_trace_event_t *trace_events;
+  size_t trace_size;
+  uint32_t trace_count;
+  lwmqtt_trace_clock_t trace_clock;
+#endif
 };
 
 /**
  * Will initialize the specified client object.
  *
+ * The write and read buffer may be the same buffer to save memory. Acknowledgements, pings and disconnects are then
+ * encoded into a small scratch area of the client object, and commands issued from within the message callback fail
+ * with LWMQTT_SHARED_BUFFER_BUSY as they would overwrite the packet that is being dispatched.
+ *
  * @param client The client object.
  * @param write_buf The write buffer.
  * @param write_buf_size The write buffer size.
@@ -293,6 +436,29 @@ void lwmqtt_set_callback(lwmqtt_client_t *client, void *ref, lwmqtt_callback_t c
  */
 void lwmqtt_drop_overflow(lwmqtt_client_t *client, bool enabled, uint32_t *counter);
 
+/**
+ * Will configure the client to acknowledge incoming QoS 1 messages before the callback is called, so that the time
+ * spent in the callback does not delay the acknowledgement. The message is then lost if the device fails while
+ * handling it. QoS 2 messages are always acknowledged after the callback.
+ *
+ * @param client The client.
+ * @param enabled Whether acknowledging before the callback is enabled.
+ */
+void lwmqtt_ack_before_dispatch(lwmqtt_client_t *client, bool enabled);
+
+/**
+ * Will set the hook that is called with the size of every incoming packet before it is read, e.g. to grow the read
+ * buffer on demand. Packets that do not fit are handled as configured by lwmqtt_drop_overflow().
+ *
+ * If LWMQTT_ENABLE_PEAKS is set, the client also records the size of the largest incoming and outgoing packet in the
+ * read_peak and write_peak fields, including incoming packets that have been dropped.
+ *
+ * @param client The client.
+ * @param ref The custom reference.
+ * @param hook The hook, or NULL to disable it.
+ */
+void lwmqtt_set_read_hook(lwmqtt_client_t *client, void *ref, lwmqtt_read_hook_t hook);
+
 /**
  * Will send a connect packet and wait for a connack response. If options are provided they are used for the
  * connection attempt and the return code and whether a session was present is stored in it.
@@ -300,6 +466,9 @@ void lwmqtt_drop_overflow(lwmqtt_client_t *client, bool enabled, uint32_t *count
  * The network object must already be connected to the server. An error is returned if the broker rejects the
  * connection.
  *
+ * If skip_ack is set in the options, the call returns once the connect packet has been written. Event loops may then
+ * call lwmqtt_finish_connect() when the socket becomes readable instead of waiting for the connack.
+ *
  * @param client The client object.
  * @param options The optional connect options.
  * @param will The will object.
@@ -309,10 +478,63 @@ void lwmqtt_drop_overflow(lwmqtt_client_t *client, bool enabled, uint32_t *count
 lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, lwmqtt_will_t *will,
                             uint32_t timeout);
 
+/**
+ * Will send a connect packet immediately followed by a subscribe packet for the specified topic filters and a publish
+ * packet for each specified message without waiting for the connack response. The packets are written to the network
+ * in as few writes as the write buffer allows. Afterwards, the connack is awaited, followed by the suback and publish
+ * acks in any order. The acks are matched to the packets by their packet ids.
+ *
+ * If the broker does not accept the connection, the allocated packet ids are rolled back and the return code is stored
+ * in the options. As in lwmqtt_connect(), the return code is LWMQTT_CONNECTION_ACCEPTED once the connection has been
+ * accepted, even if a later acknowledgement fails.
+ *
+ * If skip_ack is set in the options, the call returns once all packets have been written. The connack must then be
+ * awaited using lwmqtt_finish_connect(), the remaining acknowledgements release their packet ids as they arrive.
+ *
+ * Note: The message callback might be called with incoming messages as part of this call.
+ *
+ * @param client The client object.
+ * @param options The optional connect options.
+ * @param will The will object.
+ * @param sub_count The number of topic filters and QOS levels.
+ * @param topic_filters The list of topic filters.
+ * @param qos_levels The list of QOS levels.
+ * @param pub_count The number of topics and messages.
+ * @param topics The list of topics.
+ * @param msgs The list of messages.
+ * @param timeout The command timeout.
+ * @return An error value.
+ */
+#if LWMQTT_ENABLE_PIPELINE
+lwmqtt_err_t lwmqtt_connect_pipelined(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, lwmqtt_will_t *will,
+                                      int sub_count, lwmqtt_string_t *topic_filters, lwmqtt_qos_t *qos_levels,
+                                      int pub_count, lwmqtt_string_t *topics, lwmqtt_message_t *msgs,
+                                      uint32_t timeout);
+#endif
+
+/**
+ * Will wait for the connack response of a connect packet that has been sent with skip_ack set in the options. The
+ * return code and whether a session was present is stored in the options.
+ *
+ * The connack must be the next incoming packet, so the function should be called before lwmqtt_yield() once the
+ * network has data available. If lwmqtt_yield() reads the connack first, it completes the connect itself and returns
+ * LWMQTT_CONNECTION_DENIED if the broker rejected the connection. The connack_pending field of the client is cleared in
+ * both cases, and this function must not be called once it is cleared.
+ *
+ * @param client The client object.
+ * @param options The optional connect options.
+ * @param timeout The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_finish_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *options, uint32_t timeout);
+
 /**
  * Will send a publish packet and wait for all acks to complete. If the encoded packet (without payload) is bigger than
  * the write buffer the function will return LWMQTT_BUFFER_TOO_SHORT without attempting to send the packet.
  *
+ * The payload is written directly after the header. A payload in program memory (msg.flash) is copied through the
+ * write buffer in chunks of its size instead, so it is not limited by the write buffer either.
+ *
  * If options.dup_id is present and zero, the client will store the used packet id at the specified location (QoS >= 1).
  * If options.dup_id is present and non-zero, the client will use the specified number as the packet id and flag the
  * message as a duplicate (QoS >= 1).
@@ -329,6 +551,29 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_connect_options_t *o
 lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_publish_options_t *options, lwmqtt_string_t topic,
                             lwmqtt_message_t msg, uint32_t timeout);
 
+/**
+ * Will send a publish packet whose payload is serialized by the specified writer directly into the write buffer and
+ * wait for all acks to complete. The writer is offered the space that remains after the encoded topic and packet id.
+ * The remaining length is backfilled after the writer returns and the whole packet is sent with a single write.
+ *
+ * The payload and payload length of the message are ignored. The options are handled as in lwmqtt_publish(). If the
+ * writer fails or overflows, its error or LWMQTT_BUFFER_TOO_SHORT is returned before anything has been written.
+ *
+ * Note: The message callback might be called with incoming messages as part of this call.
+ *
+ * @param client The client object.
+ * @param options The optional publish options.
+ * @param topic The topic.
+ * @param msg The message.
+ * @param writer The payload writer.
+ * @param ref A custom reference that will be passed to the writer.
+ * @param timeout The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_publish_in_place(lwmqtt_client_t *client, lwmqtt_publish_options_t *options, lwmqtt_string_t topic,
+                                     lwmqtt_message_t msg, lwmqtt_payload_writer_t writer, void *ref,
+                                     uint32_t timeout);
+
 /**
  * Will send a subscribe packet with multiple topic filters plus QOS levels and wait for the suback to complete.
  *
@@ -341,8 +586,10 @@ lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_publish_options_t *o
  * @param timeout The command timeout.
  * @return An error value.
  */
+#if LWMQTT_ENABLE_MULTI
 lwmqtt_err_t lwmqtt_subscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, lwmqtt_qos_t *qos,
                               uint32_t timeout);
+#endif
 
 /**
  * Will send a subscribe packet with a single topic filter plus QOS level and wait for the suback to complete.
@@ -369,7 +616,9 @@ lwmqtt_err_t lwmqtt_subscribe_one(lwmqtt_client_t *client, lwmqtt_string_t topic
  * @param timeout The command timeout.
  * @return An error value.
  */
+#if LWMQTT_ENABLE_MULTI
 lwmqtt_err_t lwmqtt_unsubscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, uint32_t timeout);
+#endif
 
 /**
  * Will send an unsubscribe packet with a single topic filter and wait for the unsuback to complete.
@@ -418,10 +667,61 @@ lwmqtt_err_t lwmqtt_yield(lwmqtt_client_t *client, size_t available, uint32_t ti
  * This functions must be called at a rate slightly lower than 25% of the configured keep alive. If keep alive is zero,
  * the function may not be called at all.
  *
+ * While the connack of a connect sent with skip_ack is awaited, no ping is sent and LWMQTT_NETWORK_TIMEOUT is returned
+ * once the command timeout of the connect has elapsed.
+ *
  * @param client The client object.
  * @param timeout The command timeout.
  * @return An error value.
  */
 lwmqtt_err_t lwmqtt_keep_alive(lwmqtt_client_t *client, uint32_t timeout);
 
+/**
+ * Will return the amount of milliseconds until the client needs to be serviced again by calling lwmqtt_keep_alive().
+ *
+ * The deadline is the next ping or pong of the keep alive and, while the connack of a connect sent with skip_ack is
+ * awaited, the command timeout of that connect. Other acknowledgements awaited separately (e.g. of publishes sent with
+ * skip_ack) have no deadline, as they are accepted whenever they arrive and their packet ids stay allocated until then.
+ * A broker that stopped responding is detected by the keep alive.
+ *
+ * Applications that do not expect incoming data may sleep until this deadline has been reached. A return value of zero
+ * means that the deadline has already been reached.
+ *
+ * @param client The client object.
+ * @return The time until the next deadline or UINT32_MAX if there is no deadline.
+ */
+uint32_t lwmqtt_next_deadline(lwmqtt_client_t *client);
+
+/**
+ * Will return a command timeout derived from the round-trip times measured between sending connect, publish, subscribe,
+ * unsubscribe and ping packets and receiving their acknowledgements. Commands that dispatched an incoming message
+ * while waiting are not measured, as the callback delayed reading the acknowledgement.
+ *
+ * The timeout is calculated from the smoothed round-trip time and its variance like the TCP retransmission timeout
+ * (RFC 6298) and doubled for every consecutive command that expired while waiting for an acknowledgement.
+ *
+ * @param client The client object.
+ * @return The timeout in milliseconds or zero if no round-trip time has been measured yet.
+ */
+#if LWMQTT_ENABLE_RTT
+uint32_t lwmqtt_adaptive_timeout(lwmqtt_client_t *client);
+#endif
+
+/**
+ * Will configure the client to record protocol events into the specified ring buffer. The buffer is owned by the
+ * caller, the oldest events are overwritten once it is full. Network calls that return within a millisecond are not
+ * recorded as their bytes are also reflected by the packet events.
+ *
+ * The number of events recorded so far is available as client->trace_count, the event with the sequence number n is
+ * stored at index n % size.
+ *
+ * @param client The client object.
+ * @param events The event buffer or NULL to stop recording.
+ * @param size The number of events in the buffer.
+ * @param clock The clock used to timestamp events.
+ */
+#if LWMQTT_ENABLE_TRACE
+void lwmqtt_set_trace(lwmqtt_client_t *client, lwmqtt_trace_event_t *events, size_t size, lwmqtt_trace_clock_t clock);
+#endif
+
 #endif  // LWMQTT_H
@@ -0,0 +1,170 @@
+#ifndef LWMQTT_CONFIG_H
+#define LWMQTT_CONFIG_H
+
+/**
+ * The feature profiles.
+ *
+ * Constrained builds may strip unused protocol features by defining one of the following profiles using a build flag
+ * or by defining it at the top of this file:
+ *
+ * - LWMQTT_PROFILE_SMALL: Disables QoS 2, multi topic (un)subscribe, pipelined connects, tracing and packet size
+ *   peaks, as well as the read buffer limit, buffer pools, failover endpoints, TLS session hooks, handler statistics,
+ *   outbound queues and rate limits of the Arduino client.
+ * - LWMQTT_PROFILE_MINIMAL: Additionally disables wills, authentication and the round-trip time measurement, and
+ *   shrinks the packet id window.
+ *
+ * - LWMQTT_PROFILE_FULL: Enables all features on AVR. Without a profile, AVR builds keep QoS 2, multi topic
+ *   (un)subscribe, wills, authentication and the round-trip time measurement, but disable the other features listed for
+ *   LWMQTT_PROFILE_SMALL, so that existing sketches do not grow. Other platforms enable all features by default.
+ *
+ * Individual features may be configured by defining the LWMQTT_ENABLE_* switches below as 0 or 1, which takes
+ * precedence over the selected profile.
+ */
+#if defined(LWMQTT_PROFILE_MINIMAL)
+#define LWMQTT_PROFILE_LEVEL 2
+#elif defined(LWMQTT_PROFILE_SMALL)
+#define LWMQTT_PROFILE_LEVEL 1
+#else
+#define LWMQTT_PROFILE_LEVEL 0
+#endif
+
+#if LWMQTT_PROFILE_LEVEL < 1 && (!defined(__AVR__) || defined(LWMQTT_PROFILE_FULL))
+#define LWMQTT_PROFILE_EXTRAS 1
+#else
+#define LWMQTT_PROFILE_EXTRAS 0
+#endif
+
+/**
+ * Whether QoS 2 is supported. If disabled, QoS 2 publishes and subscriptions are downgraded to QoS 1 and incoming QoS
+ * 2 packets are rejected.
+ */
+#ifndef LWMQTT_ENABLE_QOS2
+#define LWMQTT_ENABLE_QOS2 (LWMQTT_PROFILE_LEVEL < 1)
+#endif
+
+/**
+ * Whether lwmqtt_subscribe() and lwmqtt_unsubscribe() with multiple topic filters are available.
+ */
+#ifndef LWMQTT_ENABLE_MULTI
+#define LWMQTT_ENABLE_MULTI (LWMQTT_PROFILE_LEVEL < 1)
+#endif
+
+/**
+ * Whether lwmqtt_connect_pipelined() is available.
+ */
+#ifndef LWMQTT_ENABLE_PIPELINE
+#define LWMQTT_ENABLE_PIPELINE LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether a will is encoded into the connect packet. If disabled, the will passed to the connect functions is ignored.
+ */
+#ifndef LWMQTT_ENABLE_WILL
+#define LWMQTT_ENABLE_WILL (LWMQTT_PROFILE_LEVEL < 2)
+#endif
+
+/**
+ * Whether the username and password are encoded into the connect packet. If disabled, they are ignored.
+ */
+#ifndef LWMQTT_ENABLE_AUTH
+#define LWMQTT_ENABLE_AUTH (LWMQTT_PROFILE_LEVEL < 2)
+#endif
+
+/**
+ * Whether round-trip times are measured and lwmqtt_adaptive_timeout() is available.
+ */
+#ifndef LWMQTT_ENABLE_RTT
+#define LWMQTT_ENABLE_RTT (LWMQTT_PROFILE_LEVEL < 2)
+#endif
+
+/**
+ * Whether strings may be stored in program memory that cannot be read like regular memory (e.g. PROGMEM on AVR and
+ * ESP8266). If enabled, strings created with lwmqtt_flash_string() are read using memcpy_P() and strlen_P().
+ */
+#ifndef LWMQTT_ENABLE_PROGMEM
+#if defined(__AVR__) || defined(ESP8266)
+#define LWMQTT_ENABLE_PROGMEM 1
+#else
+#define LWMQTT_ENABLE_PROGMEM 0
+#endif
+#endif
+
+/**
+ * Whether protocol events can be recorded into a trace ring buffer using lwmqtt_set_trace().
+ */
+#ifndef LWMQTT_ENABLE_TRACE
+#define LWMQTT_ENABLE_TRACE LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the size of the largest incoming and outgoing packet is recorded in the read_peak and write_peak fields.
+ */
+#ifndef LWMQTT_ENABLE_PEAKS
+#define LWMQTT_ENABLE_PEAKS LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client can grow its read buffer on demand using setReadBufferLimit().
+ */
+#ifndef LWMQTT_ENABLE_READ_LIMIT
+#define LWMQTT_ENABLE_READ_LIMIT LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client can borrow its packet buffers from an MQTTBufferPool.
+ */
+#ifndef LWMQTT_ENABLE_BUFFER_POOL
+#define LWMQTT_ENABLE_BUFFER_POOL LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client can fail over between endpoints added using addEndpoint() and resolve them using a
+ * custom resolver.
+ */
+#ifndef LWMQTT_ENABLE_ENDPOINTS
+#define LWMQTT_ENABLE_ENDPOINTS LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client can resume TLS sessions using setTLSSessionHooks() and reports handshake statistics.
+ */
+#ifndef LWMQTT_ENABLE_TLS_SESSION
+#define LWMQTT_ENABLE_TLS_SESSION LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client measures the duration of message callbacks and reports slow handlers.
+ */
+#ifndef LWMQTT_ENABLE_HANDLER_STATS
+#define LWMQTT_ENABLE_HANDLER_STATS LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client can queue outgoing bytes using setOutboundQueue() and prioritize them.
+ */
+#ifndef LWMQTT_ENABLE_OUTBOUND_QUEUE
+#define LWMQTT_ENABLE_OUTBOUND_QUEUE LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * Whether the Arduino client can limit the rate of publishes using setRateLimit().
+ */
+#ifndef LWMQTT_ENABLE_RATE_LIMIT
+#define LWMQTT_ENABLE_RATE_LIMIT LWMQTT_PROFILE_EXTRAS
+#endif
+
+/**
+ * The number of slots (a multiple of 8) of the bitmap that tracks packet ids awaiting acknowledgement, each slot costs
+ * one bit in the client. A packet id occupies the slot of its value modulo the window and is not allocated again until
+ * its acknowledgement has been received or a new connection has been started, so at most this many packets may be
+ * in flight at once. If set to 0, packet ids are allocated sequentially without tracking.
+ */
+#ifndef LWMQTT_PACKET_ID_WINDOW
+#if LWMQTT_PROFILE_LEVEL < 2
+#define LWMQTT_PACKET_ID_WINDOW 32
+#else
+#define LWMQTT_PACKET_ID_WINDOW 8
+#endif
+#endif
+
+#endif  // LWMQTT_CONFIG_H
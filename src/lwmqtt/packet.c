@@ -25,9 +25,11 @@ lwmqtt_err_t lwmqtt_detect_packet_type(uint8_t *buf, size_t buf_len, lwmqtt_pack
     case LWMQTT_CONNACK_PACKET:
     case LWMQTT_PUBLISH_PACKET:
     case LWMQTT_PUBACK_PACKET:
+#if LWMQTT_ENABLE_QOS2
     case LWMQTT_PUBREC_PACKET:
     case LWMQTT_PUBREL_PACKET:
     case LWMQTT_PUBCOMP_PACKET:
+#endif
     case LWMQTT_SUBACK_PACKET:
     case LWMQTT_UNSUBACK_PACKET:
     case LWMQTT_PINGRESP_PACKET:
@@ -67,11 +69,16 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
   // add client id to remaining length
   rem_len += options->client_id.len + 2;
 
+#if LWMQTT_ENABLE_WILL
   // add will if present to remaining length
   if (will != NULL) {
     rem_len += will->topic.len + 2 + will->payload.len + 2;
   }
+#else
+  (void)will;
+#endif
 
+#if LWMQTT_ENABLE_AUTH
   // add username if username or password is present to remaining length
   if (options->username.len > 0 || options->password.len > 0) {
     rem_len += options->username.len + 2;
@@ -81,6 +88,7 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
       rem_len += options->password.len + 2;
     }
   }
+#endif
 
   // check remaining length length
   int rem_len_len;
@@ -123,13 +131,16 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
   // set clean session
   lwmqtt_write_bits(&flags, (uint8_t)(options->clean_session), 1, 1);
 
+#if LWMQTT_ENABLE_WILL
   // set will flags if present
   if (will != NULL) {
     lwmqtt_write_bits(&flags, 1, 2, 1);
     lwmqtt_write_bits(&flags, will->qos, 3, 2);
     lwmqtt_write_bits(&flags, (uint8_t)(will->retained), 5, 1);
   }
+#endif
 
+#if LWMQTT_ENABLE_AUTH
   // set username flag if username or password is present
   if (options->username.len > 0 || options->password.len > 0) {
     lwmqtt_write_bits(&flags, 1, 7, 1);
@@ -139,6 +150,7 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
       lwmqtt_write_bits(&flags, 1, 6, 1);
     }
   }
+#endif
 
   // write flags
   err = lwmqtt_write_byte(&buf_ptr, buf_end, flags);
@@ -158,6 +170,7 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
     return err;
   }
 
+#if LWMQTT_ENABLE_WILL
   // write will if present
   if (will != NULL) {
     // write topic
@@ -166,19 +179,15 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
       return err;
     }
 
-    // write payload length
-    err = lwmqtt_write_num(&buf_ptr, buf_end, (uint16_t)will->payload.len);
-    if (err != LWMQTT_SUCCESS) {
-      return err;
-    }
-
-    // write payload
-    err = lwmqtt_write_data(&buf_ptr, buf_end, (uint8_t *)will->payload.data, will->payload.len);
+    // write payload (length prefixed like a string)
+    err = lwmqtt_write_string(&buf_ptr, buf_end, will->payload);
     if (err != LWMQTT_SUCCESS) {
       return err;
     }
   }
+#endif
 
+#if LWMQTT_ENABLE_AUTH
   // write username if username of password is present
   if (options->username.len > 0 || options->password.len > 0) {
     err = lwmqtt_write_string(&buf_ptr, buf_end, options->username);
@@ -194,6 +203,7 @@ lwmqtt_err_t lwmqtt_encode_connect(uint8_t *buf, size_t buf_len, size_t *len, lw
       return err;
     }
   }
+#endif
 
   // set written length
   *len = buf_ptr - buf;
@@ -344,6 +354,34 @@ lwmqtt_err_t lwmqtt_decode_ack(uint8_t *buf, size_t buf_len, lwmqtt_packet_type_
   return LWMQTT_SUCCESS;
 }
 
+lwmqtt_err_t lwmqtt_decode_packet_id(uint8_t *buf, size_t buf_len, uint16_t *packet_id) {
+  // prepare pointer
+  uint8_t *buf_ptr = buf;
+  uint8_t *buf_end = buf + buf_len;
+
+  // read header
+  uint8_t header = 0;
+  lwmqtt_err_t err = lwmqtt_read_byte(&buf_ptr, buf_end, &header);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // read remaining length
+  uint32_t rem_len;
+  err = lwmqtt_read_varnum(&buf_ptr, buf_end, &rem_len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // check remaining length
+  if (rem_len < 2) {
+    return LWMQTT_REMAINING_LENGTH_MISMATCH;
+  }
+
+  // read packet id
+  return lwmqtt_read_num(&buf_ptr, buf_end, packet_id);
+}
+
 lwmqtt_err_t lwmqtt_encode_ack(uint8_t *buf, size_t buf_len, size_t *len, lwmqtt_packet_type_t packet_type,
                                uint16_t packet_id) {
   // prepare pointer
@@ -415,9 +453,11 @@ lwmqtt_err_t lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint
     case 1:
       msg->qos = LWMQTT_QOS1;
       break;
+#if LWMQTT_ENABLE_QOS2
     case 2:
       msg->qos = LWMQTT_QOS2;
       break;
+#endif
     default:
       return LWMQTT_MISSING_OR_WRONG_PACKET;
   }
@@ -463,6 +503,9 @@ lwmqtt_err_t lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint
 
   // set payload length
   msg->payload_len = buf_end - buf_ptr;
+#if LWMQTT_ENABLE_PROGMEM
+  msg->flash = false;
+#endif
 
   // read payload
   err = lwmqtt_read_data(&buf_ptr, buf_end, &msg->payload, buf_end - buf_ptr);
@@ -502,7 +545,11 @@ lwmqtt_err_t lwmqtt_encode_publish(uint8_t *buf, size_t buf_len, size_t *len, bo
   lwmqtt_write_bits(&header, (uint8_t)(dup), 3, 1);
 
   // set qos
+#if LWMQTT_ENABLE_QOS2
   lwmqtt_write_bits(&header, msg.qos, 1, 2);
+#else
+  lwmqtt_write_bits(&header, (uint8_t)(msg.qos > LWMQTT_QOS1 ? LWMQTT_QOS1 : msg.qos), 1, 2);
+#endif
 
   // set retained
   lwmqtt_write_bits(&header, (uint8_t)(msg.retained), 0, 1);
@@ -594,7 +641,11 @@ lwmqtt_err_t lwmqtt_encode_subscribe(uint8_t *buf, size_t buf_len, size_t *len,
     }
 
     // write qos level
+#if LWMQTT_ENABLE_QOS2
     err = lwmqtt_write_byte(&buf_ptr, buf_end, (uint8_t)qos_levels[i]);
+#else
+    err = lwmqtt_write_byte(&buf_ptr, buf_end, (uint8_t)(qos_levels[i] > LWMQTT_QOS1 ? LWMQTT_QOS1 : qos_levels[i]));
+#endif
     if (err != LWMQTT_SUCCESS) {
       return err;
     }
@@ -94,6 +94,17 @@ lwmqtt_err_t lwmqtt_encode_zero(uint8_t *buf, size_t buf_len, size_t *len, lwmqt
  */
 lwmqtt_err_t lwmqtt_decode_ack(uint8_t *buf, size_t buf_len, lwmqtt_packet_type_t packet_type, uint16_t *packet_id);
 
+/**
+ * Decodes the packet id that follows the fixed header of an ack (puback, pubrec, pubrel, pubcomp, suback, unsuback)
+ * packet without checking the rest of the packet.
+ *
+ * @param buf The raw buffer data.
+ * @param buf_len The length of the specified buffer.
+ * @param packet_id The packet id.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_decode_packet_id(uint8_t *buf, size_t buf_len, uint16_t *packet_id);
+
 /**
  * Encodes an ack (puback, pubrec, pubrel, pubcomp) packet into the supplied buffer.
  *
@@ -1,11 +1,14 @@
 #include <string.h>
 
-#include "lwmqtt.h"
+#include "helpers.h"
 
 lwmqtt_string_t lwmqtt_string(const char *str) {
+  // prepare string
+  lwmqtt_string_t ret = lwmqtt_default_string;
+
   // check for null
   if (str == NULL) {
-    return (lwmqtt_string_t){0, NULL};
+    return ret;
   }
 
   // get length
@@ -13,10 +16,43 @@ lwmqtt_string_t lwmqtt_string(const char *str) {
 
   // check zero length
   if (len == 0) {
-    return (lwmqtt_string_t){0, NULL};
+    return ret;
+  }
+
+  // set data
+  ret.len = len;
+  ret.data = (char *)str;
+
+  return ret;
+}
+
+lwmqtt_string_t lwmqtt_flash_string(const char *str) {
+#if LWMQTT_ENABLE_PROGMEM
+  // prepare string
+  lwmqtt_string_t ret = lwmqtt_default_string;
+
+  // check for null
+  if (str == NULL) {
+    return ret;
+  }
+
+  // get length from program memory
+  uint16_t len = (uint16_t)strlen_P(str);
+
+  // check zero length
+  if (len == 0) {
+    return ret;
   }
 
-  return (lwmqtt_string_t){len, (char *)str};
+  // set data
+  ret.len = len;
+  ret.data = (char *)str;
+  ret.flash = true;
+
+  return ret;
+#else
+  return lwmqtt_string(str);
+#endif
 }
 
 int lwmqtt_strcmp(lwmqtt_string_t a, const char *b) {
@@ -33,6 +69,50 @@ int lwmqtt_strcmp(lwmqtt_string_t a, const char *b) {
     return -1;
   }
 
+#if LWMQTT_ENABLE_PROGMEM
+  // compare memory with program memory of same length
+  if (a.flash) {
+    return -strncmp_P(b_str.data, a.data, a.len);
+  }
+#endif
+
   // compare memory of same length
   return strncmp(a.data, b_str.data, a.len);
 }
+
+bool lwmqtt_topic_match(lwmqtt_string_t filter, lwmqtt_string_t topic) {
+  // do not match system topics with a wildcard at the first level
+  if (topic.len > 0 && topic.data[0] == '$' && filter.len > 0 && (filter.data[0] == '+' || filter.data[0] == '#')) {
+    return false;
+  }
+
+  // compare filter and topic
+  uint16_t f = 0;
+  uint16_t t = 0;
+  while (f < filter.len) {
+    // match remaining levels on multi level wildcard
+    if (filter.data[f] == '#') {
+      return true;
+    }
+
+    // skip topic level on single level wildcard
+    if (filter.data[f] == '+') {
+      while (t < topic.len && topic.data[t] != '/') {
+        t++;
+      }
+      f++;
+      continue;
+    }
+
+    // handle mismatch, a trailing "/#" also matches the parent level
+    if (t >= topic.len || filter.data[f] != topic.data[t]) {
+      return t == topic.len && f + 2 == filter.len && filter.data[f] == '/' && filter.data[f + 1] == '#';
+    }
+
+    // advance
+    f++;
+    t++;
+  }
+
+  return t == topic.len;
+}